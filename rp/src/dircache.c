@@ -0,0 +1,220 @@
+/**
+ * File: dircache.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: In-RAM cache of SD card directory listings
+ */
+
+#include "dircache.h"
+
+// Growth step of the buffer of a listing while reading the folder
+#define DIRCACHE_GROW_SIZE 1024
+
+// Fixed part of a packed entry, followed by the name without terminator
+typedef struct {
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  BYTE fattrib;
+  BYTE nameLen;
+} dircache_entry_t;
+
+static dircache_listing_t listings[DIRCACHE_MAX_LISTINGS] = {0};
+static uint32_t useCounter = 0;
+
+// Last folder found too large to be cached, not worth reading twice
+static char oversized[DIRCACHE_PATH_SIZE] = {0};
+
+// Collapse repeated slashes and drop the trailing one, so the same folder
+// always has the same key. FAT names ignore the case, so the keys are
+// compared with strcasecmp().
+static void normalize_path(const char *in, char *out, size_t outLen) {
+  size_t o = 0;
+  for (size_t i = 0; in[i] && o < outLen - 1; i++) {
+    if (in[i] == '/' && o > 0 && out[o - 1] == '/') continue;
+    out[o++] = in[i];
+  }
+  if (o > 1 && out[o - 1] == '/') o--;
+  if (o == 0) out[o++] = '/';
+  out[o] = '\0';
+}
+
+static void free_listing(dircache_listing_t *listing) {
+  free(listing->data);
+  memset(listing, 0, sizeof(dircache_listing_t));
+}
+
+// Drop a listing now, or when its last user releases it
+static void drop_listing(dircache_listing_t *listing) {
+  if (listing->users > 0) {
+    listing->stale = true;
+  } else {
+    free_listing(listing);
+  }
+}
+
+static size_t used_bytes(void) {
+  size_t total = 0;
+  for (int i = 0; i < DIRCACHE_MAX_LISTINGS; i++) {
+    if (listings[i].in_use) total += listings[i].size;
+  }
+  return total;
+}
+
+// Free the least recently used listing nobody is reading
+static bool evict_one(void) {
+  dircache_listing_t *lru = NULL;
+  for (int i = 0; i < DIRCACHE_MAX_LISTINGS; i++) {
+    dircache_listing_t *l = &listings[i];
+    if (l->in_use && l->users == 0 && (!lru || l->lastUsed < lru->lastUsed)) {
+      lru = l;
+    }
+  }
+  if (!lru) return false;
+  DPRINTF("Evicting cached listing of %s\n", lru->folder);
+  free_listing(lru);
+  return true;
+}
+
+// Read the whole folder into a packed buffer. Fails if it is larger than the
+// cache.
+static bool read_folder(const char *folder, dircache_listing_t *listing) {
+  DIR dir;
+  FILINFO fno;
+  FRESULT fr = f_opendir(&dir, folder);
+  if (fr != FR_OK) {
+    DPRINTF("Failed to open directory %s, error %d\n", folder, fr);
+    return false;
+  }
+  size_t capacity = 0;
+  bool ok = true;
+  for (;;) {
+    fr = f_readdir(&dir, &fno);
+    if (fr != FR_OK) ok = false;
+    if (fr != FR_OK || fno.fname[0] == '\0') break;
+    size_t nameLen = strlen(fno.fname);
+    size_t need = listing->size + sizeof(dircache_entry_t) + nameLen;
+    if (need > DIRCACHE_MAX_BYTES) {
+      DPRINTF("Listing of %s too large to cache\n", folder);
+      strncpy(oversized, folder, sizeof(oversized) - 1);
+      ok = false;
+      break;
+    }
+    if (need > capacity) {
+      capacity += DIRCACHE_GROW_SIZE;
+      if (capacity > DIRCACHE_MAX_BYTES) capacity = DIRCACHE_MAX_BYTES;
+      if (capacity < need) capacity = need;
+      uint8_t *data = realloc(listing->data, capacity);
+      if (!data) {
+        ok = false;
+        break;
+      }
+      listing->data = data;
+    }
+    dircache_entry_t entry = {.fsize = fno.fsize,
+                              .fdate = fno.fdate,
+                              .ftime = fno.ftime,
+                              .fattrib = fno.fattrib,
+                              .nameLen = (BYTE)nameLen};
+    memcpy(listing->data + listing->size, &entry, sizeof(entry));
+    memcpy(listing->data + listing->size + sizeof(entry), fno.fname, nameLen);
+    listing->size = need;
+    listing->count++;
+  }
+  f_closedir(&dir);
+  return ok;
+}
+
+dircache_listing_t *dircache_get(const char *folder) {
+  char key[DIRCACHE_PATH_SIZE];
+  normalize_path(folder, key, sizeof(key));
+  for (int i = 0; i < DIRCACHE_MAX_LISTINGS; i++) {
+    dircache_listing_t *l = &listings[i];
+    if (l->in_use && !l->stale && strcasecmp(l->folder, key) == 0) {
+      l->users++;
+      l->lastUsed = ++useCounter;
+      DPRINTF("Listing of %s served from the cache\n", key);
+      return l;
+    }
+  }
+  if (strcasecmp(oversized, key) == 0) return NULL;
+
+  dircache_listing_t *listing = NULL;
+  do {
+    for (int i = 0; i < DIRCACHE_MAX_LISTINGS && !listing; i++) {
+      if (!listings[i].in_use) listing = &listings[i];
+    }
+  } while (!listing && evict_one());
+  if (!listing) return NULL;
+
+  listing->in_use = true;
+  strncpy(listing->folder, key, sizeof(listing->folder) - 1);
+  if (!read_folder(key, listing)) {
+    free_listing(listing);
+    return NULL;
+  }
+  // Make room for the new listing. If the others are busy, it is only used
+  // once.
+  while (used_bytes() > DIRCACHE_MAX_BYTES && evict_one()) {
+  }
+  if (used_bytes() > DIRCACHE_MAX_BYTES) listing->stale = true;
+  listing->users = 1;
+  listing->lastUsed = ++useCounter;
+  DPRINTF("Cached listing of %s: %d entries, %u bytes\n", key, listing->count,
+          (unsigned)listing->size);
+  return listing;
+}
+
+void dircache_release(dircache_listing_t *listing) {
+  if (!listing || !listing->in_use) return;
+  if (listing->users > 0) listing->users--;
+  if (listing->users == 0 && listing->stale) free_listing(listing);
+}
+
+bool dircache_read(const dircache_listing_t *listing, size_t *pos,
+                   FILINFO *fno) {
+  if (*pos + sizeof(dircache_entry_t) > listing->size) return false;
+  dircache_entry_t entry;
+  memcpy(&entry, listing->data + *pos, sizeof(entry));
+  fno->fsize = entry.fsize;
+  fno->fdate = entry.fdate;
+  fno->ftime = entry.ftime;
+  fno->fattrib = entry.fattrib;
+  memcpy(fno->fname, listing->data + *pos + sizeof(entry), entry.nameLen);
+  fno->fname[entry.nameLen] = '\0';
+  *pos += sizeof(entry) + entry.nameLen;
+  return true;
+}
+
+void dircache_invalidate(const char *path) {
+  char key[DIRCACHE_PATH_SIZE];
+  normalize_path(path, key, sizeof(key));
+  size_t keyLen = strlen(key);
+  // The folder containing the path
+  char parent[DIRCACHE_PATH_SIZE];
+  strcpy(parent, key);
+  char *slash = strrchr(parent, '/');
+  if (slash) slash[slash == parent ? 1 : 0] = '\0';
+  if (strcasecmp(oversized, key) == 0 || strcasecmp(oversized, parent) == 0) {
+    oversized[0] = '\0';
+  }
+  for (int i = 0; i < DIRCACHE_MAX_LISTINGS; i++) {
+    dircache_listing_t *l = &listings[i];
+    if (!l->in_use || l->stale) continue;
+    bool below = strncasecmp(l->folder, key, keyLen) == 0 &&
+                 (l->folder[keyLen] == '\0' || l->folder[keyLen] == '/' ||
+                  keyLen == 1);
+    if (below || strcasecmp(l->folder, parent) == 0) {
+      DPRINTF("Invalidating cached listing of %s\n", l->folder);
+      drop_listing(l);
+    }
+  }
+}
+
+void dircache_invalidateAll(void) {
+  for (int i = 0; i < DIRCACHE_MAX_LISTINGS; i++) {
+    if (listings[i].in_use && !listings[i].stale) drop_listing(&listings[i]);
+  }
+  oversized[0] = '\0';
+}
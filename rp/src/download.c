@@ -8,14 +8,63 @@
 
 #include "download.h"
 
-// Download
-static FIL file;
-static download_status_t downloadStatus = DOWNLOAD_STATUS_IDLE;
-static HTTPC_REQUEST_T request = {0};
-static download_url_components_t components;
-static download_file_t fileUrl;
-static char url[DOWNLOAD_BUFFLINE_SIZE] = {0};
-static char dst_folder[DOWNLOAD_BUFFLINE_SIZE] = {0};
+// Where the decoder of a chunked body is: in the size line of a chunk, in
+// its data, in the CRLF after the data, or in the trailer after the last one
+typedef enum {
+  DOWNLOAD_CHUNK_SIZE,
+  DOWNLOAD_CHUNK_EXTENSION,
+  DOWNLOAD_CHUNK_DATA,
+  DOWNLOAD_CHUNK_DATA_END,
+  DOWNLOAD_CHUNK_TRAILER,
+  DOWNLOAD_CHUNK_DONE
+} download_chunk_state_t;
+
+// A transfer in progress: the HTTP request and the file it writes
+typedef struct {
+  download_item_t *item;  // NULL when the slot is free
+  FIL file;
+  writeback_stream_t *stream;  // Writes the body on core 1, NULL until open
+  struct altcp_pcb *conn;      // Connection receiving the body
+  HTTPC_REQUEST_T request;
+  download_url_components_t components;  // Of the URL requested
+  // Redirects followed, and the URL to request next when redirect is set
+  uint8_t redirects;
+  bool redirect;
+  char location[DOWNLOAD_BUFFLINE_SIZE];
+  // Decoding of a chunked body
+  bool chunked;
+  download_chunk_state_t chunkState;
+  uint32_t chunkLeft;    // Size of the chunk, then the bytes left of its data
+  uint16_t chunkDigits;  // Digits of the size, or characters of a trailer
+  // Validator of the file, sent with the range of a resumed request
+  char validator[DOWNLOAD_VALIDATOR_SIZE];
+  char requestUri[DOWNLOAD_BUFFLINE_SIZE + DOWNLOAD_VALIDATOR_SIZE + 64];
+} download_slot_t;
+
+// Hash of the first bytes of the file of a download, kept across its retries
+typedef struct {
+  uint32_t hashed;  // Bytes hashed
+  union {
+    mbedtls_md5_context md5;
+    mbedtls_sha256_context sha256;
+  };
+} download_digest_t;
+
+static download_item_t items[DOWNLOAD_MAX_QUEUE] = {0};
+static download_digest_t digests[DOWNLOAD_MAX_QUEUE];
+static download_slot_t slots[DOWNLOAD_MAX_SLOTS] = {0};
+static uint32_t nextId = 1;
+static uint32_t version = 0;
+
+// Room for the name of the file of a download with an extension added
+#define DOWNLOAD_EXT_PATH_SIZE (DOWNLOAD_BUFFLINE_SIZE + 8)
+
+// The sidecar files are read and written at once, one at a time
+static FIL sidecar;
+
+static const char *status_names[] = {"idle",        "requested", "started",
+                                     "in_progress", "resuming",  "completed",
+                                     "failed"};
 
 // Parses a URL into its components and extracts the file name.
 static int parseUrl(const char *url, download_url_components_t *components,
@@ -86,134 +135,364 @@ static int parseUrl(const char *url, download_url_components_t *components,
   return 0;  // Success.
 }
 
-// Save body to file
-static err_t httpClientReceiveFileFn(__unused void *arg,
-                                     __unused struct altcp_pcb *conn,
-                                     struct pbuf *ptr, err_t err) {
-  // Check for null input or errors
-  if (ptr == NULL) {
-    DPRINTF("End of data or connection closed by the server.\n");
-    downloadStatus = DOWNLOAD_STATUS_COMPLETED;
-    return ERR_OK;  // Signal the connection closure
-  }
+static void set_status(download_item_t *item, download_status_t status) {
+  if (item->status != status) version++;
+  item->status = status;
+}
 
-  if (err != ERR_OK) {
-    DPRINTF("Error receiving file: %i\n", err);
-    downloadStatus = DOWNLOAD_STATUS_FAILED;
-    return ERR_VAL;  // Invalid input or error occurred
+static void fail(download_item_t *item, download_err_t error) {
+  item->error = error;
+  item->endTime = get_absolute_time();
+  set_status(item, DOWNLOAD_STATUS_FAILED);
+}
+
+static download_digest_t *digest_of(const download_item_t *item) {
+  return &digests[item - items];
+}
+
+static void digest_start(const download_item_t *item) {
+  download_digest_t *digest = digest_of(item);
+  digest->hashed = 0;
+  if (item->hashType == DOWNLOAD_HASH_MD5) {
+    mbedtls_md5_init(&digest->md5);
+    mbedtls_md5_starts_ret(&digest->md5);
+  } else if (item->hashType == DOWNLOAD_HASH_SHA256) {
+    mbedtls_sha256_init(&digest->sha256);
+    mbedtls_sha256_starts_ret(&digest->sha256, 0);
   }
+}
 
-  // Allocate buffer to hold pbuf content
-  char *buffc = malloc(ptr->tot_len);
-  if (buffc == NULL) {
-    DPRINTF("Error allocating memory\n");
-    downloadStatus = DOWNLOAD_STATUS_FAILED;
-    return ERR_MEM;  // Memory allocation failed
+// Hash the data of a pbuf chain, as it is received
+static void digest_update(const download_item_t *item, const struct pbuf *p) {
+  download_digest_t *digest = digest_of(item);
+  for (const struct pbuf *q = p; q != NULL; q = q->next) {
+    const unsigned char *data = (const unsigned char *)q->payload;
+    if (item->hashType == DOWNLOAD_HASH_MD5) {
+      mbedtls_md5_update_ret(&digest->md5, data, q->len);
+    } else {
+      mbedtls_sha256_update_ret(&digest->sha256, data, q->len);
+    }
+    digest->hashed += q->len;
   }
+}
 
-  // Use pbuf_copy_partial to copy the pbuf content to the buffer
-  pbuf_copy_partial(ptr, buffc, ptr->tot_len, 0);
+// Compare the hash of all the data with the checksum expected
+static bool digest_matches(const download_item_t *item) {
+  download_digest_t *digest = digest_of(item);
+  unsigned char hash[DOWNLOAD_HASH_SIZE];
+  size_t len;
+  if (item->hashType == DOWNLOAD_HASH_MD5) {
+    mbedtls_md5_finish_ret(&digest->md5, hash);
+    mbedtls_md5_free(&digest->md5);
+    len = 16;
+  } else {
+    mbedtls_sha256_finish_ret(&digest->sha256, hash);
+    mbedtls_sha256_free(&digest->sha256);
+    len = 32;
+  }
+  digest->hashed = 0;
+  return memcmp(hash, item->hash, len) == 0;
+}
 
-  // Write the buffer to the file. File descriptor is 'file'
-  FRESULT res;
-  UINT bytesWritten;
-  res = f_write(&file, buffc, ptr->tot_len, &bytesWritten);
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
 
-  // Free the allocated memory
-  free(buffc);
+// Parse a checksum in hexadecimal, its length tells MD5 from SHA-256
+static bool parse_hash(const char *hex, download_hash_t *type, uint8_t *hash) {
+  size_t len = hex ? strlen(hex) : 0;
+  if (len == 0) {
+    *type = DOWNLOAD_HASH_NONE;
+    return true;
+  }
+  if (len == 32) {
+    *type = DOWNLOAD_HASH_MD5;
+  } else if (len == 64) {
+    *type = DOWNLOAD_HASH_SHA256;
+  } else {
+    return false;
+  }
+  for (size_t i = 0; i < len / 2; i++) {
+    int high = hex_value(hex[i * 2]);
+    int low = hex_value(hex[i * 2 + 1]);
+    if (high < 0 || low < 0) return false;
+    hash[i] = (uint8_t)(high << 4 | low);
+  }
+  return true;
+}
 
-  // Check for file write errors
-  if (res != FR_OK || bytesWritten != ptr->tot_len) {
-    DPRINTF("Error writing to file: %i\n", res);
-    downloadStatus = DOWNLOAD_STATUS_FAILED;
-    return ERR_ABRT;  // Abort on failure
+// Request the download again after a delay, or fail once the retries run
+// out. The count starts again when a resumed request received data.
+static void retry_download(download_slot_t *slot, download_err_t error) {
+  download_item_t *item = slot->item;
+  if (item->offset > 0 && item->received > item->offset) item->retries = 0;
+  if (item->retries >= DOWNLOAD_MAX_RETRIES) {
+    fail(item, error);
+    return;
   }
+  uint32_t delay = DOWNLOAD_RETRY_MIN_MS << item->retries;
+  if (delay > DOWNLOAD_RETRY_MAX_MS) delay = DOWNLOAD_RETRY_MAX_MS;
+  DPRINTF("Download %lu interrupted at %lu bytes, retry in %lu ms\n",
+          (unsigned long)item->id, (unsigned long)item->received,
+          (unsigned long)delay);
+  item->retries++;
+  item->error = error;
+  item->retryTime = make_timeout_time_ms(delay);
+  set_status(item, DOWNLOAD_STATUS_RESUMING);
+}
 
-  // Acknowledge that we received the data
+// Acknowledge the data once it is on the card, so the TCP window follows the
+// free buffers of the stream
+static void httpClientRecvedFn(void *arg, u16_t len) {
+  download_slot_t *slot = (download_slot_t *)arg;
 #if FMANAGER_DOWNLOAD_HTTPS == 1
-  altcp_recved(conn, ptr->tot_len);
+  altcp_recved(slot->conn, len);
 #else
-  tcp_recved(conn, ptr->tot_len);
+  tcp_recved(slot->conn, len);
 #endif
+}
 
-  // Free the pbuf
-  pbuf_free(ptr);
+// Fail the download and close its connection from the receive callback
+static err_t abort_download(download_slot_t *slot, struct altcp_pcb *conn,
+                            download_err_t error) {
+  fail(slot->item, error);
+#if FMANAGER_DOWNLOAD_HTTPS == 1
+  altcp_abort(conn);
+#else
+  tcp_abort(conn);
+#endif
+  return ERR_ABRT;
+}
 
-  downloadStatus = DOWNLOAD_STATUS_IN_PROGRESS;
-  return ERR_OK;
+// Decode a chunked body in place: the data of the chunks is moved to the
+// start of each pbuf and the framing is dropped. Returns false if the body is
+// not valid.
+static bool dechunk(download_slot_t *slot, struct pbuf *p) {
+  for (struct pbuf *q = p; q != NULL; q = q->next) {
+    uint8_t *data = (uint8_t *)q->payload;
+    u16_t in = 0;
+    u16_t out = 0;
+    while (in < q->len) {
+      if (slot->chunkState == DOWNLOAD_CHUNK_DATA) {
+        u16_t n = q->len - in;
+        if (n > slot->chunkLeft) n = (u16_t)slot->chunkLeft;
+        memmove(&data[out], &data[in], n);
+        in += n;
+        out += n;
+        slot->chunkLeft -= n;
+        if (slot->chunkLeft == 0) slot->chunkState = DOWNLOAD_CHUNK_DATA_END;
+        continue;
+      }
+      uint8_t c = data[in++];
+      switch (slot->chunkState) {
+        case DOWNLOAD_CHUNK_SIZE:
+          if (isxdigit(c) && slot->chunkLeft <= 0x0FFFFFFF) {
+            slot->chunkLeft = slot->chunkLeft * 16 +
+                              (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            slot->chunkDigits++;
+            break;
+          }
+          if (c != ';' && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+            return false;
+          }
+          if (slot->chunkDigits == 0) return false;
+          slot->chunkState = DOWNLOAD_CHUNK_EXTENSION;
+          // fall through
+        case DOWNLOAD_CHUNK_EXTENSION:
+          // Chunk extensions are ignored up to the end of the line
+          if (c != '\n') break;
+          if (slot->chunkLeft > 0) {
+            slot->chunkState = DOWNLOAD_CHUNK_DATA;
+          } else {
+            slot->chunkState = DOWNLOAD_CHUNK_TRAILER;
+            slot->chunkDigits = 0;
+          }
+          break;
+        case DOWNLOAD_CHUNK_DATA_END:
+          if (c == '\n') {
+            slot->chunkState = DOWNLOAD_CHUNK_SIZE;
+            slot->chunkDigits = 0;
+          } else if (c != '\r') {
+            return false;
+          }
+          break;
+        case DOWNLOAD_CHUNK_TRAILER:
+          // The trailer lines end with an empty line. chunkDigits counts the
+          // characters of the current line.
+          if (c == '\n') {
+            if (slot->chunkDigits == 0) slot->chunkState = DOWNLOAD_CHUNK_DONE;
+            slot->chunkDigits = 0;
+          } else if (c != '\r') {
+            slot->chunkDigits++;
+          }
+          break;
+        default:
+          // Anything after the last chunk is dropped
+          break;
+      }
+    }
+    q->len = out;
+  }
+  // The lengths of the chain changed
+  u16_t left = 0;
+  for (struct pbuf *q = p; q != NULL; q = q->next) left += q->len;
+  for (struct pbuf *q = p; q != NULL; q = q->next) {
+    q->tot_len = left;
+    left -= q->len;
+  }
+  return true;
 }
 
-// Function to parse headers and check Content-Length
-static err_t httpClientHeaderCheckSizeFn(__unused httpc_state_t *connection,
-                                         __unused void *arg, struct pbuf *hdr,
-                                         u16_t hdrLen,
-                                         __unused u32_t contentLen) {
-  downloadStatus = DOWNLOAD_STATUS_FAILED;
-  const char *contentLengthLabel = "Content-Length:";
-  u16_t offset = 0;
-  char *headerData = malloc(hdrLen + 1);
+// Save body to file. Core 1 writes the data queued in the stream.
+static err_t httpClientReceiveFileFn(void *arg, struct altcp_pcb *conn,
+                                     struct pbuf *ptr, err_t err) {
+  download_slot_t *slot = (download_slot_t *)arg;
+  download_item_t *item = slot->item;
+  // Check for null input or errors
+  if (ptr == NULL) {
+    DPRINTF("End of data or connection closed by the server.\n");
+    set_status(item, DOWNLOAD_STATUS_COMPLETED);
+    return ERR_OK;  // Signal the connection closure
+  }
 
-  if (headerData == NULL) {
-    return ERR_MEM;  // Memory allocation failed
+  if (err != ERR_OK) {
+    DPRINTF("Error receiving file: %i\n", err);
+    fail(item, DOWNLOAD_FORCEDABORT_ERROR);
+    return ERR_VAL;  // Invalid input or error occurred
   }
 
-  // Copy header data into a buffer for parsing
-  pbuf_copy_partial(hdr, headerData, hdrLen, 0);
-  headerData[hdrLen] = '\0';  // Null-terminate the string
+  // The data is acknowledged by httpClientRecvedFn() once written, and the
+  // framing of the chunks right away
+  slot->conn = conn;
+  u16_t received = ptr->tot_len;
+  if (slot->chunked && !dechunk(slot, ptr)) {
+    DPRINTF("Invalid chunk in the body\n");
+    pbuf_free(ptr);
+    return abort_download(slot, conn, DOWNLOAD_BADRESPONSE_ERROR);
+  }
+  u16_t len = ptr->tot_len;
+  if (received > len) httpClientRecvedFn(slot, received - len);
+  if (len == 0) {
+    pbuf_free(ptr);
+  } else {
+    // Hashed as it arrives, the file is not read again
+    if (item->hashType != DOWNLOAD_HASH_NONE) digest_update(item, ptr);
+    if (writeback_receive(slot->stream, ptr) != ERR_OK) {
+      DPRINTF("Error writing to file: %i\n", slot->stream->error);
+      return abort_download(slot, conn, DOWNLOAD_FORCEDABORT_ERROR);
+    }
+  }
+  item->received += len;
 
-  // Find the Content-Length header
-  char *contentLengthStart = strstr(headerData, contentLengthLabel);
-  if (contentLengthStart != NULL) {
-    contentLengthStart +=
-        strlen(contentLengthLabel);  // Move past "Content-Length:"
+  set_status(item, DOWNLOAD_STATUS_IN_PROGRESS);
+  return ERR_OK;
+}
 
-    // Skip leading spaces
-    while (*contentLengthStart == ' ') {
-      contentLengthStart++;
-    }
+// The name of the file of a download with an extension: its sidecar or the
+// file the data is written to
+static void ext_path(const download_item_t *item, const char *ext, char *path,
+                     size_t size) {
+  snprintf(path, size, "%s%s", item->filepath, ext);
+}
 
-    // Convert the Content-Length value to an integer
-    size_t contentLength = strtoul(contentLengthStart, NULL, DEC_BASE);
+// Drop the end of line read by f_gets()
+static void chomp(char *line) {
+  size_t len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    line[--len] = '\0';
   }
+}
 
-  free(headerData);  // Free allocated memory
-  downloadStatus = DOWNLOAD_STATUS_IN_PROGRESS;
-  return ERR_OK;  // Header check passed
+// Bytes of the file left by an interrupted download of the same URL, with
+// the validator of its sidecar. The download starts again without both.
+static uint32_t resume_offset(download_slot_t *slot) {
+  download_item_t *item = slot->item;
+  char path[DOWNLOAD_EXT_PATH_SIZE];
+  ext_path(item, DOWNLOAD_SIDECAR_EXT, path, sizeof(path));
+  slot->validator[0] = '\0';
+  if (f_open(&sidecar, path, FA_READ) != FR_OK) return 0;
+  // The URL, then the validator, one per line
+  char line[DOWNLOAD_BUFFLINE_SIZE + 2];
+  bool same = f_gets(line, sizeof(line), &sidecar) != NULL;
+  if (same) {
+    chomp(line);
+    same = strcmp(line, item->url) == 0 &&
+           f_gets(slot->validator, sizeof(slot->validator), &sidecar);
+  }
+  f_close(&sidecar);
+  if (same) chomp(slot->validator);
+  if (!same || slot->validator[0] == '\0') {
+    slot->validator[0] = '\0';
+    return 0;
+  }
+  // The sidecar is written before the data, the file has the size resumed
+  uint32_t size = 0;
+  ext_path(item, DOWNLOAD_TEMP_EXT, path, sizeof(path));
+  if (f_open(&sidecar, path, FA_READ) == FR_OK) {
+    size = (uint32_t)f_size(&sidecar);
+    f_close(&sidecar);
+  }
+  // The hash must go on from the end of the data kept
+  if (item->hashType != DOWNLOAD_HASH_NONE &&
+      digest_of(item)->hashed != size) {
+    slot->validator[0] = '\0';
+    return 0;
+  }
+  return size;
 }
 
-static void httpClientResultCompleteFn(void *arg, httpc_result_t httpcResult,
-                                       u32_t rxContentLen, u32_t srvRes,
-                                       err_t err) {
-  HTTPC_REQUEST_T *req = (HTTPC_REQUEST_T *)arg;
-  DPRINTF("Requet complete: result %d len %u server_response %u err %d\n",
-          httpcResult, rxContentLen, srvRes, err);
-  req->complete = true;
-  if (err == ERR_OK) {
-    downloadStatus = DOWNLOAD_STATUS_COMPLETED;
+// Keep the URL and the validator of a new download next to its file, or
+// drop the sidecar of an older one if the server sent no validator
+static void save_sidecar(download_slot_t *slot) {
+  download_item_t *item = slot->item;
+  char path[DOWNLOAD_EXT_PATH_SIZE];
+  ext_path(item, DOWNLOAD_SIDECAR_EXT, path, sizeof(path));
+  if (slot->validator[0] == '\0') {
+    if (f_unlink(path) == FR_OK) dircache_invalidate(path);
+    return;
+  }
+  f_chmod(path, 0, AM_RDO);
+  FRESULT res = f_open(&sidecar, path, FA_WRITE | FA_CREATE_ALWAYS);
+  if (res == FR_OK) {
+    if (f_printf(&sidecar, "%s\n%s\n", item->url, slot->validator) < 0) {
+      res = FR_DISK_ERR;
+    }
+    FRESULT closed = f_close(&sidecar);
+    if (res == FR_OK) res = closed;
+  }
+  if (res == FR_OK) {
+    // Hidden, it is not part of the files downloaded
+    f_chmod(path, AM_HID, AM_HID);
   } else {
-    downloadStatus = DOWNLOAD_STATUS_FAILED;
+    DPRINTF("Error saving %s: %i\n", path, res);
+    f_unlink(path);
   }
+  dircache_invalidate(path);
 }
 
-download_err_t download_start() {
-  // Download the app binary from the URL in the app_info struct
-  // The binary is saved to the SD card in the folder
-  // The binary is downloaded using the HTTP client
-  // The binary is saved to the SD card
-
-  // Get the components of a url
-  if (parseUrl(url, &components, &fileUrl) != 0) {
-    DPRINTF("Error parsing URL\n");
-    return DOWNLOAD_CANNOTPARSEURL_ERROR;
-  }
+// The download finished or starts again from the beginning
+static void delete_sidecar(const download_item_t *item) {
+  char path[DOWNLOAD_EXT_PATH_SIZE];
+  ext_path(item, DOWNLOAD_SIDECAR_EXT, path, sizeof(path));
+  if (f_unlink(path) == FR_OK) dircache_invalidate(path);
+}
 
-  // Concatane in filename the folder and filename
-  char filename[DOWNLOAD_BUFFLINE_SIZE] = {0};
-  snprintf(filename, sizeof(filename), "%s/%s", dst_folder, fileUrl.filename);
+// Delete the data of a download that can't be used or resumed
+static void discard_download(const download_item_t *item, const char *temp) {
+  if (f_unlink(temp) == FR_OK) dircache_invalidate(temp);
+  delete_sidecar(item);
+}
 
-  // Close any previously open handle
-  DPRINTF("Closing any previously open file\n");
-  f_close(&file);
+// Create the file the data of a download is written to once the server
+// accepted the request, with the space of its size reserved, or open it at
+// the end of the data resumed
+static download_err_t open_file(download_slot_t *slot, bool resume) {
+  download_item_t *item = slot->item;
+  char filename[DOWNLOAD_EXT_PATH_SIZE];
+  ext_path(item, DOWNLOAD_TEMP_EXT, filename, sizeof(filename));
 
   // Clear read-only attribute if necessary
   DPRINTF("Clearing read-only attribute, if any\n");
@@ -221,8 +500,17 @@ download_err_t download_start() {
 
   // Open file for writing or create if it doesn't exist
   DPRINTF("Opening file for writing\n");
-  FRESULT res = f_open(&file, filename, FA_WRITE | FA_CREATE_ALWAYS);
-  if (res == FR_LOCKED) {
+  FRESULT res;
+  if (resume) {
+    res = f_open(&slot->file, filename, FA_WRITE | FA_OPEN_EXISTING);
+    if (res == FR_OK) {
+      res = f_lseek(&slot->file, item->offset);
+      if (res != FR_OK) f_close(&slot->file);
+    }
+  } else {
+    res = f_open(&slot->file, filename, FA_WRITE | FA_CREATE_ALWAYS);
+  }
+  if (res == FR_LOCKED && !resume) {
     DPRINTF("File is locked. Attempting to resolve...\n");
 
     // Try to remove the file and create it again
@@ -230,101 +518,563 @@ download_err_t download_start() {
     res = f_unlink(filename);
     if (res == FR_OK || res == FR_NO_FILE) {
       DPRINTF("File removed. Creating again\n");
-      res = f_open(&file, filename, FA_WRITE | FA_CREATE_ALWAYS);
+      res = f_open(&slot->file, filename, FA_WRITE | FA_CREATE_ALWAYS);
     }
   }
 
+  dircache_invalidate(filename);
   if (res != FR_OK) {
     DPRINTF("Error opening file %s: %i\n", filename, res);
     return DOWNLOAD_CANNOTOPENFILE_ERROR;
   }
+  if (!resume) {
+    res = sdcard_preallocate(&slot->file, item->total);
+    if (res != FR_OK) {
+      DPRINTF("Cannot reserve %lu bytes for %s: %i\n",
+              (unsigned long)item->total, filename, res);
+      f_close(&slot->file);
+      f_unlink(filename);
+      return res == FR_DENIED ? DOWNLOAD_NOSPACE_ERROR
+                              : DOWNLOAD_CANNOTOPENFILE_ERROR;
+    }
+  }
 
-  downloadStatus = DOWNLOAD_STATUS_STARTED;
+  slot->stream = writeback_open(&slot->file, httpClientRecvedFn, slot);
+  if (!slot->stream) {
+    f_close(&slot->file);
+    return DOWNLOAD_CANNOTSTARTDOWNLOAD_ERROR;
+  }
+  return DOWNLOAD_OK;
+}
+
+// Copy the header line starting at offset, without its CRLF and cut to the
+// size of the buffer. Returns the offset of the next line.
+static u16_t header_line(struct pbuf *hdr, u16_t hdrLen, u16_t offset,
+                         char *line, size_t size) {
+  u16_t end = pbuf_memfind(hdr, "\r\n", 2, offset);
+  if (end > hdrLen) end = hdrLen;  // 0xFFFF when there is none
+  u16_t len = end - offset;
+  if (len > size - 1) len = (u16_t)(size - 1);
+  pbuf_copy_partial(hdr, line, len, offset);
+  line[len] = '\0';
+  return end + 2;
+}
+
+// The value of a header line if it has the name, case insensitive
+static const char *header_value(const char *line, const char *name) {
+  size_t len = strlen(name);
+  if (strncasecmp(line, name, len) != 0 || line[len] != ':') return NULL;
+  const char *value = &line[len + 1];
+  while (*value == ' ' || *value == '\t') value++;
+  return value;
+}
+
+// Resolve the Location of a redirect against the URL requested
+static bool redirect_url(download_slot_t *slot, const char *location) {
+  const download_url_components_t *base = &slot->components;
+  int len;
+  if (strstr(location, "://")) {
+    len = snprintf(slot->location, sizeof(slot->location), "%s", location);
+  } else if (location[0] == '/') {
+    len = snprintf(slot->location, sizeof(slot->location), "%s://%s%s",
+                   base->protocol, base->host, location);
+  } else {
+    // Relative to the folder of the URI
+    const char *slash = strrchr(base->uri, '/');
+    int folderLen = slash ? (int)(slash - base->uri) + 1 : 0;
+    len = snprintf(slot->location, sizeof(slot->location), "%s://%s%s%.*s%s",
+                   base->protocol, base->host, folderLen ? "" : "/", folderLen,
+                   base->uri, location);
+  }
+  return len > 0 && len < (int)sizeof(slot->location);
+}
+
+// Check the status line and the headers. The file is only opened for a
+// successful response; redirects are followed once the request closes.
+static err_t httpClientHeaderCheckSizeFn(__unused httpc_state_t *connection,
+                                         void *arg, struct pbuf *hdr,
+                                         u16_t hdrLen,
+                                         __unused u32_t contentLen) {
+  download_slot_t *slot = (download_slot_t *)arg;
+  download_item_t *item = slot->item;
+  char line[DOWNLOAD_BUFFLINE_SIZE + 16];
+  // Status line: HTTP/1.1 200 OK
+  u16_t offset = header_line(hdr, hdrLen, 0, line, sizeof(line));
+  const char *code = strchr(line, ' ');
+  item->httpStatus = code ? (uint16_t)atoi(code + 1) : 0;
+  DPRINTF("Response %u for %s\n", item->httpStatus, slot->components.uri);
+
+  uint32_t total = 0;
+  bool chunked = false;
+  const char *location = NULL;
+  char locationLine[sizeof(line)];
+  // Content-Range of a resumed request: bytes first-last/size
+  bool range = false;
+  uint32_t rangeFirst = 0;
+  uint32_t rangeSize = 0;
+  // The ETag if strong, else Last-Modified
+  char validator[DOWNLOAD_VALIDATOR_SIZE] = "";
+  bool strongTag = false;
+  while (offset < hdrLen) {
+    offset = header_line(hdr, hdrLen, offset, line, sizeof(line));
+    const char *value;
+    if ((value = header_value(line, "Content-Length"))) {
+      total = (uint32_t)strtoul(value, NULL, DEC_BASE);
+    } else if ((value = header_value(line, "Transfer-Encoding"))) {
+      // chunked is always the last encoding applied
+      for (char *c = line; *c; c++) *c = (char)tolower((unsigned char)*c);
+      chunked = strstr(value, "chunked") != NULL;
+    } else if ((value = header_value(line, "Location"))) {
+      strcpy(locationLine, value);
+      location = locationLine;
+    } else if ((value = header_value(line, "Content-Range"))) {
+      if (strncasecmp(value, "bytes ", 6) == 0) {
+        char *end;
+        rangeFirst = (uint32_t)strtoul(value + 6, &end, DEC_BASE);
+        range = *end == '-';
+        // The size is * if the server doesn't know it
+        const char *size = strchr(value, '/');
+        rangeSize = size ? (uint32_t)strtoul(size + 1, NULL, DEC_BASE) : 0;
+      }
+    } else if ((value = header_value(line, "ETag"))) {
+      // A weak tag can't validate a range
+      if (strncmp(value, "W/", 2) != 0 && strlen(value) < sizeof(validator)) {
+        strcpy(validator, value);
+        strongTag = true;
+      }
+    } else if ((value = header_value(line, "Last-Modified"))) {
+      if (!strongTag && strlen(value) < sizeof(validator)) {
+        strcpy(validator, value);
+      }
+    }
+  }
+
+  uint16_t status = item->httpStatus;
+  bool redirect = status == 301 || status == 302 || status == 303 ||
+                  status == 307 || status == 308;
+  if (redirect && location) {
+    if (slot->redirects >= DOWNLOAD_MAX_REDIRECTS) {
+      fail(item, DOWNLOAD_TOOMANYREDIRECTS_ERROR);
+      return ERR_VAL;
+    }
+    if (!redirect_url(slot, location)) {
+      fail(item, DOWNLOAD_CANNOTPARSEURL_ERROR);
+      return ERR_VAL;
+    }
+    DPRINTF("Redirected to %s\n", slot->location);
+    // Closing the request sends download_poll() to the new URL
+    slot->redirects++;
+    slot->redirect = true;
+    return ERR_VAL;
+  }
+  if ((status == 206 && (!range || rangeFirst != item->offset)) ||
+      (status == 416 && item->offset > 0)) {
+    // The part kept can't be resumed: the retry starts from the beginning
+    DPRINTF("Cannot resume at %lu bytes\n", (unsigned long)item->offset);
+    delete_sidecar(item);
+    return ERR_VAL;
+  }
+  if (status < 200 || status > 299) {
+    fail(item, DOWNLOAD_HTTPSTATUS_ERROR);
+    return ERR_VAL;
+  }
+
+  // The server sends the whole file if it changed since the part kept
+  bool resume = status == 206 && item->offset > 0;
+  if (!resume) {
+    item->offset = 0;
+    item->received = 0;
+    if (item->hashType != DOWNLOAD_HASH_NONE) digest_start(item);
+  }
+  // The length of a chunked body is only known at the end
+  if (!resume) {
+    item->total = chunked ? 0 : total;
+  } else if (rangeSize > 0) {
+    item->total = rangeSize;
+  } else {
+    item->total = chunked || total == 0 ? 0 : item->offset + total;
+  }
+  download_err_t error = open_file(slot, resume);
+  if (error != DOWNLOAD_OK) {
+    fail(item, error);
+    return ERR_VAL;
+  }
+  if (!resume) {
+    strcpy(slot->validator, validator);
+    save_sidecar(slot);
+  }
+  slot->chunked = chunked;
+  slot->chunkState = DOWNLOAD_CHUNK_SIZE;
+  slot->chunkLeft = 0;
+  slot->chunkDigits = 0;
+  set_status(item, DOWNLOAD_STATUS_IN_PROGRESS);
+  return ERR_OK;  // Header check passed
+}
 
-  request.url = components.uri;
-  request.hostname = components.host;
-  DPRINTF("HOST: %s. URI: %s\n", components.host, components.uri);
-  request.headers_fn = httpClientHeaderCheckSizeFn;
-  request.recv_fn = httpClientReceiveFileFn;
-  request.result_fn = httpClientResultCompleteFn;
-  DPRINTF("Downloading: %s\n", request.url);
+static void httpClientResultCompleteFn(void *arg, httpc_result_t httpcResult,
+                                       u32_t rxContentLen, u32_t srvRes,
+                                       err_t err) {
+  download_slot_t *slot = (download_slot_t *)arg;
+  download_item_t *item = slot->item;
+  // The connection is closed, the data still queued is not acknowledged
+  if (slot->stream) writeback_detach(slot->stream);
+  DPRINTF("Request %lu complete: result %d len %u server_response %u err %d\n",
+          (unsigned long)item->id, httpcResult, rxContentLen, srvRes, err);
+  if (item->status == DOWNLOAD_STATUS_FAILED || slot->redirect) return;
+  // The network failed or the connection closed before the end: the rest is
+  // requested again
+  if (httpcResult != HTTPC_RESULT_OK || err != ERR_OK) {
+    retry_download(slot, DOWNLOAD_FORCEDABORT_ERROR);
+    return;
+  }
+  if (slot->chunked && slot->chunkState != DOWNLOAD_CHUNK_DONE) {
+    // The connection closed before the last chunk
+    retry_download(slot, DOWNLOAD_FORCEDABORT_ERROR);
+    return;
+  }
+  item->error = DOWNLOAD_OK;  // Of the interruptions resumed
+  item->endTime = get_absolute_time();
+  set_status(item, DOWNLOAD_STATUS_COMPLETED);
+}
+
+// Send the request for a URL, the one of the download or a redirect
+static download_err_t send_request(download_slot_t *slot, const char *url) {
+  download_file_t fileUrl;
+  if (parseUrl(url, &slot->components, &fileUrl) != 0) {
+    DPRINTF("Error parsing URL\n");
+    return DOWNLOAD_CANNOTPARSEURL_ERROR;
+  }
+  bool https = strcasecmp(slot->components.protocol, "https") == 0;
+#if FMANAGER_DOWNLOAD_HTTPS == 0
+  if (https) {
+    DPRINTF("HTTPS is not supported\n");
+    return DOWNLOAD_CANNOTSTARTDOWNLOAD_ERROR;
+  }
+#endif
+  slot->conn = NULL;
+  slot->redirect = false;
+  slot->chunked = false;
+
+  HTTPC_REQUEST_T *request = &slot->request;
+  memset(request, 0, sizeof(HTTPC_REQUEST_T));
+  request->url = slot->components.uri;
+  if (slot->item->offset > 0) {
+    // The HTTP client of lwIP can't add headers: they follow the URI in the
+    // request line, and the last one takes the " HTTP/1.1" lwIP appends
+    snprintf(slot->requestUri, sizeof(slot->requestUri),
+             "%s HTTP/1.1\r\nRange: bytes=%lu-\r\nIf-Range: %s\r\nX-Resume:",
+             slot->components.uri, (unsigned long)slot->item->offset,
+             slot->validator);
+    request->url = slot->requestUri;
+  }
+  request->hostname = slot->components.host;
+  DPRINTF("HOST: %s. URI: %s\n", slot->components.host, slot->components.uri);
+  request->headers_fn = httpClientHeaderCheckSizeFn;
+  request->recv_fn = httpClientReceiveFileFn;
+  request->result_fn = httpClientResultCompleteFn;
+  request->callback_arg = slot;
+  DPRINTF("Downloading: %s\n", request->url);
 #if FMANAGER_DOWNLOAD_HTTPS == 1
-  request.tls_config = altcp_tls_create_config_client(NULL, 0);  // https
-  DPRINTF("Download with HTTPS\n");
+  if (https) {
+    request->tls_config = altcp_tls_create_config_client(NULL, 0);  // https
+    DPRINTF("Download with HTTPS\n");
+  } else {
+    DPRINTF("Download with HTTP\n");
+  }
 #else
   DPRINTF("Download with HTTP\n");
 #endif
-  int result = http_client_request_async(cyw43_arch_async_context(), &request);
+  int result = http_client_request_async(cyw43_arch_async_context(), request);
   if (result != 0) {
     DPRINTF("Error initializing the download: %i\n", result);
-    res = f_close(&file);
-    if (res != FR_OK) {
-      DPRINTF("Error closing file %s: %i\n", filename, res);
-    }
+#if FMANAGER_DOWNLOAD_HTTPS == 1
+    if (request->tls_config) altcp_tls_free_config(request->tls_config);
+    request->tls_config = NULL;
+#endif
     return DOWNLOAD_CANNOTSTARTDOWNLOAD_ERROR;
   }
   return DOWNLOAD_OK;
 }
 
-download_poll_t download_poll() {
-  if (!request.complete) {
-    async_context_poll(cyw43_arch_async_context());
-    async_context_wait_for_work_ms(cyw43_arch_async_context(),
-                                   DOWNLOAD_POLLING_INTERVAL_MS);
-    downloadStatus = DOWNLOAD_STATUS_IN_PROGRESS;
-    return DOWNLOAD_POLL_CONTINUE;
+// Send the request of a queued or interrupted download. The file is created,
+// or opened to resume it, when the response arrives.
+static download_err_t start_download(download_slot_t *slot) {
+  download_item_t *item = slot->item;
+  slot->stream = NULL;
+  slot->redirects = 0;
+  // The data kept of an earlier request is not requested again
+  item->offset = resume_offset(slot);
+  if (item->offset > 0) {
+    set_status(item, DOWNLOAD_STATUS_RESUMING);
+  } else {
+    item->total = 0;
+    set_status(item, DOWNLOAD_STATUS_STARTED);
   }
-  downloadStatus = DOWNLOAD_STATUS_COMPLETED;
-  return DOWNLOAD_POLL_COMPLETED;
+  item->received = item->offset;
+  item->httpStatus = 0;
+  item->startTime = get_absolute_time();
+  return send_request(slot, item->url);
 }
 
-download_err_t download_finish() {
-  // Close the file
-  int res = f_close(&file);
-  if (res != FR_OK) {
-    DPRINTF("Error closing tmp file %s: %i\n", res);
-    return DOWNLOAD_CANNOTCLOSEFILE_ERROR;
+// Close the file of a finished request and free its slot
+static void finish_download(download_slot_t *slot) {
+  download_item_t *item = slot->item;
+  char temp[DOWNLOAD_EXT_PATH_SIZE];
+  ext_path(item, DOWNLOAD_TEMP_EXT, temp, sizeof(temp));
+  // The stream is drained, close the file. There is none if the server
+  // refused the request.
+  bool opened = slot->stream != NULL;
+  FRESULT written = FR_OK;
+  int res = FR_OK;
+  if (opened) {
+    written = writeback_close(slot->stream);
+    slot->stream = NULL;
+    // A preallocated file ends where the data written does, also to resume it
+    FRESULT truncated = f_truncate(&slot->file);
+    if (written == FR_OK) written = truncated;
+    res = f_close(&slot->file);
+    // The size of the downloaded file changed
+    dircache_invalidate(temp);
   }
-  DPRINTF("Downloaded.\n");
-
 #if FMANAGER_DOWNLOAD_HTTPS == 1
-  altcp_tls_free_config(request.tls_config);
+  if (slot->request.tls_config) altcp_tls_free_config(slot->request.tls_config);
 #endif
+  slot->item = NULL;
+  bool closed = written == FR_OK && res == FR_OK;
+  if (item->status == DOWNLOAD_STATUS_RESUMING) {
+    if (closed) return;
+    // What was received is not all on the card, it can't be resumed
+    DPRINTF("Error closing file %s: %i %i\n", temp, written, res);
+    fail(item, DOWNLOAD_CANNOTCLOSEFILE_ERROR);
+  }
+  if (item->status != DOWNLOAD_STATUS_COMPLETED) {
+    DPRINTF("Error downloading %s: %i\n", item->url, item->error);
+    if (item->status != DOWNLOAD_STATUS_FAILED) {
+      fail(item, DOWNLOAD_FORCEDABORT_ERROR);
+    }
+    // The data is kept for a later download of the same URL only if it can
+    // be resumed
+    bool resumable = closed && slot->validator[0] != '\0' &&
+                     item->hashType == DOWNLOAD_HASH_NONE;
+    if (opened && !resumable) discard_download(item, temp);
+    return;
+  }
+  if (!closed) {
+    DPRINTF("Error closing file %s: %i %i\n", temp, written, res);
+    discard_download(item, temp);
+    fail(item, DOWNLOAD_CANNOTCLOSEFILE_ERROR);
+    return;
+  }
+  // Check the data before it takes the name of the file
+  if (item->hashType != DOWNLOAD_HASH_NONE && !digest_matches(item)) {
+    DPRINTF("Checksum mismatch: %s\n", item->url);
+    discard_download(item, temp);
+    fail(item, DOWNLOAD_MD5MISMATCH_ERROR);
+    return;
+  }
+  // FatFS doesn't rename over a file, the older one goes first
+  f_chmod(item->filepath, 0, AM_RDO);
+  FRESULT renamed = f_unlink(item->filepath);
+  if (renamed == FR_OK || renamed == FR_NO_FILE) {
+    renamed = f_rename(temp, item->filepath);
+  }
+  dircache_invalidate(temp);
+  dircache_invalidate(item->filepath);
+  if (renamed != FR_OK) {
+    // The data stays in the temporary file
+    DPRINTF("Error renaming %s: %i\n", temp, renamed);
+    fail(item, DOWNLOAD_CANNOTRENAMEFILE_ERROR);
+    return;
+  }
+  delete_sidecar(item);
+  DPRINTF("File downloaded: %s\n", item->filepath);
 
-  if (downloadStatus != DOWNLOAD_STATUS_COMPLETED) {
-    DPRINTF("Error downloading: %i\n", downloadStatus);
-    return DOWNLOAD_FORCEDABORT_ERROR;
+  if (item->unzip) {
+    // Extract next to the archive, in a folder named after it
+    char folder[DOWNLOAD_BUFFLINE_SIZE];
+    strcpy(folder, item->filepath);
+    char *ext = strrchr(folder, '.');
+    if (ext && ext > strrchr(folder, '/')) *ext = '\0';
+    const char *error = NULL;
+    if (jobs_start(JOBS_OP_UNZIP, item->filepath, folder, &error) == 0) {
+      DPRINTF("Cannot extract %s: %s\n", item->filepath, error);
+    }
   }
-  DPRINTF("File downloaded\n");
+}
 
-  return DOWNLOAD_OK;
+static bool is_running(const download_item_t *item) {
+  for (int i = 0; i < DOWNLOAD_MAX_SLOTS; i++) {
+    if (slots[i].item == item) return true;
+  }
+  return false;
 }
 
-download_status_t download_getStatus() { return downloadStatus; }
+// The queued download waiting the longest. An interrupted one waits for its
+// retry time, and keeps its place ahead of the ones queued after it.
+static download_item_t *next_queued(void) {
+  download_item_t *next = NULL;
+  for (int i = 0; i < DOWNLOAD_MAX_QUEUE; i++) {
+    download_item_t *item = &items[i];
+    bool ready = item->status == DOWNLOAD_STATUS_REQUESTED ||
+                 (item->status == DOWNLOAD_STATUS_RESUMING &&
+                  time_reached(item->retryTime) && !is_running(item));
+    if (item->in_use && ready && (!next || item->id < next->id)) {
+      next = item;
+    }
+  }
+  return next;
+}
 
-void download_setStatus(download_status_t status) { downloadStatus = status; }
+// A free place in the queue, or the place of the oldest finished download
+static download_item_t *alloc_item(void) {
+  download_item_t *oldest = NULL;
+  for (int i = 0; i < DOWNLOAD_MAX_QUEUE; i++) {
+    download_item_t *item = &items[i];
+    if (!item->in_use) return item;
+    if ((item->status == DOWNLOAD_STATUS_COMPLETED ||
+         item->status == DOWNLOAD_STATUS_FAILED) &&
+        (!oldest || item->id < oldest->id)) {
+      oldest = item;
+    }
+  }
+  return oldest;
+}
+
+uint32_t download_queue(const char *url, const char *folder, bool unzip,
+                        const char *hash, download_err_t *error) {
+  download_url_components_t components;
+  download_file_t fileUrl;
+  if (parseUrl(url, &components, &fileUrl) != 0) {
+    DPRINTF("Error parsing URL %s\n", url);
+    *error = DOWNLOAD_CANNOTPARSEURL_ERROR;
+    return 0;
+  }
+  download_hash_t hashType;
+  uint8_t expected[DOWNLOAD_HASH_SIZE] = {0};
+  if (!parse_hash(hash, &hashType, expected)) {
+    DPRINTF("Invalid checksum %s\n", hash);
+    *error = DOWNLOAD_PARSEMD5_ERROR;
+    return 0;
+  }
+  download_item_t *item = alloc_item();
+  if (!item) {
+    DPRINTF("Download queue full\n");
+    *error = DOWNLOAD_QUEUEFULL_ERROR;
+    return 0;
+  }
+  memset(item, 0, sizeof(download_item_t));
+  item->in_use = true;
+  item->id = nextId++;
+  item->unzip = unzip;
+  item->hashType = hashType;
+  memcpy(item->hash, expected, sizeof(item->hash));
+  // The hash of the download that had this place doesn't cover this file
+  digest_of(item)->hashed = 0;
+  strncpy(item->url, url, sizeof(item->url) - 1);
+  // Concatenate the folder and the file name
+  snprintf(item->filepath, sizeof(item->filepath), "%s/%s", folder,
+           fileUrl.filename);
+  set_status(item, DOWNLOAD_STATUS_REQUESTED);
+  DPRINTF("Download %lu queued: %s to %s\n", (unsigned long)item->id, url,
+          item->filepath);
+  *error = DOWNLOAD_OK;
+  return item->id;
+}
+
+void download_poll(void) {
+  bool running = false;
+  for (int i = 0; i < DOWNLOAD_MAX_SLOTS; i++) {
+    download_slot_t *slot = &slots[i];
+    if (slot->item && slot->request.complete && slot->redirect) {
+      // Nothing was written: request the new URL with the same slot
+#if FMANAGER_DOWNLOAD_HTTPS == 1
+      if (slot->request.tls_config) {
+        altcp_tls_free_config(slot->request.tls_config);
+        slot->request.tls_config = NULL;
+      }
+#endif
+      download_err_t err = send_request(slot, slot->location);
+      if (err != DOWNLOAD_OK) {
+        fail(slot->item, err);
+        slot->request.complete = true;
+        slot->redirect = false;
+      }
+    }
+    if (slot->item && slot->request.complete && !slot->redirect) {
+      // Wait for core 1 to write the rest of the body
+      if (slot->stream) writeback_flush(slot->stream);
+      if (!slot->stream || writeback_isDrained(slot->stream)) {
+        finish_download(slot);
+      }
+    }
+    if (!slot->item) {
+      // Queued downloads that can't start fail, and the next one is tried
+      download_item_t *item;
+      while (!slot->item && (item = next_queued())) {
+        slot->item = item;
+        download_err_t err = start_download(slot);
+        if (err == DOWNLOAD_CANNOTSTARTDOWNLOAD_ERROR &&
+            item->status == DOWNLOAD_STATUS_RESUMING) {
+          // The network may still be down
+          retry_download(slot, err);
+          slot->item = NULL;
+        } else if (err != DOWNLOAD_OK) {
+          DPRINTF("Error starting download %lu\n", (unsigned long)item->id);
+          fail(item, err);
+          slot->item = NULL;
+        }
+      }
+    }
+    running |= slot->item != NULL;
+  }
+  if (running) async_context_poll(cyw43_arch_async_context());
+}
 
-// Add setter and getter for download URL and destination folder
-void download_setUrl(const char *u) {
-  strncpy(url, u, sizeof(url) - 1);
-  url[sizeof(url) - 1] = '\0';
+const download_item_t *download_get(uint32_t id) {
+  for (int i = 0; i < DOWNLOAD_MAX_QUEUE; i++) {
+    if (items[i].in_use && items[i].id == id) return &items[i];
+  }
+  return NULL;
 }
 
-const char *download_getUrl(void) { return url; }
+const download_item_t *download_getItem(int index) {
+  return items[index].in_use ? &items[index] : NULL;
+}
 
-void download_setDstFolder(const char *d) {
-  strncpy(dst_folder, d, sizeof(dst_folder) - 1);
-  dst_folder[sizeof(dst_folder) - 1] = '\0';
+void download_getSummary(download_summary_t *summary) {
+  summary->version = version;
+  summary->received = 0;
+  summary->busy = 0;
+  for (int i = 0; i < DOWNLOAD_MAX_QUEUE; i++) {
+    const download_item_t *item = &items[i];
+    if (!item->in_use) continue;
+    summary->received += item->received;
+    if (item->status != DOWNLOAD_STATUS_COMPLETED &&
+        item->status != DOWNLOAD_STATUS_FAILED) {
+      summary->busy++;
+    }
+  }
 }
 
-const char *download_getDstFolder(void) { return dst_folder; }
+uint32_t download_getRate(const download_item_t *item) {
+  if (item->status == DOWNLOAD_STATUS_REQUESTED ||
+      (item->status == DOWNLOAD_STATUS_RESUMING && !is_running(item))) {
+    return 0;
+  }
+  bool done = item->status == DOWNLOAD_STATUS_COMPLETED ||
+              item->status == DOWNLOAD_STATUS_FAILED;
+  int64_t elapsed = absolute_time_diff_us(
+      item->startTime, done ? item->endTime : get_absolute_time());
+  uint64_t received = item->received - item->offset;
+  return elapsed > 0 ? (uint32_t)(received * 1000000 / elapsed) : 0;
+}
 
-const download_url_components_t *download_getUrlComponents() {
-  return &components;
+const char *download_getStatusName(download_status_t status) {
+  return status_names[status];
 }
 
-const char *download_getErrorString() {
-  switch (downloadStatus) {
+const char *download_getErrorString(download_err_t error) {
+  switch (error) {
     case DOWNLOAD_OK:
       return "No error";
     case DOWNLOAD_BASE64_ERROR:
@@ -332,7 +1082,7 @@ const char *download_getErrorString() {
     case DOWNLOAD_PARSEJSON_ERROR:
       return "Error parsing JSON";
     case DOWNLOAD_PARSEMD5_ERROR:
-      return "Error parsing MD5";
+      return "Error parsing checksum";
     case DOWNLOAD_CANNOTOPENFILE_ERROR:
       return "Cannot open file";
     case DOWNLOAD_CANNOTCLOSEFILE_ERROR:
@@ -346,13 +1096,23 @@ const char *download_getErrorString() {
     case DOWNLOAD_CANNOTPARSEURL_ERROR:
       return "Cannot parse URL";
     case DOWNLOAD_MD5MISMATCH_ERROR:
-      return "MD5 mismatch";
+      return "Checksum mismatch";
     case DOWNLOAD_CANNOTRENAMEFILE_ERROR:
       return "Cannot rename file";
     case DOWNLOAD_CANNOTCREATE_CONFIG:
       return "Cannot create configuration";
     case DOWNLOAD_CANNOTDELETECONFIGSECTOR_ERROR:
       return "Cannot delete configuration sector";
+    case DOWNLOAD_QUEUEFULL_ERROR:
+      return "Too many downloads queued";
+    case DOWNLOAD_HTTPSTATUS_ERROR:
+      return "Server refused the download";
+    case DOWNLOAD_TOOMANYREDIRECTS_ERROR:
+      return "Too many redirects";
+    case DOWNLOAD_BADRESPONSE_ERROR:
+      return "Invalid response from server";
+    case DOWNLOAD_NOSPACE_ERROR:
+      return "Not enough space on the SD card";
     default:
       return "Unknown error";
   }
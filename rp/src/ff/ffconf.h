@@ -256,8 +256,11 @@ files/sub-directories /      can be opened simultaneously under file lock
 control. Note that the file /      lock control is independent of re-entrancy.
 */
 
-#define FF_FS_REENTRANT 0
-#define FF_FS_TIMEOUT 1000
+#define FF_FS_REENTRANT 1
+// Milliseconds (see ffsystem.c). Core 1 holds the volume while it writes a
+// buffer behind the network, which can take hundreds of milliseconds while
+// the card erases: core 0 waits for it rather than failing with FR_TIMEOUT.
+#define FF_FS_TIMEOUT 5000
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the
 FatFs /  module itself. Note that regardless of this option, file access to
 different /  volume is always re-entrant and volume control functions,
@@ -0,0 +1,42 @@
+/**
+ * File: ffsystem.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: FatFS memory and mutex functions for the Pico SDK. Replaces
+ * the ffsystem.c of the FatFS library, which has no Pico SDK mutexes.
+ */
+
+#include <stdlib.h>
+
+#include "ff.h"
+#include "pico/mutex.h"
+
+#if FF_USE_LFN == 3  // Working buffers of the long file names on the heap
+
+void *ff_memalloc(UINT msize) { return malloc((size_t)msize); }
+
+void ff_memfree(void *mblock) { free(mblock); }
+
+#endif
+
+#if FF_FS_REENTRANT  // Both cores use the volume: core 1 writes behind
+
+// One mutex per volume, and one for the file lock table
+static mutex_t ff_mutexes[FF_VOLUMES + 1];
+
+int ff_mutex_create(int vol) {
+  mutex_init(&ff_mutexes[vol]);
+  return 1;
+}
+
+void ff_mutex_delete(int vol) { (void)vol; }
+
+// FF_FS_TIMEOUT is in milliseconds
+int ff_mutex_take(int vol) {
+  return mutex_enter_timeout_ms(&ff_mutexes[vol], FF_FS_TIMEOUT) ? 1 : 0;
+}
+
+void ff_mutex_give(int vol) { mutex_exit(&ff_mutexes[vol]); }
+
+#endif
@@ -0,0 +1,413 @@
+/**
+ * File: floppy.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Read the FAT12 file system of the .ST and .MSA images without
+ * extracting them
+ */
+
+#include "floppy.h"
+
+#define DIR_ENTRY_SIZE 32
+#define DIR_ENTRIES_PER_SECTOR (FLOPPY_SECTOR_SIZE / DIR_ENTRY_SIZE)
+#define FAT12_MAX_CLUSTERS 4084
+#define FAT12_END 0xFF8
+#define MSA_RLE_MARKER 0xE5
+#define ATTR_VOLUME 0x08
+#define ATTR_LFN 0x0F
+#define DELETED 0xE5
+
+// Room kept at the end of the JSON buffer for the fields after the entries
+#define JSON_TAIL_SIZE 64
+
+static uint16_t get16le(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint16_t get16be(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static FRESULT read_at(floppy_image_t *img, uint32_t offset, void *buffer,
+                       UINT len) {
+  UINT br;
+  FRESULT fr = f_lseek(&img->file, offset);
+  if (fr == FR_OK) fr = f_read(&img->file, buffer, len, &br);
+  if (fr == FR_OK && br != len) fr = FR_NO_FILESYSTEM;  // Image cut short
+  return fr;
+}
+
+// Find where a stored track of an MSA image starts, following the lengths of
+// the tracks before it the first time
+static FRESULT msa_track_offset(floppy_image_t *img, uint32_t stored,
+                                uint32_t *offset) {
+  while (img->msaIndexed <= stored) {
+    uint8_t len[2];
+    uint32_t last = img->msaOffsets[img->msaIndexed - 1];
+    FRESULT fr = read_at(img, last, len, sizeof(len));
+    if (fr != FR_OK) return fr;
+    img->msaOffsets[img->msaIndexed++] = last + 2 + get16be(len);
+  }
+  *offset = img->msaOffsets[stored];
+  return FR_OK;
+}
+
+// Decode a track of an MSA image. Runs are the marker, the byte and a 16-bit
+// count; a track as big as its decoded size is stored as is.
+static FRESULT msa_load_track(floppy_image_t *img, uint32_t linear) {
+  if (img->cachedTrack == (int32_t)linear) return FR_OK;
+  uint32_t trackSize = (uint32_t)img->sectorsPerTrack * FLOPPY_SECTOR_SIZE;
+  uint32_t first = (uint32_t)img->msaFirstTrack * img->sides;
+  uint32_t storedTracks = (uint32_t)img->tracks * img->sides - first;
+  img->cachedTrack = -1;
+  if (linear < first || linear - first >= storedTracks) {
+    // Tracks not in the image are blank
+    memset(img->track, 0, trackSize);
+    img->cachedTrack = (int32_t)linear;
+    return FR_OK;
+  }
+  uint32_t offset;
+  FRESULT fr = msa_track_offset(img, linear - first, &offset);
+  uint8_t lenBytes[2];
+  if (fr == FR_OK) fr = read_at(img, offset, lenBytes, sizeof(lenBytes));
+  if (fr != FR_OK) return fr;
+  uint32_t left = get16be(lenBytes);
+  if (left == trackSize) {
+    fr = read_at(img, offset + 2, img->track, trackSize);
+    if (fr == FR_OK) img->cachedTrack = (int32_t)linear;
+    return fr;
+  }
+  if (left > trackSize) return FR_NO_FILESYSTEM;
+  // The compressed bytes go through the sector buffer
+  img->cachedSector = -1;
+  UINT pos = 0, len = 0;
+  uint32_t out = 0;
+  uint8_t run[4];
+  int runLen = 0;
+  fr = f_lseek(&img->file, offset + 2);
+  while (fr == FR_OK && (left > 0 || pos < len)) {
+    if (pos == len) {
+      UINT chunk = left < FLOPPY_SECTOR_SIZE ? left : FLOPPY_SECTOR_SIZE;
+      fr = f_read(&img->file, img->sector, chunk, &len);
+      if (fr == FR_OK && len != chunk) fr = FR_NO_FILESYSTEM;
+      if (fr != FR_OK) break;
+      left -= len;
+      pos = 0;
+    }
+    uint8_t b = img->sector[pos++];
+    if (runLen == 0 && b != MSA_RLE_MARKER) {
+      if (out == trackSize) fr = FR_NO_FILESYSTEM;
+      else img->track[out++] = b;
+      continue;
+    }
+    run[runLen++] = b;
+    if (runLen < 4) continue;
+    uint16_t count = get16be(&run[2]);
+    if (count > trackSize - out) {
+      fr = FR_NO_FILESYSTEM;
+    } else {
+      memset(&img->track[out], run[1], count);
+      out += count;
+    }
+    runLen = 0;
+  }
+  if (fr == FR_OK && (out != trackSize || runLen != 0)) fr = FR_NO_FILESYSTEM;
+  if (fr != FR_OK) {
+    DPRINTF("Bad MSA track %lu: %d\n", (unsigned long)linear, fr);
+    return fr;
+  }
+  img->cachedTrack = (int32_t)linear;
+  return FR_OK;
+}
+
+static FRESULT read_sector(floppy_image_t *img, uint32_t lsn,
+                           const uint8_t **data) {
+  if (img->totalSectors && lsn >= img->totalSectors) return FR_NO_FILESYSTEM;
+  if (img->format == FLOPPY_FORMAT_MSA) {
+    uint32_t linear = lsn / img->sectorsPerTrack;
+    if (linear >= (uint32_t)img->tracks * img->sides) return FR_NO_FILESYSTEM;
+    FRESULT fr = msa_load_track(img, linear);
+    if (fr != FR_OK) return fr;
+    *data = &img->track[(lsn % img->sectorsPerTrack) * FLOPPY_SECTOR_SIZE];
+    return FR_OK;
+  }
+  if (img->cachedSector != (int32_t)lsn) {
+    img->cachedSector = -1;
+    FRESULT fr =
+        read_at(img, lsn * FLOPPY_SECTOR_SIZE, img->sector, FLOPPY_SECTOR_SIZE);
+    if (fr != FR_OK) return fr;
+    img->cachedSector = (int32_t)lsn;
+  }
+  *data = img->sector;
+  return FR_OK;
+}
+
+// FAT12 entries take a byte and a half, and can straddle two sectors
+static FRESULT fat_next(floppy_image_t *img, uint16_t cluster,
+                        uint16_t *next) {
+  uint32_t offset = cluster + cluster / 2;
+  uint8_t bytes[2];
+  for (int i = 0; i < 2; i++) {
+    const uint8_t *data;
+    FRESULT fr = read_sector(
+        img, img->fatStart + (offset + i) / FLOPPY_SECTOR_SIZE, &data);
+    if (fr != FR_OK) return fr;
+    bytes[i] = data[(offset + i) % FLOPPY_SECTOR_SIZE];
+  }
+  uint16_t value = get16le(bytes);
+  *next = (cluster & 1) ? (value >> 4) : (value & 0xFFF);
+  return FR_OK;
+}
+
+static FRESULT mount(floppy_image_t *img) {
+  if (img->format == FLOPPY_FORMAT_MSA) {
+    uint8_t header[FLOPPY_MSA_HEADER_SIZE];
+    FRESULT fr = read_at(img, 0, header, sizeof(header));
+    if (fr != FR_OK) return fr;
+    uint16_t end = get16be(&header[8]);
+    img->sectorsPerTrack = get16be(&header[2]);
+    img->sides = get16be(&header[4]) + 1;
+    img->msaFirstTrack = get16be(&header[6]);
+    img->tracks = end + 1;
+    if (get16be(header) != FLOPPY_MSA_MAGIC || img->sectorsPerTrack == 0 ||
+        img->sectorsPerTrack > FLOPPY_MAX_SECTORS_PER_TRACK ||
+        img->sides > 2 || end >= FLOPPY_MAX_TRACKS ||
+        img->msaFirstTrack > end) {
+      DPRINTF("Not an MSA image\n");
+      return FR_NO_FILESYSTEM;
+    }
+    img->msaOffsets[0] = FLOPPY_MSA_HEADER_SIZE;
+    img->msaIndexed = 1;
+  }
+  const uint8_t *boot;
+  FRESULT fr = read_sector(img, 0, &boot);
+  if (fr != FR_OK) return fr;
+  uint16_t bytesPerSector = get16le(&boot[11]);
+  uint8_t spc = boot[13];
+  uint16_t reserved = get16le(&boot[14]);
+  uint8_t fats = boot[16];
+  uint16_t sectorsPerFat = get16le(&boot[22]);
+  img->rootEntries = get16le(&boot[17]);
+  img->totalSectors = get16le(&boot[19]);
+  if (bytesPerSector != FLOPPY_SECTOR_SIZE || spc == 0 || (spc & (spc - 1)) ||
+      reserved == 0 || fats == 0 || fats > 2 || sectorsPerFat == 0 ||
+      img->rootEntries == 0) {
+    DPRINTF("Invalid boot sector\n");
+    return FR_NO_FILESYSTEM;
+  }
+  img->sectorsPerCluster = spc;
+  img->fatStart = reserved;
+  img->rootStart = reserved + fats * sectorsPerFat;
+  img->dataStart =
+      img->rootStart + (img->rootEntries + DIR_ENTRIES_PER_SECTOR - 1) /
+                           DIR_ENTRIES_PER_SECTOR;
+  if (img->dataStart >= img->totalSectors) return FR_NO_FILESYSTEM;
+  uint32_t clusters = (img->totalSectors - img->dataStart) / spc;
+  if (clusters > FAT12_MAX_CLUSTERS) return FR_NO_FILESYSTEM;
+  img->clusters = (uint16_t)clusters;
+  if (img->format == FLOPPY_FORMAT_ST) {
+    // Raw images only have the geometry of the boot sector
+    img->sectorsPerTrack = get16le(&boot[24]);
+    img->sides = get16le(&boot[26]);
+    uint32_t perTrack = (uint32_t)img->sectorsPerTrack * img->sides;
+    img->tracks = perTrack ? img->totalSectors / perTrack : 0;
+    if (f_size(&img->file) < img->totalSectors * FLOPPY_SECTOR_SIZE) {
+      DPRINTF("Image smaller than its file system\n");
+      return FR_NO_FILESYSTEM;
+    }
+  }
+  return FR_OK;
+}
+
+// Walks the entries of a folder: the root has a fixed size, the subfolders
+// follow their chain of clusters
+typedef struct {
+  uint16_t cluster;  // 0 for the root
+  uint32_t index;
+  uint32_t steps;  // Clusters followed, to stop on loops
+} dir_walk_t;
+
+static FRESULT dir_next(floppy_image_t *img, dir_walk_t *walk,
+                        const uint8_t **entry) {
+  uint32_t lsn;
+  *entry = NULL;
+  if (walk->cluster == 0) {
+    if (walk->index >= img->rootEntries) return FR_OK;
+    lsn = img->rootStart + walk->index / DIR_ENTRIES_PER_SECTOR;
+  } else {
+    uint32_t perCluster =
+        (uint32_t)img->sectorsPerCluster * DIR_ENTRIES_PER_SECTOR;
+    uint32_t inCluster = walk->index % perCluster;
+    if (walk->index > 0 && inCluster == 0) {
+      uint16_t next;
+      FRESULT fr = fat_next(img, walk->cluster, &next);
+      if (fr != FR_OK) return fr;
+      if (next >= FAT12_END) return FR_OK;
+      if (next < 2 || next >= img->clusters + 2 ||
+          ++walk->steps > img->clusters) {
+        return FR_NO_FILESYSTEM;
+      }
+      walk->cluster = next;
+    }
+    lsn = img->dataStart +
+          (uint32_t)(walk->cluster - 2) * img->sectorsPerCluster +
+          inCluster / DIR_ENTRIES_PER_SECTOR;
+  }
+  const uint8_t *data;
+  FRESULT fr = read_sector(img, lsn, &data);
+  if (fr != FR_OK) return fr;
+  const uint8_t *e =
+      &data[(walk->index % DIR_ENTRIES_PER_SECTOR) * DIR_ENTRY_SIZE];
+  if (e[0] == 0) return FR_OK;  // No more entries
+  walk->index++;
+  *entry = e;
+  return FR_OK;
+}
+
+static bool is_listed(const uint8_t *e) {
+  return e[0] != DELETED && e[0] != '.' && e[11] != ATTR_LFN &&
+         !(e[11] & ATTR_VOLUME);
+}
+
+// The 8.3 name as "NAME.EXT". Characters that need escaping in JSON, or that
+// are not ASCII, become underscores.
+static void entry_name(const uint8_t *e, char *name, bool label) {
+  int len = 0;
+  for (int i = 0; i < 11; i++) {
+    if (i == 8 && !label) {
+      while (len > 0 && name[len - 1] == ' ') len--;
+      if (e[8] == ' ') break;
+      name[len++] = '.';
+    }
+    uint8_t c = (i == 0 && e[0] == 0x05) ? DELETED : e[i];  // Escaped 0xE5
+    name[len++] = (c < 0x20 || c > 0x7E || c == '"' || c == '\\') ? '_' : c;
+  }
+  while (len > 0 && name[len - 1] == ' ') len--;
+  name[len] = '\0';
+}
+
+// Find the first cluster of a folder of the image, 0 for the root
+static FRESULT find_folder(floppy_image_t *img, const char *folder,
+                           uint16_t *cluster) {
+  char part[13], name[13];
+  int depth = 0;
+  *cluster = 0;
+  while (*folder) {
+    while (*folder == '/') folder++;
+    size_t len = strcspn(folder, "/");
+    if (len == 0) break;
+    if (len >= sizeof(part) || ++depth > FLOPPY_MAX_DEPTH) return FR_NO_PATH;
+    memcpy(part, folder, len);
+    part[len] = '\0';
+    folder += len;
+    dir_walk_t walk = {.cluster = *cluster};
+    const uint8_t *e;
+    FRESULT fr;
+    while ((fr = dir_next(img, &walk, &e)) == FR_OK && e) {
+      if (!is_listed(e) || !(e[11] & AM_DIR)) continue;
+      entry_name(e, name, false);
+      if (strcasecmp(name, part) == 0) break;
+    }
+    if (fr != FR_OK) return fr;
+    if (!e) return FR_NO_PATH;
+    *cluster = get16le(&e[26]);
+    if (*cluster < 2 || *cluster >= img->clusters + 2) {
+      return FR_NO_FILESYSTEM;
+    }
+  }
+  return FR_OK;
+}
+
+static FRESULT count_free(floppy_image_t *img, uint32_t *freeClusters) {
+  *freeClusters = 0;
+  for (uint16_t c = 2; c < img->clusters + 2; c++) {
+    uint16_t value;
+    FRESULT fr = fat_next(img, c, &value);
+    if (fr != FR_OK) return fr;
+    if (value == 0) (*freeClusters)++;
+  }
+  return FR_OK;
+}
+
+bool floppy_isImage(const char *name) {
+  const char *ext = strrchr(name, '.');
+  return ext && (strcasecmp(ext, ".st") == 0 || strcasecmp(ext, ".msa") == 0);
+}
+
+static FRESULT list_folder(floppy_image_t *img, const char *folder, int skip,
+                           char *json, size_t jsonLen) {
+  FRESULT fr = mount(img);
+  uint16_t cluster = 0;
+  uint32_t freeClusters = 0;
+  if (fr == FR_OK) fr = find_folder(img, folder, &cluster);
+  if (fr == FR_OK) fr = count_free(img, &freeClusters);
+  if (fr != FR_OK) return fr;
+  size_t len = snprintf(
+      json, jsonLen,
+      "{\"format\":\"%s\",\"tracks\":%u,\"sides\":%u,\"sectors\":%u,"
+      "\"free\":%lu,\"entries\":[",
+      img->format == FLOPPY_FORMAT_MSA ? "msa" : "st", img->tracks, img->sides,
+      img->sectorsPerTrack,
+      (unsigned long)freeClusters * img->sectorsPerCluster *
+          FLOPPY_SECTOR_SIZE);
+  char label[13] = "";
+  char name[13];
+  char entry[96];
+  int index = 0;
+  bool more = false;
+  dir_walk_t walk = {.cluster = cluster};
+  const uint8_t *e;
+  while ((fr = dir_next(img, &walk, &e)) == FR_OK && e) {
+    if (cluster == 0 && e[0] != DELETED && e[11] != ATTR_LFN &&
+        (e[11] & ATTR_VOLUME)) {
+      entry_name(e, label, true);
+      continue;
+    }
+    if (!is_listed(e) || index++ < skip) continue;
+    entry_name(e, name, false);
+    // Same timestamp as the folder listings: the FAT date and time
+    unsigned ts = ((unsigned)get16le(&e[24]) << 16) | get16le(&e[22]);
+    int n = snprintf(entry, sizeof(entry),
+                     "%s{\"n\":\"%s\",\"a\":%u,\"s\":%lu,\"t\":%u}",
+                     index - 1 > skip ? "," : "", name,
+                     (unsigned)(e[11] & 0x3F),
+                     (unsigned long)(get16le(&e[28]) |
+                                     ((uint32_t)get16le(&e[30]) << 16)),
+                     ts);
+    if (len + n + JSON_TAIL_SIZE > jsonLen) {
+      more = true;
+      index--;
+      break;
+    }
+    memcpy(json + len, entry, n + 1);
+    len += n;
+  }
+  if (fr != FR_OK) return fr;
+  snprintf(json + len, jsonLen - len,
+           "],\"label\":\"%s\",\"more\":%s,\"next\":%d}", label,
+           more ? "true" : "false", index);
+  return FR_OK;
+}
+
+FRESULT floppy_list(const char *path, const char *folder, int skip, char *json,
+                    size_t jsonLen) {
+  if (!floppy_isImage(path)) return FR_NO_FILESYSTEM;
+  // Only needed while the listing is built
+  floppy_image_t *img = malloc(sizeof(floppy_image_t));
+  if (!img) return FR_NOT_ENOUGH_CORE;
+  memset(img, 0, sizeof(floppy_image_t));
+  const char *ext = strrchr(path, '.');
+  img->format = strcasecmp(ext, ".msa") == 0 ? FLOPPY_FORMAT_MSA
+                                              : FLOPPY_FORMAT_ST;
+  img->cachedSector = -1;
+  img->cachedTrack = -1;
+  FRESULT fr = f_open(&img->file, path, FA_READ);
+  if (fr == FR_OK) {
+    fr = list_folder(img, folder, skip, json, jsonLen);
+    f_close(&img->file);
+  }
+  if (fr != FR_OK) DPRINTF("Cannot list %s in %s: %d\n", folder, path, fr);
+  free(img);
+  return fr;
+}
@@ -0,0 +1,145 @@
+function appManager() {
+  return {
+    // Folder browser state
+    folderBrowserOpen: false,
+    currentFolder: '/',
+    folderList: [],
+    selectedFile: '',
+    baseDownloadUrl: 'http://ataristdb.sidecartridge.com/',
+    initialized: false,
+    parsedEntries: [],
+    loaded: false,
+    currentLetter: '',
+    itemsCount: 0,
+    totalLetters: 0,
+    search: '',
+    labels: [],       // unique labels for combo box
+    selectedLabel: '', // filter by this label
+    showNew: false,    // only show newest entries when checked
+    queuedCount: 0,    // downloads queued from this page
+    // returns entries matching the search query
+    filteredEntries() {
+      const q = this.search.toLowerCase();
+      let list = this.parsedEntries.filter(e => {
+        if (!e.name.toLowerCase().startsWith(q)) return false;
+        if (this.selectedLabel && e.label !== this.selectedLabel) return false;
+        return true;
+      });
+      if (this.showNew) {
+        list = list.filter(e => e.time);
+        list.sort((a, b) => Number(b.time) - Number(a.time));
+      }
+      return list;
+    },
+
+    init() {
+      if (this.initialized) return;
+      this.initialized = true;
+      this.loadFiles();
+    },
+    async loadFiles() {
+      const baseUrl = this.baseDownloadUrl + 'db/';
+      const letters = 'abcdefghijklmnopqrstuvwxyz0123456789_';
+      // reset progress state
+      this.parsedEntries = [];
+      this.itemsCount = 0;
+      this.loaded = false;
+      this.totalLetters = letters.length;
+
+      for (const ch of letters) {
+        this.currentLetter = ch;
+        try {
+          const res = await fetch(`${baseUrl}${ch}.csv`);
+          if (res.ok) {
+            const txt = await res.text();
+            const lines = txt.split('\n').filter(l => l.trim());
+            for (const line of lines) {
+              const parts = line.split(';');
+              if (parts.length === 6) {
+                // remove carriage returns, trim whitespace, then strip surrounding quotes
+                const cleaned = parts.map(s => s.replace(/\r/g, '').trim().replace(/^"|"$/g, ''));
+                const [f1, , f3, , f5, f6] = cleaned;
+                const entry = { name: f1, time: f3 || null, label: f5, path: f6 };
+                if (this.currentLetter === '_') {
+                  // only dedupe for underscore file
+                  if (!this.parsedEntries.some(e => e.name === entry.name && e.time === entry.time && e.label === entry.label && e.path === entry.path)) {
+                    this.parsedEntries.push(entry);
+                    this.itemsCount = this.parsedEntries.length;
+                  }
+                } else {
+                  this.parsedEntries.push(entry);
+                  this.itemsCount = this.parsedEntries.length;
+                }
+              }
+            }
+          }
+        } catch (e) {
+          // ignore missing or inaccessible files
+        }
+      }
+      this.currentLetter = '';
+      // collect unique labels
+      const set = new Set(this.parsedEntries.map(e => e.label));
+      this.labels = Array.from(set).sort();
+      this.loaded = true;
+    }
+    ,
+    // Load folders under currentFolder
+    async loadFolders() {
+      try {
+        const res = await fetch(`/folder.cgi?folder=${encodeURIComponent(this.currentFolder)}`);
+        let list = [];
+        if (res.ok) {
+          list = await res.json();
+        }
+        this.folderList = list;
+        // add parent link if not root, always
+        if (this.currentFolder !== '/') {
+          this.folderList.unshift('..');
+        }
+      } catch (e) {
+        this.folderList = [];
+      }
+    },
+    // Open browser for a given start folder
+    openBrowser(filePath) {
+      this.selectedFile = filePath;
+      this.currentFolder = '/';
+      this.folderBrowserOpen = true;
+      this.loadFolders();
+    },
+    // Navigate into a folder or up
+    async changeFolder(name) {
+      if (name === '..') {
+        // move up one level
+        const parts = this.currentFolder.replace(/\/$/, '').split('/');
+        parts.pop();
+        const newPath = parts.join('/');
+        this.currentFolder = newPath ? newPath : '/';
+      } else {
+        this.currentFolder = this.currentFolder.replace(/\/$/, '') + '/' + name;
+      }
+      await this.loadFolders();
+    },
+    closeBrowser() {
+      this.folderBrowserOpen = false;
+      this.folderList = [];
+    },
+    // Queue the download and stay on the page, to add more games
+    async queueDownload() {
+      const url = `/download.cgi?queue=1&folder=${encodeURIComponent(this.currentFolder)}` +
+        `&url=${encodeURIComponent(this.baseDownloadUrl + this.selectedFile)}`;
+      try {
+        const r = await (await fetch(url)).json();
+        if (r.error) {
+          alert('Cannot queue the download: ' + r.error);
+          return;
+        }
+        this.queuedCount++;
+        this.closeBrowser();
+      } catch (e) {
+        alert('Cannot queue the download');
+      }
+    }
+  };
+}
@@ -0,0 +1,542 @@
+function fileManager() {
+  return {
+    // Current folder path
+    folder: '/',
+    // Token of the directory cursor used to page the listing
+    lsToken: '',
+    // Entries requested per listing page
+    lsPageSize: 200,
+    // Upload in progress flag
+    uploading: false,
+    // Request of the file being streamed, if any
+    uploadXhr: null,
+    // Chunks in flight at once in chunked uploads
+    uploadWindow: 4,
+    // Default sort: by name ascending
+    sortKey: 'n',
+    sortAsc: true,
+    // Progress of the running copy, move or delete job
+    jobText: '',
+    // Recursive search below the current folder
+    searchPattern: '',
+    searchToken: '',
+    searchResults: [],
+    searching: false,
+    // Names of the entries selected for a batch operation
+    selected: [],
+    // Folder of the floppy image shown in the details, read on the device
+    imageInfo: null,
+    imageFolder: '/',
+    imageItems: [],
+    load(offset = 0) {
+      // Each page continues the directory cursor the server keeps for the token
+      if (offset === 0) this.lsToken = Math.random().toString(36).substr(2, 9);
+      const url = `/ls.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&token=${this.lsToken}&limit=${this.lsPageSize}` + (offset ? `&nextItem=${offset}` : '');
+      fetch(url)
+        .then(res => res.ok ? res.json() : [])
+        .then(data => {
+          let more = false;
+          // Check for sentinel empty object indicating more data
+          if (data.length && Object.keys(data[data.length - 1]).length === 0) {
+            more = true;
+            data.pop();
+          }
+          if (offset === 0) {
+            this.items = [];
+            this.selected = [];
+          }
+          this.items = this.items.concat(data);
+          if (more) this.load(offset + data.length);
+        })
+        .catch(() => {
+          if (offset === 0) this.items = [];
+        });
+    },
+    // Initialize by clearing and loading from offset 0
+    init() {
+      this.items = [];
+      this.load(0);
+    },
+    // The server searches in the background: poll until it is done
+    search() {
+      if (!this.searchPattern) return;
+      this.searchToken = Math.random().toString(36).substr(2, 9);
+      this.searchResults = [];
+      this.searching = true;
+      this._searchPoll(this.searchToken, 0);
+    },
+    _searchPoll(token, next) {
+      const url = `/find.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&pattern=${encodeURIComponent(this.searchPattern)}&token=${token}&nextItem=${next}`;
+      fetch(url)
+        .then(res => res.json())
+        .then(r => {
+          if (token !== this.searchToken) return;
+          if (r.error) {
+            alert('Search failed: ' + r.error);
+            this.searching = false;
+            return;
+          }
+          this.searchResults = this.searchResults.concat(r.results);
+          if (r.done) {
+            this.searching = false;
+          } else {
+            setTimeout(() => this._searchPoll(token, r.next), r.results.length ? 0 : 300);
+          }
+        })
+        .catch(() => {
+          if (token === this.searchToken) this.searching = false;
+        });
+    },
+    clearSearch() {
+      this.searchToken = '';
+      this.searchResults = [];
+      this.searching = false;
+    },
+    // Go to the folder of a match, or into it if it is a folder
+    openResult(r) {
+      const folder = (r.a & 0x10) ? r.p : r.p.substring(0, r.p.lastIndexOf('/'));
+      this.clearSearch();
+      this.folder = folder || '/';
+      this.load();
+    },
+    toggleSort(key) {
+      if (this.sortKey === key) this.sortAsc = !this.sortAsc;
+      else { this.sortKey = key; this.sortAsc = true; }
+    },
+    itemsSorted() {
+      // Sort all entries and then separate directories and files
+      const arr = [...this.items].sort((a, b) => {
+        let av = a[this.sortKey], bv = b[this.sortKey];
+        // Compare as strings for name and timestamp
+        if (this.sortKey === 'n' || this.sortKey === 't') {
+          av = String(av).toLowerCase(); bv = String(bv).toLowerCase();
+        }
+        if (av < bv) return this.sortAsc ? -1 : 1;
+        if (av > bv) return this.sortAsc ? 1 : -1;
+        return 0;
+      });
+      // Directories first
+      const dirs = arr.filter(item => item.a & 0x10);
+      const files = arr.filter(item => !(item.a & 0x10));
+      return dirs.concat(files);
+    },
+    formatAttr(attr) {
+      const flags = [];
+      if (attr & 0x10) flags.push('D'); // Directory
+      if (attr & 0x01) flags.push('R'); // Read-only
+      if (attr & 0x02) flags.push('H'); // Hidden
+      return flags.join('');
+    },
+    formatTs(ts) {
+      const date = ts >> 16;
+      const time = ts & 0xFFFF;
+      const year = ((date >> 9) & 0x7F) + 1980;
+      const monthIdx = ((date >> 5) & 0x0F) - 1;
+      const day = date & 0x1F;
+      const hours = (time >> 11) & 0x1F;
+      const minutes = (time >> 5) & 0x3F;
+      const months = ['Jan', 'Feb', 'Mar', 'Apr', 'May', 'Jun', 'Jul', 'Aug', 'Sep', 'Oct', 'Nov', 'Dec'];
+      const mo = months[monthIdx] || '??';
+      const dd = String(day).padStart(2, ' ');
+      const hh = String(hours).padStart(2, '0');
+      const mm = String(minutes).padStart(2, '0');
+      return `${mo} ${dd} ${hh}:${mm}`;
+    },
+    navigate(name) {
+      if (name === '..') {
+        const parts = this.folder.replace(/\/$/, '').split('/');
+        parts.pop();
+        const newFolder = parts.join('/');
+        this.folder = newFolder || '/';
+      } else {
+        this.folder = this.folder.replace(/\/$/, '') + '/' + name;
+      }
+      this.load();
+    },
+    // Handler for multiple file upload
+    uploadFiles(event) {
+      const files = event.target.files;
+      if (!files || files.length === 0) return;
+      this.uploads = Array.from(files).map(f => ({ file: f, name: f.name, progress: 0, token: null }));
+      this.uploading = true;
+      this._uploadNext(0);
+    },
+    async _uploadNext(index) {
+      if (index >= this.uploads.length) {
+        this.uploading = false;
+        this.load(0);
+        return;
+      }
+      const entry = this.uploads[index];
+      const fullpath = this.folder.replace(/\/$/, '') + '/' + entry.file.name;
+      // Stream the whole file in one request, fall back to chunks if the
+      // firmware can't take it
+      let ok = await this._uploadStream(entry, fullpath);
+      if (ok === null) ok = await this._uploadChunked(entry, fullpath);
+      if (!ok) { this.uploading = false; return; }
+      entry.progress = 100;
+      // Next file
+      this._uploadNext(index + 1);
+    },
+    // Upload a file with a single POST /files/<path>. Resolves true on
+    // success, false on error and null if the endpoint is not available.
+    _uploadStream(entry, fullpath) {
+      return new Promise(resolve => {
+        const xhr = new XMLHttpRequest();
+        this.uploadXhr = xhr;
+        xhr.open('POST', '/files' + fullpath.split('/').map(encodeURIComponent).join('/'));
+        xhr.upload.onprogress = e => {
+          if (e.lengthComputable) entry.progress = (e.loaded / e.total) * 100;
+        };
+        xhr.onload = () => {
+          this.uploadXhr = null;
+          let result = {};
+          try { result = JSON.parse(xhr.responseText); } catch (e) { }
+          if (xhr.status === 404) { resolve(null); return; }
+          if (xhr.status !== 200 || result.error) {
+            alert('Upload failed: ' + (result.error || xhr.status));
+            resolve(false);
+            return;
+          }
+          resolve(true);
+        };
+        xhr.onerror = () => { this.uploadXhr = null; alert('Upload failed'); resolve(false); };
+        xhr.onabort = () => { this.uploadXhr = null; resolve(false); };
+        xhr.send(entry.file);
+      });
+    },
+    // Upload a file as a sequence of chunks through the upload CGIs. A
+    // window of chunks is kept in flight, the server writes each one at
+    // its offset whatever the order of arrival.
+    async _uploadChunked(entry, fullpath) {
+      const file = entry.file;
+      const token = Math.random().toString(36).substr(2, 9);
+      entry.token = token;
+      // Start upload
+      let res = await fetch(`/upload_start.cgi?token=${encodeURIComponent(token)}` +
+        `&fullpath=${encodeURIComponent(fullpath)}&size=${file.size}`);
+      let result = await res.json();
+      // record preferred upload method
+      this.uploadMethod = result.method || 'GET';
+      if (result.error) { alert('Upload start failed: ' + result.error); return false; }
+      const chunkSize = result.chunkSize || 512;
+      const totalChunks = Math.ceil(file.size / chunkSize);
+      const sendChunk = async (i) => {
+        const blob = file.slice(i * chunkSize, (i + 1) * chunkSize);
+        if (this.uploadMethod === 'POST') {
+          // send raw binary POST
+          const r = await fetch(`/upload_chunk.cgi?token=${encodeURIComponent(token)}` +
+            `&chunk=${i}`, {
+            method: 'POST',
+            body: blob
+          });
+          return r.json();
+        }
+        const buffer = await blob.arrayBuffer();
+        let binary = '';
+        new Uint8Array(buffer).forEach(b => binary += String.fromCharCode(b));
+        const b64 = btoa(binary);
+        // Upload chunk
+        const r = await fetch(`/upload_chunk.cgi?token=${encodeURIComponent(token)}` +
+          `&chunk=${i}&payload=${encodeURIComponent(b64)}`);
+        return r.json();
+      };
+      let next = 0, done = 0, failure = null;
+      const worker = async () => {
+        while (!failure && this.uploading && next < totalChunks) {
+          const i = next++;
+          let r = {};
+          // Retry a chunk a couple of times before giving up
+          for (let attempt = 0; attempt < 3; attempt++) {
+            try { r = await sendChunk(i); } catch (e) { r = { error: 'network error' }; }
+            if (!r.error) break;
+          }
+          if (r.error) { failure = `Chunk ${i} failed: ` + r.error; return; }
+          done++;
+          entry.progress = (done / totalChunks) * 100;
+        }
+      };
+      await Promise.all(Array.from({ length: this.uploadWindow }, worker));
+      if (failure) { alert(failure); return false; }
+      if (!this.uploading) return false;
+      // Finish, asking again while the device writes the last chunks
+      for (;;) {
+        res = await fetch(`/upload_end.cgi?token=${encodeURIComponent(token)}`);
+        result = await res.json();
+        if (result.status !== 'writing') break;
+        await new Promise(r => setTimeout(r, 200));
+      }
+      if (result.error) { alert('Upload end failed: ' + result.error); return false; }
+      return true;
+    },
+    cancelAll() {
+      // cancel current upload
+      const current = this.uploads.find(u => u.token);
+      if (current && current.token) fetch(`/upload_cancel.cgi?token=${encodeURIComponent(current.token)}`);
+      if (this.uploadXhr) this.uploadXhr.abort();
+      this.uploading = false;
+      this.uploads = [];
+    },
+    _itemPath(name) {
+      return this.folder.replace(/\/$/, '') + '/' + name;
+    },
+    // Queue a job on the device and poll its progress until it is over
+    runJob(op, src, dst) {
+      let url = `/job_start.cgi?op=${op}&src=${encodeURIComponent(src)}`;
+      if (dst) url += `&dst=${encodeURIComponent(dst)}`;
+      return fetch(url)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) throw new Error(r.error);
+          return this._pollJob(r.id);
+        })
+        .catch(e => alert(op + ' failed: ' + e.message))
+        .finally(() => { this.jobText = ''; this.load(0); });
+    },
+    _pollJob(id) {
+      return fetch(`/job_status.cgi?id=${id}`)
+        .then(res => res.json())
+        .then(j => {
+          if (j.error) throw new Error(j.error);
+          this.jobText = `${j.op}: ${j.files} files, ${j.folders} folders, ` +
+            `${Math.round(j.bytes / 1024)} KB`;
+          if (j.state === 'running' && j.fileSize > 0 && j.fileDone < j.fileSize) {
+            this.jobText += ` (current file ${Math.floor(j.fileDone * 100 / j.fileSize)}%)`;
+          }
+          if (j.state === 'queued' || j.state === 'running') {
+            return new Promise(r => setTimeout(r, 500)).then(() => this._pollJob(id));
+          }
+          if (j.state === 'failed' || j.errors) {
+            throw new Error(`${j.errors} errors, last error ${j.lastError}`);
+          }
+        });
+    },
+    copyItem(item) {
+      const dst = prompt('Copy ' + item.n + ' to', this._itemPath(item.n + ' copy'));
+      if (dst) this.runJob('copy', this._itemPath(item.n), dst);
+    },
+    moveItem(item) {
+      const dst = prompt('Move ' + item.n + ' to', this._itemPath(item.n));
+      if (dst && dst !== this._itemPath(item.n)) this.runJob('move', this._itemPath(item.n), dst);
+    },
+    // Archives are extracted by a job on the device, next to the archive by default
+    extractItem(item) {
+      const dst = prompt('Extract ' + item.n + ' to', this._itemPath(item.n.replace(/\.zip$/i, '')));
+      if (dst) this.runJob('unzip', this._itemPath(item.n), dst);
+    },
+    // Handler to delete a file or folder directly from list; shift-click skips confirmation
+    deleteItem(item, ev) {
+      const skipConfirm = ev && ev.shiftKey;
+      if (item.a & 0x10) {
+        // Folders are deleted with all their content by a job on the device
+        if (skipConfirm || confirm('Delete ' + item.n + ' and everything in it?')) {
+          this.runJob('rmtree', this._itemPath(item.n));
+        }
+        return;
+      }
+      if (!skipConfirm && !confirm('Delete ' + item.n + '?')) {
+        return;
+      }
+      fetch(`/del.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(item.n)}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Delete failed: ' + r.error);
+          else this.load(0);
+        });
+    },
+    toggleSelect(item) {
+      const i = this.selected.indexOf(item.n);
+      if (i < 0) this.selected.push(item.n);
+      else this.selected.splice(i, 1);
+    },
+    // Run many file operations in one request: one line per operation, with
+    // the parameters of its CGI. The results come back in the same order.
+    runBatch(lines, what) {
+      fetch('/batch.cgi', { method: 'POST', body: lines.join('\n') })
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert(what + ' failed: ' + r.error);
+          else if (r.failed || r.skipped) {
+            const errors = (r.results || []).map((res, i) => res.error ? this.selected[i] + ': ' + res.error : null)
+              .filter(e => e);
+            alert(what + ': ' + r.ok + ' done, ' + r.failed + ' failed' +
+              (r.skipped ? ', ' + r.skipped + ' not run' : '') + '\n' + errors.join('\n') +
+              (r.truncated ? '\n...' : ''));
+          }
+          this.load(0);
+        })
+        .catch(() => alert(what + ' failed'));
+    },
+    _selectedLine(op, name) {
+      return `op=${op}&folder=${encodeURIComponent(this.folder)}&src=${encodeURIComponent(name)}`;
+    },
+    deleteSelected() {
+      if (!confirm('Delete ' + this.selected.length + ' selected entries? Folders must be empty.')) return;
+      this.runBatch(this.selected.map(n => this._selectedLine('del', n)), 'Delete');
+    },
+    // Set or clear the hidden attribute of the selection, keeping read-only
+    hideSelected(hide) {
+      const lines = this.selected.map(n => {
+        const item = this.items.find(i => i.n === n);
+        const readonly = item && (item.a & 0x01) ? 1 : 0;
+        return this._selectedLine('attr', n) + `&hidden=${hide ? 1 : 0}&readonly=${readonly}`;
+      });
+      this.runBatch(lines, hide ? 'Hide' : 'Unhide');
+    },
+    // Inline rename handler for list rows
+    renameItem(item) {
+      const newName = prompt('New name for ' + item.n, item.n);
+      if (!newName || newName === item.n) return;
+      fetch(`/ren.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(item.n)}` +
+        `&dst=${encodeURIComponent(newName)}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Rename failed: ' + r.error);
+          else this.load(0);
+        });
+    },
+    // Handler for URL-based upload: redirect to download CGI with params.
+    // ZIP archives can be extracted on the device once downloaded.
+    uploadUrl() {
+      const fileUrl = prompt('Enter file URL to upload:');
+      if (fileUrl) {
+        const unzip = /\.zip$/i.test(fileUrl.split('?')[0]) &&
+          confirm('Extract the archive once downloaded?');
+        const target = `/download.cgi?folder=${encodeURIComponent(this.folder)}` +
+          `&url=${encodeURIComponent(fileUrl)}` + (unzip ? '&unzip=1' : '');
+        window.location.href = target;
+      }
+    },
+    // Handler to cancel an ongoing upload
+    cancelUpload() {
+      if (this.uploading && this.uploadToken) {
+        fetch(`/upload_cancel.cgi?token=${encodeURIComponent(this.uploadToken)}`);
+        this.uploading = false;
+        this.uploadToken = null;
+        alert('Upload cancelled');
+      }
+    },
+    showDetails(item) {
+      this.detailFile = item;
+      this.detailVisible = true;
+      this.imageInfo = null;
+      this.imageItems = [];
+      if (/\.(st|msa)$/i.test(item.n)) this.loadImage('/');
+    },
+    closeDetails() {
+      this.detailVisible = false;
+      this.detailFile = {};
+      this.imageInfo = null;
+    },
+    // List a folder of the floppy image without downloading it, page by page
+    loadImage(folder, next = 0) {
+      const url = `/image_ls.cgi?image=${encodeURIComponent(this._itemPath(this.detailFile.n))}` +
+        `&folder=${encodeURIComponent(folder)}&nextItem=${next}`;
+      fetch(url)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) {
+            this.imageInfo = { error: r.error };
+            return;
+          }
+          if (next === 0) {
+            this.imageFolder = folder;
+            this.imageItems = [];
+          }
+          this.imageInfo = r;
+          this.imageItems = this.imageItems.concat(r.entries);
+          if (r.more) this.loadImage(folder, r.next);
+        })
+        .catch(() => this.imageInfo = { error: 'cannot read the image' });
+    },
+    openImageFolder(entry) {
+      if (entry.a & 0x10) this.loadImage(this.imageFolder.replace(/\/$/, '') + '/' + entry.n);
+    },
+    imageParent() {
+      this.loadImage(this.imageFolder.replace(/\/[^/]*$/, '') || '/');
+    },
+    renameFile() {
+      const newName = prompt('New name for ' + this.detailFile.n, this.detailFile.n);
+      if (!newName || newName === this.detailFile.n) return;
+      fetch(`/ren.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(this.detailFile.n)}` +
+        `&dst=${encodeURIComponent(newName)}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Rename failed: ' + r.error);
+          else {
+            this.closeDetails(); this.load(0);
+          }
+        });
+    },
+    deleteFile() {
+      if (!confirm('Delete ' + this.detailFile.n + '?')) return;
+      fetch(`/del.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(this.detailFile.n)}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Delete failed: ' + r.error);
+          else { this.closeDetails(); this.load(0); }
+        });
+    },
+    // Stream the file straight from the SD card and let the browser save it
+    downloadFile() {
+      const path = this.folder.replace(/\/$/, '') + '/' + this.detailFile.n;
+      const a = document.createElement('a');
+      a.href = '/files' + path.split('/').map(encodeURIComponent).join('/');
+      a.download = this.detailFile.n;
+      document.body.appendChild(a);
+      a.click();
+      document.body.removeChild(a);
+    },
+    // The device builds the ZIP archive of the folder while sending it
+    downloadZip(name) {
+      const path = name ? this._itemPath(name) : this.folder;
+      window.location.href = `/zip.cgi?folder=${encodeURIComponent(path)}`;
+    },
+    // Create new folder in current directory
+    createFolder() {
+      const name = prompt('New folder name:');
+      if (!name) return;
+      fetch(`/mkdir.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(name)}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Create folder failed: ' + r.error);
+          else this.load(0);
+        });
+    },
+    // Toggle hidden attribute while preserving read-only flag
+    toggleHidden() {
+      const current = this.detailFile.a;
+      const newHidden = (current & 0x02) ? 0 : 1;
+      const readonlyParam = (current & 0x01) ? 1 : 0;
+      fetch(`/attr.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(this.detailFile.n)}` +
+        `&hidden=${newHidden}&readonly=${readonlyParam}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Attribute update failed: ' + r.error);
+          else { this.closeDetails(); this.load(0); }
+        });
+    },
+    // Toggle read-only attribute while preserving hidden flag
+    toggleReadonly() {
+      const current = this.detailFile.a;
+      const newReadOnly = (current & 0x01) ? 0 : 1;
+      const hiddenParam = (current & 0x02) ? 1 : 0;
+      fetch(`/attr.cgi?folder=${encodeURIComponent(this.folder)}` +
+        `&src=${encodeURIComponent(this.detailFile.n)}` +
+        `&hidden=${hiddenParam}&readonly=${newReadOnly}`)
+        .then(res => res.json())
+        .then(r => {
+          if (r.error) alert('Attribute update failed: ' + r.error);
+          else { this.closeDetails(); this.load(0); }
+        });
+    },
+  };
+}
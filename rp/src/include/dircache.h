@@ -0,0 +1,93 @@
+/**
+ * File: dircache.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the in-RAM cache of SD card directory listings
+ */
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "ff.h"
+
+// Maximum number of folders in the cache
+#define DIRCACHE_MAX_LISTINGS 8
+
+// Maximum number of bytes used by all the cached listings together. Folders
+// that don't fit are always read from the SD card.
+#define DIRCACHE_MAX_BYTES (12 * 1024)
+
+// Maximum length of a cached folder path
+#define DIRCACHE_PATH_SIZE 256
+
+typedef struct {
+  bool in_use;
+  bool stale;  // Invalidated while being read, freed on release
+  int users;
+  char folder[DIRCACHE_PATH_SIZE];
+  uint8_t *data;  // Packed entries
+  size_t size;
+  int count;
+  uint32_t lastUsed;
+} dircache_listing_t;
+
+/**
+ * @brief Gets the listing of a folder, reading it from the SD card on a miss.
+ *
+ * The listing must be released with dircache_release() when done.
+ *
+ * @param folder The folder path.
+ * @return The listing, or NULL if the folder can't be read or doesn't fit in
+ * the cache.
+ */
+dircache_listing_t *dircache_get(const char *folder);
+
+/**
+ * @brief Releases a listing obtained with dircache_get().
+ *
+ * @param listing The listing.
+ */
+void dircache_release(dircache_listing_t *listing);
+
+/**
+ * @brief Reads the entry of a listing at the given position.
+ *
+ * Only the name, attributes, size, date and time of the entry are set.
+ *
+ * @param listing The listing.
+ * @param pos Byte position of the entry, advanced to the next one. Start at 0.
+ * @param fno The entry read.
+ * @return true if an entry was read, false at the end of the listing.
+ */
+bool dircache_read(const dircache_listing_t *listing, size_t *pos,
+                   FILINFO *fno);
+
+/**
+ * @brief Invalidates the listings affected by a change of a path.
+ *
+ * Drops the listing of the folder containing the path, the listing of the
+ * path itself and the listings of everything below it.
+ *
+ * @param path The file or folder that was created, modified, renamed or
+ * deleted.
+ */
+void dircache_invalidate(const char *path);
+
+/**
+ * @brief Invalidates all the cached listings.
+ *
+ * Used when the SD card is changed behind FatFS, e.g. by the USB host.
+ */
+void dircache_invalidateAll(void);
+
+#endif  // DIRCACHE_H
@@ -9,40 +9,71 @@
 #ifndef DOWNLOAD_H
 #define DOWNLOAD_H
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "aconfig.h"
 #include "constants.h"
 #include "debug.h"
+#include "dircache.h"
 #include "ff.h"
 #include "httpc/httpc.h"
+#include "jobs.h"
+#include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
 #include "memfunc.h"
 #include "network.h"
+#include "sdcard.h"
+#include "writeback.h"
 
 #define DOWNLOAD_BUFFLINE_SIZE 256
 #define DOWNLOAD_FILENAME_SIZE 64
 #define DOWNLOAD_HOSTNAME_SIZE 128
 #define DOWNLOAD_PROTOCOL_SIZE 16
-#define DOWNLOAD_POLLING_INTERVAL_MS 100
+
+// Downloads queued, running or finished and kept for their status
+#define DOWNLOAD_MAX_QUEUE 10
+
+// Transfers running at the same time. Each one takes a TCP connection and up
+// to a full receive window of pbufs, shared with the web server.
+#define DOWNLOAD_MAX_SLOTS 2
+
+// Redirects followed by a download before giving up
+#define DOWNLOAD_MAX_REDIRECTS 5
+
+// An interrupted download is requested again after a delay that doubles with
+// each retry, from DOWNLOAD_RETRY_MIN_MS up to DOWNLOAD_RETRY_MAX_MS. The
+// count starts again when a retry resumes and receives data.
+#define DOWNLOAD_MAX_RETRIES 8
+#define DOWNLOAD_RETRY_MIN_MS 1000
+#define DOWNLOAD_RETRY_MAX_MS 60000
+
+// ETag or Last-Modified of the file, to resume it only if it didn't change
+#define DOWNLOAD_VALIDATOR_SIZE 80
+
+// Kept next to a partial download, with its URL and its validator
+#define DOWNLOAD_SIDECAR_EXT ".dl"
+
+// The data is written to the name of the file with this extension, and only
+// takes the name of the file once complete and verified
+#define DOWNLOAD_TEMP_EXT ".part"
+
+// Bytes of the largest checksum, SHA-256
+#define DOWNLOAD_HASH_SIZE 32
 
 typedef enum {
   DOWNLOAD_STATUS_IDLE,
-  DOWNLOAD_STATUS_REQUESTED,
-  DOWNLOAD_STATUS_NOT_STARTED,
+  DOWNLOAD_STATUS_REQUESTED,  // Queued, waiting for a free slot
   DOWNLOAD_STATUS_STARTED,
   DOWNLOAD_STATUS_IN_PROGRESS,
+  DOWNLOAD_STATUS_RESUMING,  // Interrupted, waiting to request the rest
   DOWNLOAD_STATUS_COMPLETED,
   DOWNLOAD_STATUS_FAILED
 } download_status_t;
 
-typedef enum {
-  DOWNLOAD_POLL_CONTINUE,
-  DOWNLOAD_POLL_ERROR,
-  DOWNLOAD_POLL_COMPLETED
-} download_poll_t;
-
 typedef enum {
   DOWNLOAD_OK,
   DOWNLOAD_BASE64_ERROR,
@@ -57,9 +88,48 @@ typedef enum {
   DOWNLOAD_MD5MISMATCH_ERROR,
   DOWNLOAD_CANNOTRENAMEFILE_ERROR,
   DOWNLOAD_CANNOTCREATE_CONFIG,
-  DOWNLOAD_CANNOTDELETECONFIGSECTOR_ERROR
+  DOWNLOAD_CANNOTDELETECONFIGSECTOR_ERROR,
+  DOWNLOAD_QUEUEFULL_ERROR,
+  DOWNLOAD_HTTPSTATUS_ERROR,
+  DOWNLOAD_TOOMANYREDIRECTS_ERROR,
+  DOWNLOAD_BADRESPONSE_ERROR,
+  DOWNLOAD_NOSPACE_ERROR
 } download_err_t;
 
+// Checksum a download is verified with
+typedef enum {
+  DOWNLOAD_HASH_NONE,
+  DOWNLOAD_HASH_MD5,
+  DOWNLOAD_HASH_SHA256
+} download_hash_t;
+
+typedef struct {
+  bool in_use;
+  uint32_t id;
+  download_status_t status;
+  download_err_t error;  // Why the download failed
+  bool unzip;            // Extract the archive once downloaded
+  download_hash_t hashType;
+  uint8_t hash[DOWNLOAD_HASH_SIZE];  // Checksum expected, if any
+  char url[DOWNLOAD_BUFFLINE_SIZE];
+  char filepath[DOWNLOAD_BUFFLINE_SIZE];  // Destination on the SD card
+  uint32_t received;                      // Bytes of the file written
+  uint32_t total;       // Size of the file, 0 if the server sent none
+  uint32_t offset;      // Bytes in the file when the last request started
+  uint16_t httpStatus;  // Status of the last response, 0 before it
+  uint8_t retries;      // Retries with no data resumed
+  absolute_time_t startTime;
+  absolute_time_t endTime;
+  absolute_time_t retryTime;  // When a resuming download is requested again
+} download_item_t;
+
+// State of the whole queue, to tell when the progress must be reported again
+typedef struct {
+  uint32_t version;   // Changes every time a download changes its status
+  uint32_t received;  // Bytes received by all the downloads kept
+  int busy;           // Downloads queued or running
+} download_summary_t;
+
 typedef struct {
   char protocol[DOWNLOAD_PROTOCOL_SIZE];
   char host[DOWNLOAD_HOSTNAME_SIZE];
@@ -72,109 +142,86 @@ typedef struct {
 } download_file_t;
 
 /**
- * @brief Initiates the download by parsing the current URL, opening a temporary
- * file, and starting the HTTP client request for the file. Checks and prepares
- * the file system environment (e.g., clearing read-only attributes, handling
- * locked files) before initiating the asynchronous download.
- *
- * @return A download_err_t code indicating a successful start or a specific
- * error.
- */
-download_err_t download_start();
-
-/**
- * @brief Polls the download process by invoking the asynchronous context
- * routines. Processes incoming data packets and HTTP events. Periodically waits
- * for a defined interval to allow the download to progress until the process is
- * complete.
+ * @brief Queues the download of a URL to a folder of the SD card.
  *
- * @return DOWNLOAD_POLL_CONTINUE if download is in progress,
- * DOWNLOAD_POLL_COMPLETED when finished.
- */
-download_poll_t download_poll(void);
-
-/**
- * @brief Finalizes the download process by closing the temporary file and
- * releasing resources. Performs error handling during file closure and cleans
- * up HTTPS configurations if used.
+ * The file takes the name of the last part of the URL. Up to
+ * DOWNLOAD_MAX_SLOTS downloads run at the same time, the others wait in
+ * order. Finished downloads are kept for their status until their place is
+ * needed.
  *
- * @return A download_err_t code indicating success or the specific error
- * encountered.
- */
-download_err_t download_finish(void);
-
-/**
- * @brief Retrieves the current status of the download process.
+ * The data is written to a file named with DOWNLOAD_TEMP_EXT, renamed to the
+ * name of the file once complete and, with a checksum given, verified.
  *
- * @return The current download_status_t representing the state.
- */
-download_status_t download_getStatus(void);
-
-/**
- * @brief Updates the status of the download process.
+ * A download interrupted by the network is resumed where it stopped, if the
+ * server sent a validator for the file and the file didn't change. A partial
+ * download that failed resumes too when the same URL is queued again, unless
+ * it has a checksum: the hash of the data kept is gone by then.
  *
- * @param status New download_status_t value to set.
+ * @param url The URL to download.
+ * @param folder The destination folder.
+ * @param unzip true to extract the file, a ZIP archive, once downloaded. A
+ * background job extracts it next to the archive, in a folder named after
+ * it. The archive is kept.
+ * @param hash The MD5 (32 digits) or the SHA-256 (64 digits) of the file in
+ * hexadecimal, or NULL or empty to not verify it.
+ * @param error Receives the reason when the download can't be queued.
+ * @return The id of the download, or 0 if it can't be queued.
  */
-void download_setStatus(download_status_t status);
+uint32_t download_queue(const char *url, const char *folder, bool unzip,
+                        const char *hash, download_err_t *error);
 
 /**
- * @brief Retrieves the current file path used in the download process.
- *
- * This path may represent the temporary file or a user-defined URL for
- * downloading.
- *
- * @return A pointer to a null-terminated string with the current file path.
+ * @brief Starts the queued downloads when a slot is free, and closes the
+ * files of the finished ones. Must be called from the main loop.
  */
-const char *download_getFilepath(void);
+void download_poll(void);
 
 /**
- * @brief Sets the file path for the download process.
- *
- * Copies the supplied path into internal storage ensuring proper
- * null-termination.
+ * @brief Gets a download of the queue by its id.
  *
- * @param path A null-terminated string containing the new file path.
+ * @param id The id returned by download_queue().
+ * @return The download, or NULL if it is no longer kept.
  */
-void download_setFilepath(const char *path);
+const download_item_t *download_get(uint32_t id);
 
 /**
- * @brief Provides access to the parsed components of the download URL.
+ * @brief Gets a download by its place in the queue, to walk all of them.
  *
- * This includes protocol, hostname, and URI as extracted from the user-supplied
- * URL.
- *
- * @return A pointer to a download_url_components_t structure.
+ * @param index From 0 to DOWNLOAD_MAX_QUEUE - 1.
+ * @return The download, or NULL if the place is free.
  */
-const download_url_components_t *download_getUrlComponents(void);
+const download_item_t *download_getItem(int index);
 
 /**
- * @brief Sets the download source URL.
+ * @brief Gets the state of the whole queue.
  *
- * @param url The URL string to set for downloading.
+ * @param summary Receives the state.
  */
-void download_setUrl(const char *url);
+void download_getSummary(download_summary_t *summary);
 
 /**
- * @brief Retrieves the currently set download source URL.
+ * @brief Gets the average transfer rate of a download.
  *
- * @return The current URL string.
+ * @param item The download.
+ * @return Bytes per second since the last request started, until it
+ * finished. 0 while waiting to start or to resume.
  */
-const char *download_getUrl(void);
+uint32_t download_getRate(const download_item_t *item);
 
 /**
- * @brief Sets the destination folder for the download.
+ * @brief Gets the name of a download status, as used by the web pages.
  *
- * @param folder The folder path where the file will be saved.
+ * @param status The status.
+ * @return The name.
  */
-void download_setDstFolder(const char *folder);
+const char *download_getStatusName(download_status_t status);
 
 /**
- * @brief Retrieves the currently set destination folder.
+ * @brief Gets the description of a download error.
  *
- * @return The current folder path.
+ * @param error The error.
+ * @return The description.
  */
-const char *download_getDstFolder(void);
-
-const char *download_getErrorString();
+const char *download_getErrorString(download_err_t error);
 
 #endif  // DOWNLOAD_H
\ No newline at end of file
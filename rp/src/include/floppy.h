@@ -0,0 +1,96 @@
+/**
+ * File: floppy.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the inspection of the floppy disk images
+ */
+
+#ifndef FLOPPY_H
+#define FLOPPY_H
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "debug.h"
+#include "ff.h"
+
+#define FLOPPY_SECTOR_SIZE 512
+
+// Magic number at the start of the MSA images, big endian
+#define FLOPPY_MSA_MAGIC 0x0E0F
+#define FLOPPY_MSA_HEADER_SIZE 10
+
+// Largest geometry accepted: 86 tracks per side and 21 sectors per track
+// cover the extended formats of the ST and the HD disks
+#define FLOPPY_MAX_TRACKS 86
+#define FLOPPY_MAX_SECTORS_PER_TRACK 21
+
+// Deepest folder of an image that can be listed
+#define FLOPPY_MAX_DEPTH 8
+
+typedef enum {
+  FLOPPY_FORMAT_ST,   // Raw sectors
+  FLOPPY_FORMAT_MSA,  // Tracks compressed one by one with RLE
+} floppy_format_t;
+
+// An open image. Sectors are read one at a time through a single sector
+// cache; MSA tracks are decoded only when one of their sectors is needed.
+typedef struct {
+  FIL file;
+  floppy_format_t format;
+  uint16_t sectorsPerTrack;
+  uint16_t sides;
+  uint16_t tracks;
+  // Layout of the FAT12 file system, from the boot sector
+  uint8_t sectorsPerCluster;
+  uint16_t fatStart;
+  uint16_t rootStart;
+  uint16_t rootEntries;
+  uint16_t dataStart;
+  uint16_t clusters;  // Data clusters, numbered from 2
+  uint32_t totalSectors;
+  int32_t cachedSector;
+  uint8_t sector[FLOPPY_SECTOR_SIZE];
+  // MSA images: offset in the file of each track found so far, and the
+  // decoded track
+  uint16_t msaFirstTrack;  // First track stored, the tracks before are empty
+  uint16_t msaIndexed;     // Tracks with a known offset
+  uint32_t msaOffsets[FLOPPY_MAX_TRACKS * 2];
+  int32_t cachedTrack;
+  uint8_t track[FLOPPY_MAX_SECTORS_PER_TRACK * FLOPPY_SECTOR_SIZE];
+} floppy_image_t;
+
+/**
+ * @brief Tells whether the name has the extension of a supported image.
+ *
+ * @param name The name of the file.
+ * @return true for .st and .msa files.
+ */
+bool floppy_isImage(const char *name);
+
+/**
+ * @brief Lists a folder of a floppy disk image as JSON.
+ *
+ * Only the boot sector, the FAT and the sectors of the folders in the path
+ * are read. The entries use the keys of the folder listings of the file
+ * manager: name, attributes, size and timestamp. When the buffer is full the
+ * listing stops, "more" is true and "next" is the skip of the next page.
+ *
+ * @param path The path of the image on the SD card.
+ * @param folder The folder inside the image, "/" for the root.
+ * @param skip The number of entries to skip.
+ * @param json The buffer for the JSON object.
+ * @param jsonLen The size of the buffer.
+ * @return FR_OK, the error of the SD card, or FR_NO_FILESYSTEM if the image is
+ * not valid and FR_NO_PATH if the folder is not in it.
+ */
+FRESULT floppy_list(const char *path, const char *folder, int skip, char *json,
+                    size_t jsonLen);
+
+#endif  // FLOPPY_H
@@ -0,0 +1,99 @@
+/**
+ * File: inflate.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the streaming DEFLATE decoder
+ */
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+// Farthest back a DEFLATE match can reach: the size of the window
+#define INFLATE_WINDOW_SIZE 32768
+
+// Compressed bytes read at once from the source
+#define INFLATE_INPUT_SIZE 1024
+
+/**
+ * @brief Reads compressed data for the decoder.
+ *
+ * @param arg The argument given to inflate_init().
+ * @param buffer The buffer to fill.
+ * @param len The size of the buffer.
+ * @return The bytes read, 0 at the end of the source, or -1 on error.
+ */
+typedef int (*inflate_read_fn)(void *arg, uint8_t *buffer, int len);
+
+typedef enum {
+  INFLATE_STATE_HEADER,  // Next block header
+  INFLATE_STATE_STORED,  // Bytes of an uncompressed block
+  INFLATE_STATE_CODES,   // Symbols of a compressed block
+  INFLATE_STATE_DONE,
+  INFLATE_STATE_ERROR
+} inflate_state_t;
+
+// Canonical Huffman code: the number of codes of each length and the symbols
+// sorted by code
+typedef struct {
+  int16_t count[16];
+  int16_t symbol[288];
+} inflate_huffman_t;
+
+typedef struct {
+  inflate_state_t state;
+  bool last;  // The block is the last one of the stream
+  inflate_read_fn read;
+  void *readArg;
+  uint8_t input[INFLATE_INPUT_SIZE];
+  int inputPos;
+  int inputLen;
+  uint32_t bitBuf;
+  int bitCount;
+  uint8_t *window;    // The output, INFLATE_WINDOW_SIZE bytes
+  uint32_t position;  // Where the next byte goes in the window
+  uint32_t total;     // Bytes produced, up to the window size
+  uint32_t stored;    // Bytes left in the stored block
+  int copyLen;        // Bytes left of the match being copied
+  uint32_t copyDist;
+  inflate_huffman_t lencode;
+  inflate_huffman_t distcode;
+} inflate_t;
+
+/**
+ * @brief Prepares the decoding of a raw DEFLATE stream, as stored in ZIP
+ * archives.
+ *
+ * @param s The decoder.
+ * @param window The output buffer, of INFLATE_WINDOW_SIZE bytes. It also
+ * holds the history the matches copy from.
+ * @param read The function reading the compressed data.
+ * @param arg The argument of the read function.
+ */
+void inflate_init(inflate_t *s, uint8_t *window, inflate_read_fn read,
+                  void *arg);
+
+/**
+ * @brief Decodes the next bytes of the stream.
+ *
+ * Decoding stops at the end of the window, so the bytes are contiguous and
+ * must be consumed before the next call overwrites them. Fewer than max bytes
+ * are only returned at the end of the window or of the stream.
+ *
+ * @param s The decoder.
+ * @param data Receives the start of the decoded bytes, in the window.
+ * @param max The most bytes to decode, which bounds the time of the call.
+ * @return The number of bytes decoded, 0 at the end of the stream, or -1 if
+ * the stream is corrupt or the source failed.
+ */
+int inflate_read(inflate_t *s, const uint8_t **data, int max);
+
+#endif  // INFLATE_H
@@ -0,0 +1,152 @@
+/**
+ * File: jobs.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the background file operations on the SD card
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "dircache.h"
+#include "ff.h"
+#include "inflate.h"
+#include "pico/stdlib.h"
+
+// Jobs queued, running or finished and kept for their status
+#define JOBS_MAX_JOBS 4
+
+// Maximum length of the paths of a job
+#define JOBS_PATH_SIZE 256
+
+// Deepest folder level below the folder of a job
+#define JOBS_MAX_DEPTH 16
+
+// Names of the subfolders still to copy
+#define JOBS_STACK_SIZE 2048
+
+// FatFS operations performed by the running job on every call to jobs_poll(),
+// and the time they can take
+#define JOBS_STEP_OPS 8
+#define JOBS_STEP_BUDGET_US (20 * 1000)
+
+// Files are copied through the ROM3 half of the ROM in RAM area, not used by
+// the manager. Reads and writes of whole sectors this large go straight
+// between the card and the buffer, with no copy through the FatFS window.
+#define JOBS_COPY_BUFFER_OFFSET ROM_SIZE_BYTES
+#define JOBS_COPY_BUFFER_SIZE (32 * 1024)
+
+// Bytes decompressed at once when extracting an archive. The copy buffer is
+// the window of the decoder.
+#define JOBS_UNZIP_CHUNK_SIZE (8 * 1024)
+
+typedef enum {
+  JOBS_OP_RMTREE,  // Delete a file or a folder with all its content
+  JOBS_OP_COPY,    // Copy a file or a folder with all its content
+  JOBS_OP_MOVE,    // Rename a file or a folder to another folder
+  JOBS_OP_UNZIP    // Extract a ZIP archive to a folder
+} jobs_op_t;
+
+typedef enum {
+  JOBS_STATE_QUEUED,
+  JOBS_STATE_RUNNING,
+  JOBS_STATE_DONE,
+  JOBS_STATE_FAILED,
+  JOBS_STATE_CANCELLED
+} jobs_state_t;
+
+typedef struct {
+  bool in_use;
+  uint32_t id;
+  jobs_op_t op;
+  jobs_state_t state;
+  char src[JOBS_PATH_SIZE];
+  char dst[JOBS_PATH_SIZE];
+  uint32_t filesDone;  // Files deleted, copied or extracted
+  uint32_t foldersDone;
+  uint64_t bytesDone;
+  FSIZE_t fileSize;  // Size of the file being copied or extracted
+  FSIZE_t fileDone;  // Bytes of it already written
+  uint32_t errors;
+  FRESULT lastError;
+} jobs_job_t;
+
+/**
+ * @brief Queues a job. Jobs run one after the other, in order.
+ *
+ * @param op The operation.
+ * @param src The file or folder to delete, copy or move, or the archive to
+ * extract.
+ * @param dst The full path of the copy or of the moved file or folder, or the
+ * folder to extract to, created if missing. Ignored by JOBS_OP_RMTREE.
+ * @param error Receives a short error message when the job is not queued.
+ * @return The id of the job, or 0 if it was not queued.
+ */
+uint32_t jobs_start(jobs_op_t op, const char *src, const char *dst,
+                    const char **error);
+
+/**
+ * @brief Gets a job by its id.
+ *
+ * Finished jobs are kept until their slot is needed by a new one.
+ *
+ * @param id The id returned by jobs_start().
+ * @return The job, or NULL if it is unknown.
+ */
+const jobs_job_t *jobs_get(uint32_t id);
+
+/**
+ * @brief Cancels a queued or running job.
+ *
+ * The file being copied or extracted is removed. What was already done is
+ * kept.
+ *
+ * @param id The id of the job.
+ * @return true if the job was queued or running.
+ */
+bool jobs_cancel(uint32_t id);
+
+/**
+ * @brief Gets the name of an operation, as used by the CGIs.
+ *
+ * @param op The operation.
+ * @return The name.
+ */
+const char *jobs_opName(jobs_op_t op);
+
+/**
+ * @brief Gets the name of the state of a job, as used by the CGIs.
+ *
+ * @param state The state.
+ * @return The name.
+ */
+const char *jobs_stateName(jobs_state_t state);
+
+/**
+ * @brief Closes the folder read by the running job.
+ *
+ * Open folders are locked by FatFS. The job reopens it on its next step, so
+ * this must be called before renaming or deleting anything.
+ */
+void jobs_suspend(void);
+
+/**
+ * @brief Advances the running job.
+ *
+ * Performs at most JOBS_STEP_OPS FatFS operations and stops after
+ * JOBS_STEP_BUDGET_US, so a large job never blocks the main loop for long.
+ * Must be called from the main loop.
+ */
+void jobs_poll(void);
+
+#endif  // JOBS_H
@@ -21,10 +21,13 @@
 #include "display_mngr.h"
 #include "gconfig.h"
 #include "httpc/httpc.h"
+#include "jobs.h"
 #include "lwip/altcp_tls.h"
 #include "lwip/apps/httpd.h"
 #include "memfunc.h"
+#include "mngr_files.h"
 #include "mngr_httpd.h"
+#include "mngr_ws.h"
 #include "network.h"
 #include "pico/async_context.h"
 #include "pico/multicore.h"
@@ -32,9 +35,11 @@
 #include "reset.h"
 #include "romemul.h"
 #include "sdcard.h"
+#include "search.h"
 #include "select.h"
 #include "tprotocol.h"
 #include "usb_mass.h"
+#include "writeback.h"
 
 #define ADDRESS_HIGH_BIT 0x8000  // High bit of the address
 
@@ -0,0 +1,137 @@
+/**
+ * File: mngr_files.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the httpd custom files that stream the SD card
+ */
+
+#ifndef MNGR_FILES_H
+#define MNGR_FILES_H
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "dircache.h"
+#include "download.h"
+#include "ff.h"
+#include "lwip/apps/fs.h"
+#include "lwip/apps/httpd.h"
+#include "pico/cyw43_arch.h"
+#include "writeback.h"
+#include "zip.h"
+
+// URI prefix of the raw files served from the SD card: /files/<path>
+#define MNGR_FILES_URI_PREFIX "/files"
+#define MNGR_FILES_URI_PREFIX_LEN (sizeof(MNGR_FILES_URI_PREFIX) - 1)
+
+// URI prefix of the folders of the SD card sent as a ZIP archive: /zip/<path>
+#define MNGR_FILES_ZIP_PREFIX "/zip"
+#define MNGR_FILES_ZIP_PREFIX_LEN (sizeof(MNGR_FILES_ZIP_PREFIX) - 1)
+
+// Server-Sent Events stream of the progress of the downloads from a URL
+#define MNGR_FILES_EVENTS_URI "/events/download"
+
+// The progress of every download is sent when a status changes, after this
+// many bytes, or at least this often as a heartbeat
+#define MNGR_FILES_EVENT_BYTES (32 * 1024)
+#define MNGR_FILES_EVENT_INTERVAL_MS 1000
+
+// Maximum length of a decoded SD card path
+#define MNGR_FILES_PATH_SIZE 256
+
+// Room for the HTTP response header built for each file
+#define MNGR_FILES_HEADER_SIZE 384
+
+// Longest Range request header value accepted
+#define MNGR_FILES_RANGE_SIZE 64
+
+// Longest ETag and request header values compared when serving the embedded
+// scripts and style sheets
+#define MNGR_FILES_ETAG_SIZE 48
+#define MNGR_FILES_VALIDATOR_SIZE 160
+
+// Uploads receiving no data for this long are abandoned
+#define MNGR_FILES_UPLOAD_TIMEOUT_MS (30 * 1000)
+
+// One file context per parallel httpd connection
+#define MNGR_FILES_MAX_CONTEXTS MEMP_NUM_PARALLEL_HTTPD_CONNS
+
+/**
+ * @brief Completes the pending asynchronous SD card reads of the open files.
+ *
+ * The httpd custom file hooks never touch the SD card from inside an lwIP
+ * callback. They only queue the read and return FS_READ_DELAYED. This function
+ * must be called from the main loop: it performs the queued f_read() calls and
+ * wakes up the httpd connections waiting for the data. It also sends the
+ * download progress events that are due and drops the uploads whose
+ * connection went away.
+ */
+void mngr_files_poll(void);
+
+/**
+ * @brief Starts receiving a file uploaded with POST /files/<path>.
+ *
+ * The file is created (or truncated) once and the request body is streamed
+ * into it as it arrives, with no intermediate buffering.
+ *
+ * @param connection The httpd connection of the POST request.
+ * @param uri The request URI, including the /files prefix.
+ * @param content_len The Content-Length of the request body.
+ * @return NULL on success, or a short error message.
+ */
+const char *mngr_files_uploadBegin(void *connection, const char *uri,
+                                   int content_len);
+
+/**
+ * @brief Queues a piece of the request body of an upload for its file.
+ *
+ * Takes ownership of the pbuf chain and frees it. Core 1 writes the data, so
+ * a write error is reported by a later piece or by the end of the upload. The
+ * data is acknowledged to the sender once written, which holds the TCP window
+ * while the SD card is busy.
+ *
+ * @param connection The httpd connection of the POST request.
+ * @param p The received data.
+ * @return ERR_OK, or ERR_VAL if the data could not be written.
+ */
+err_t mngr_files_uploadReceive(void *connection, struct pbuf *p);
+
+/**
+ * @brief Closes the file of an upload and builds its JSON result.
+ *
+ * httpd calls it once the whole body is acknowledged, that is written, so it
+ * doesn't wait for core 1. A file that was not completely written is removed.
+ *
+ * @param connection The httpd connection of the POST request.
+ * @param json Buffer receiving the JSON result.
+ * @param jsonLen The size of the JSON buffer.
+ * @return true if the whole body was written to the file.
+ */
+bool mngr_files_uploadFinished(void *connection, char *json, size_t jsonLen);
+
+/**
+ * @brief Checks whether a connection is uploading a file to /files/.
+ *
+ * @param connection The httpd connection.
+ * @return true if there is an upload in progress for the connection.
+ */
+bool mngr_files_isUpload(void *connection);
+
+/**
+ * @brief Drops the upload left on a connection by a POST that was aborted.
+ *
+ * The file of the upload is deleted. Does nothing if the connection has no
+ * upload.
+ *
+ * @param connection The httpd connection.
+ */
+void mngr_files_uploadRelease(void *connection);
+
+#endif  // MNGR_FILES_H
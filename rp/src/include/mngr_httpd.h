@@ -9,6 +9,7 @@
 #ifndef MNGR_HTTPD_H
 #define MNGR_HTTPD_H
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -31,6 +32,50 @@ typedef enum {
   MNGR_HTTPD_RESPONSE_INTERNAL_SERVER_ERROR = 500
 } mngr_httpd_response_status_t;
 
+/**
+ * @brief Decodes a percent-encoded URI string into its original value.
+ *
+ * E.g., "My%20SSID%21" -> "My SSID!". The output is always null-terminated.
+ *
+ * @param in The percent-encoded input string.
+ * @param out The output buffer.
+ * @param outLen The size of the output buffer.
+ * @return true on success, false if any argument is invalid.
+ */
+bool url_decode(const char *in, char *out, size_t outLen);
+
+/**
+ * @brief Looks up a header of the HTTP request being served.
+ *
+ * The lwIP httpd hooks only receive the URI. This function finds a request
+ * header by scanning the request buffer that follows the URI, so it must only
+ * be called with the URI passed to fs_open_custom() for the current request.
+ * The scan stops at the empty line ending the headers, and finds nothing if
+ * that line is not in the request.
+ *
+ * @param uri The URI passed by httpd, still pointing into the request.
+ * @param name The header name, matched case-insensitively.
+ * @param value Buffer receiving the null-terminated header value.
+ * @param valueLen The size of the value buffer.
+ * @return true if the header was found, false otherwise.
+ */
+bool mngr_httpd_getRequestHeader(const char *uri, const char *name,
+                                 char *value, size_t valueLen);
+
+/**
+ * @brief Checks whether the state of an httpd connection is still in use.
+ *
+ * httpd frees the state of a connection reset by the client without calling
+ * any hook, so the owners of a POST check it before using the connection
+ * outside of the httpd callbacks. A state freed may already serve a new
+ * connection: a new POST releases what the handlers kept for the old one, and
+ * httpd_post_data_recved() does nothing to a connection not holding a POST.
+ *
+ * @param connection The connection passed to the POST hooks.
+ * @return true if the state is not free.
+ */
+bool mngr_httpd_isConnectionOpen(void *connection);
+
 void mngr_httpd_start(int sdcard_err);
 
 #endif  // MNGR_HTTPD_H
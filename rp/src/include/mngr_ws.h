@@ -0,0 +1,101 @@
+/**
+ * File: mngr_ws.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the WebSocket channel of the file manager
+ */
+
+#ifndef MNGR_WS_H
+#define MNGR_WS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "dircache.h"
+#include "ff.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+// lwIP httpd can't hand a connection over to another protocol, so the
+// WebSocket channel listens on its own port
+#define MNGR_WS_PORT 8080
+
+// Largest data of a read or write request, and the buffers holding the
+// requests received and the response being sent
+#define MNGR_WS_MAX_DATA 4096
+#define MNGR_WS_RX_SIZE (2 * (MNGR_WS_MAX_DATA + 512))
+#define MNGR_WS_TX_SIZE (MNGR_WS_MAX_DATA + 512)
+
+// Longest HTTP upgrade request accepted
+#define MNGR_WS_HANDSHAKE_SIZE 1024
+
+// Maximum length of the paths of the requests
+#define MNGR_WS_PATH_SIZE 256
+
+// Requests served on every call to mngr_ws_poll()
+#define MNGR_WS_STEP_REQUESTS 4
+
+// The file of the last read or write stays open for the next range, and is
+// closed after this long without requests
+#define MNGR_WS_FILE_IDLE_MS 2000
+
+// Operations of the binary requests. Every request starts with the operation,
+// the flags and a 16-bit id chosen by the client; the response repeats the
+// operation and the id with a status byte, the FRESULT of the operation or
+// MNGR_WS_STATUS_BAD_REQUEST. All the numbers are little endian and the paths
+// are not terminated.
+//
+// LIST:  u32 first entry, path. Response: u16 count, u8 more, and for each
+//        entry u8 attributes, u16 date, u16 time, u64 size, u8 name length and
+//        the name.
+// STAT:  path. Response: u8 attributes, u16 date, u16 time, u64 size.
+// READ:  u64 offset, u32 length, path. Response: the data, up to
+//        MNGR_WS_MAX_DATA bytes, less at the end of the file.
+// WRITE: u64 offset, u16 path length, path, data. The flag
+//        MNGR_WS_FLAG_TRUNCATE creates the file empty first. Response: u32
+//        bytes written.
+typedef enum {
+  MNGR_WS_OP_LIST = 1,
+  MNGR_WS_OP_STAT = 2,
+  MNGR_WS_OP_READ = 3,
+  MNGR_WS_OP_WRITE = 4
+} mngr_ws_op_t;
+
+#define MNGR_WS_FLAG_TRUNCATE 0x01
+#define MNGR_WS_STATUS_BAD_REQUEST 0xFF
+
+/**
+ * @brief Starts listening for WebSocket connections on MNGR_WS_PORT.
+ *
+ * Only one client is served at a time, to save TCP PCBs and pbufs.
+ */
+void mngr_ws_start(void);
+
+/**
+ * @brief Serves the requests received by the WebSocket channel.
+ *
+ * The lwIP callbacks only buffer the data: the SD card is accessed here. Must
+ * be called from the main loop.
+ */
+void mngr_ws_poll(void);
+
+/**
+ * @brief Closes the file kept open between read or write requests.
+ *
+ * Open files are locked by FatFS. The next request reopens it, so this must be
+ * called before renaming or deleting anything.
+ */
+void mngr_ws_suspend(void);
+
+#endif  // MNGR_WS_H
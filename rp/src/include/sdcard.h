@@ -97,6 +97,21 @@ void sdcard_setSpiSpeedSettings();
  */
 void sdcard_getInfo(FATFS *fsPtr, uint32_t *totalSizeMb, uint32_t *freeSpaceMb);
 
+/**
+ * @brief Reserve the space of a file about to be written.
+ *
+ * Allocates contiguous clusters for the whole file with f_expand, so writing
+ * it doesn't grow the cluster chain and disk images stay contiguous. The file
+ * takes the size at once: it must be truncated where the data ends if less is
+ * written. If the free space is fragmented the file is left empty and grows as
+ * written.
+ *
+ * @param file A file just created, open for writing and empty.
+ * @param size The size of the file. Nothing is reserved if 0.
+ * @return FR_OK, FR_DENIED if there is not enough free space, or the error.
+ */
+FRESULT sdcard_preallocate(FIL *file, FSIZE_t size);
+
 // Hardware Configuration of SPI "objects"
 
 // NOLINTBEGIN(readability-identifier-naming)
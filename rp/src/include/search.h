@@ -0,0 +1,140 @@
+/**
+ * File: search.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the background recursive search of the SD card
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "ff.h"
+#include "pico/stdlib.h"
+
+// Maximum number of searches running at the same time
+#define SEARCH_MAX_JOBS 2
+
+// Maximum length of the paths and of the pattern of a search
+#define SEARCH_PATH_SIZE 256
+#define SEARCH_PATTERN_SIZE 64
+
+// Deepest folder level visited below the folder searched
+#define SEARCH_MAX_DEPTH 16
+
+// Matches found and not yet fetched by the client. The walk pauses when full.
+#define SEARCH_RESULTS_SIZE 2048
+
+// Names of the subfolders still to visit. Subfolders that don't fit are not
+// searched and the search is reported as truncated.
+#define SEARCH_STACK_SIZE 4096
+
+// Directory entries read by each search on every call to search_poll()
+#define SEARCH_STEP_ENTRIES 32
+
+// Searches not fetched for this long are dropped
+#define SEARCH_TIMEOUT_MS (30 * 1000)
+
+typedef struct {
+  char path[SEARCH_PATH_SIZE];  // Full path of the match
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  BYTE fattrib;
+} search_result_t;
+
+// Only the folder being read is open, FatFS locks every open folder. The
+// subfolders found are pushed on a stack and visited once it is read.
+typedef struct {
+  bool in_use;
+  bool open;       // The folder of the current level is open
+  bool done;       // The whole tree was visited
+  bool truncated;  // Some subfolders were not searched
+  char token[32];
+  char folder[SEARCH_PATH_SIZE];
+  char pattern[SEARCH_PATTERN_SIZE];
+  char path[SEARCH_PATH_SIZE];  // Folder being read
+  int pathLen[SEARCH_MAX_DEPTH + 1];  // Length of the path at each level
+  int depth;
+  DIR dir;
+  int read;       // Entries of the folder read, skipped when reopening it
+  int skip;       // Matches to drop, already sent before a restart
+  int delivered;  // Matches handed to the client
+  FRESULT error;
+  uint8_t stack[SEARCH_STACK_SIZE];  // Level and name of the subfolders
+  size_t stackLen;
+  uint8_t results[SEARCH_RESULTS_SIZE];  // Packed pending matches
+  size_t head;
+  size_t tail;
+  absolute_time_t deadline;
+} search_job_t;
+
+/**
+ * @brief Gets the search of a token, starting it if needed.
+ *
+ * The search of the token continues if it is for the same folder and pattern
+ * and the client already has exactly @p index matches. Otherwise it starts
+ * again from the beginning and drops the first @p index matches, so a client
+ * can resume a search that was lost.
+ *
+ * @param token The token chosen by the client for the search.
+ * @param folder The folder searched, with all its subfolders.
+ * @param pattern A glob pattern with '*' and '?', or a substring to find in
+ * the names. Case insensitive.
+ * @param index The number of matches the client already has.
+ * @return The search, or NULL if the parameters are too long. The least
+ * recently fetched search is dropped when all of them are running.
+ */
+search_job_t *search_get(const char *token, const char *folder,
+                         const char *pattern, int index);
+
+/**
+ * @brief Takes the next match found by a search.
+ *
+ * @param job The search.
+ * @param result The match.
+ * @return true if there was a match waiting.
+ */
+bool search_read(search_job_t *job, search_result_t *result);
+
+/**
+ * @brief Checks whether a search is over and all its matches were read.
+ *
+ * @param job The search.
+ * @return true if there is nothing else to read.
+ */
+bool search_finished(const search_job_t *job);
+
+/**
+ * @brief Frees a search.
+ *
+ * @param job The search.
+ */
+void search_release(search_job_t *job);
+
+/**
+ * @brief Closes the folders read by the searches.
+ *
+ * Open folders are locked by FatFS. The searches reopen them on their next
+ * step, so this must be called before renaming or deleting anything.
+ */
+void search_suspend(void);
+
+/**
+ * @brief Advances the running searches.
+ *
+ * Reads at most SEARCH_STEP_ENTRIES entries of each search, so walking a large
+ * card never blocks the main loop for long. Must be called from the main loop.
+ */
+void search_poll(void);
+
+#endif  // SEARCH_H
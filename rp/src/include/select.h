@@ -21,6 +21,10 @@
 // Define a callback typdef for the reset function
 typedef void (*reset_callback_t)();
 
+// Work done by the secondary core between checks of the button. Returns true
+// if there was something to do.
+typedef bool (*idle_callback_t)();
+
 /**
  * @brief Initializes the SELECT detection.
  *
@@ -96,4 +100,14 @@ void select_setResetCallback(reset_callback_t reset);
  */
 void select_setLongResetCallback(reset_callback_t resetLong);
 
+/**
+ * @brief Registers the work of the secondary core.
+ *
+ * The secondary core calls it while waiting for the SELECT button, and only
+ * sleeps when it returns false. Must be set before select_coreWaitPush().
+ *
+ * @param idle Callback function doing the work, or NULL.
+ */
+void select_setIdleCallback(idle_callback_t idle);
+
 #endif  // SELECT_H
@@ -17,6 +17,7 @@
 #include "blink.h"
 #include "constants.h"
 #include "debug.h"
+#include "dircache.h"
 #include "diskio.h" /* Declarations of disk functions */
 #include "f_util.h"
 #include "ff.h"
@@ -0,0 +1,194 @@
+/**
+ * File: writeback.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the writes to the SD card done behind the network
+ */
+
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "ff.h"
+#include "hardware/sync.h"
+#include "lwip/pbuf.h"
+#include "pico/stdlib.h"
+
+// Files written at the same time: the downloads and the uploads
+#define WRITEBACK_MAX_STREAMS 4
+
+// Ring of buffers of each stream. The buffers hold whole sectors, so FatFS
+// writes them straight to the card, and are allocated when the stream opens.
+#define WRITEBACK_BUFFERS 4
+#define WRITEBACK_BUFFER_SIZE (8 * FF_MIN_SS)
+
+// Tells the owner of a stream that len bytes it received are on the card and
+// can be acknowledged to the sender
+typedef void (*writeback_recved_t)(void *arg, u16_t len);
+
+// Tells the owner of an aborted stream that it is freed, and its file can be
+// closed
+typedef void (*writeback_closed_t)(void *arg);
+
+// Data received with the ring full, and where it goes in the file. Parallel
+// writers of a stream each send their own part of the file.
+typedef struct writeback_segment {
+  struct writeback_segment *next;
+  struct pbuf *p;
+  FSIZE_t offset;  // Position of the first byte of p
+  FSIZE_t end;     // Position after the last byte of p
+} writeback_segment_t;
+
+// A file written by core 1. Core 0 fills the buffer at head and core 1 writes
+// the buffer at tail: each index is only changed by one core. A buffer written
+// is filled again once core 0 has reported it to the owner.
+typedef struct {
+  bool in_use;
+  FIL *file;
+  // WRITEBACK_BUFFERS buffers of WRITEBACK_BUFFER_SIZE bytes, and the position
+  // in the file and the length of the data of each one
+  uint8_t *data;
+  FSIZE_t offset[WRITEBACK_BUFFERS];
+  UINT length[WRITEBACK_BUFFERS];
+  volatile uint32_t head;        // Buffers filled
+  volatile uint32_t tail;        // Buffers written
+  volatile FRESULT error;        // First error of core 1
+  volatile bool dropping;        // Aborted: core 1 skips the buffers
+  bool flush;                    // Queue the last buffer once pending is empty
+  UINT fill;                     // Bytes in the buffer at head
+  FSIZE_t position;              // Position of the next byte in the ring
+  FSIZE_t received;              // Position of the next byte received
+  uint32_t acked;                // Buffers reported to the owner
+  writeback_segment_t *pending;  // Received with no free buffer, in order
+  writeback_segment_t *last;     // Last segment of pending
+  writeback_recved_t recved;     // NULL if the owner doesn't hold the window
+  void *arg;
+  writeback_closed_t closed;  // Called once an aborted stream is freed
+  void *closedArg;
+} writeback_stream_t;
+
+/**
+ * @brief Starts writing a file open for writing behind the network.
+ *
+ * The file must not be used until the stream is closed. The data received
+ * with the ring full is kept until there is room, so core 0 never waits for
+ * core 1. With a recved callback the owner holds the TCP window: the data
+ * received is only reported once written. Without it, the owner must bound
+ * the data it queues.
+ *
+ * @param file The file, with its position where the data starts.
+ * @param recved Called for the data written, or NULL.
+ * @param arg The argument of recved.
+ * @return The stream, or NULL if all are in use or there is no memory.
+ */
+writeback_stream_t *writeback_open(FIL *file, writeback_recved_t recved,
+                                   void *arg);
+
+/**
+ * @brief Stops reporting the data written, when the connection is gone.
+ *
+ * @param stream The stream.
+ */
+void writeback_detach(writeback_stream_t *stream);
+
+/**
+ * @brief Moves the position where the next data received is written.
+ *
+ * The data already received, even if still kept for lack of room, is written
+ * where it was received.
+ *
+ * @param stream The stream.
+ * @param offset The position in the file.
+ */
+void writeback_seek(writeback_stream_t *stream, FSIZE_t offset);
+
+/**
+ * @brief Queues the data of a pbuf chain and frees it.
+ *
+ * @param stream The stream.
+ * @param p The pbuf chain, owned by the stream from now on.
+ * @return ERR_OK, ERR_MEM if there is no memory to keep the data, or ERR_VAL
+ * once a write failed.
+ */
+err_t writeback_receive(writeback_stream_t *stream, struct pbuf *p);
+
+/**
+ * @brief Queues data. The data that doesn't fit in the ring is copied to a
+ * pbuf and kept until there is room.
+ *
+ * @param stream The stream.
+ * @param data The data.
+ * @param len The number of bytes.
+ * @return ERR_OK, ERR_MEM if there is no memory to keep the data, or ERR_VAL
+ * once a write failed.
+ */
+err_t writeback_write(writeback_stream_t *stream, const void *data,
+                      size_t len);
+
+/**
+ * @brief Queues the buffer being filled, even if it is not full. With data
+ * still kept for lack of room, the last buffer is queued once it is in.
+ *
+ * @param stream The stream.
+ */
+void writeback_flush(writeback_stream_t *stream);
+
+/**
+ * @brief Checks whether all the data queued is on the card.
+ *
+ * @param stream The stream.
+ * @return true if there is nothing left to write.
+ */
+bool writeback_isDrained(const writeback_stream_t *stream);
+
+/**
+ * @brief Writes the rest of the data and frees the stream.
+ *
+ * Waits for core 1 to write the buffers still queued, which can take as long
+ * as the SD card needs. From lwIP callbacks, only close the streams that
+ * writeback_isDrained() reports empty: it then returns at once. The file
+ * stays open.
+ *
+ * @param stream The stream.
+ * @return FR_OK, or the first error writing the file.
+ */
+FRESULT writeback_close(writeback_stream_t *stream);
+
+/**
+ * @brief Drops the data not written yet and frees the stream without waiting.
+ *
+ * The stream is freed by writeback_poll() once core 1 is done with the buffer
+ * it may be writing, and closed is called then: the file must stay open until
+ * that happens. The stream must not be used after this call.
+ *
+ * @param stream The stream.
+ * @param closed Called once the stream is freed, or NULL.
+ * @param arg The argument of closed.
+ */
+void writeback_abort(writeback_stream_t *stream, writeback_closed_t closed,
+                     void *arg);
+
+/**
+ * @brief Queues the data kept with the ring full and reports the data written.
+ * Also frees the aborted streams core 1 is done with.
+ *
+ * Must be called from the main loop of core 0.
+ */
+void writeback_poll(void);
+
+/**
+ * @brief Writes the buffers queued. Runs on core 1.
+ *
+ * @return true if a buffer was written, false if there was nothing to do.
+ */
+bool writeback_work(void);
+
+#endif  // WRITEBACK_H
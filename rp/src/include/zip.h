@@ -0,0 +1,126 @@
+/**
+ * File: zip.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Header for the ZIP archives of SD card folders built on the fly
+ */
+
+#ifndef ZIP_H
+#define ZIP_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "ff.h"
+#include "hardware/dma.h"
+#include "jobs.h"
+#include "pico/stdlib.h"
+
+// Record signatures and fixed sizes
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_DESCRIPTOR_SIG 0x08074b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_DESCRIPTOR_SIZE 16
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+
+// Maximum length of the paths in the archive
+#define ZIP_PATH_SIZE 256
+
+// Deepest folder level archived below the folder
+#define ZIP_MAX_DEPTH 16
+
+// Names of the subfolders still to visit
+#define ZIP_STACK_SIZE 2048
+
+// Directory entries read on every call to zip_prepare()
+#define ZIP_STEP_ENTRIES 32
+
+// The CRC32 of every entry is needed again for the central directory at the
+// end of the archive. They are kept in the ROM3 half of the ROM in RAM area,
+// after the copy buffer of the jobs, which limits the entries of an archive.
+#define ZIP_CRC_TABLE_OFFSET (JOBS_COPY_BUFFER_OFFSET + JOBS_COPY_BUFFER_SIZE)
+#define ZIP_MAX_ENTRIES \
+  ((2 * ROM_SIZE_BYTES - ZIP_CRC_TABLE_OFFSET) / sizeof(uint32_t))
+
+// Blocks shorter than this are not worth setting up the DMA sniffer
+#define ZIP_DMA_CRC_MIN_SIZE 64
+
+/**
+ * @brief Starts an archive of a folder with all its content.
+ *
+ * Only one archive is built at a time. The files are stored, not compressed:
+ * the archive is as large as its files plus the ZIP headers.
+ *
+ * @param folder The folder to archive.
+ * @return true if the archive was started, false if another one is being
+ * built.
+ */
+bool zip_open(const char *folder);
+
+/**
+ * @brief Walks the folder to find the size of the archive.
+ *
+ * Reads at most ZIP_STEP_ENTRIES directory entries per call, so a large
+ * folder never blocks the main loop for long.
+ *
+ * @param error Receives a short error message when the archive can't be built.
+ * @return 1 when the size is known, 0 if it must be called again, -1 on error.
+ */
+int zip_prepare(const char **error);
+
+/**
+ * @brief Gets the size of the archive, once zip_prepare() returned 1.
+ *
+ * @return The exact number of bytes zip_read() will produce.
+ */
+uint32_t zip_size(void);
+
+/**
+ * @brief Reads the next bytes of the archive.
+ *
+ * The headers are built and the files read from the SD card as the archive is
+ * sent, with their CRC32 computed on the way. Must be called from the main
+ * loop.
+ *
+ * @param buffer The buffer to fill.
+ * @param count The size of the buffer.
+ * @return The bytes read, 0 at the end of the archive, or -1 if the folder
+ * changed or the SD card failed while sending it.
+ */
+int zip_read(uint8_t *buffer, int count);
+
+/**
+ * @brief Ends the archive being built, sent or not.
+ */
+void zip_close(void);
+
+/**
+ * @brief Closes the folder read by the archive.
+ *
+ * Open folders are locked by FatFS. The archive reopens it on its next step,
+ * so this must be called before renaming or deleting anything.
+ */
+void zip_suspend(void);
+
+/**
+ * @brief Updates the CRC32 of a stream of bytes, as used by ZIP archives.
+ *
+ * Uses the DMA sniffer when a channel is free and the block is long enough.
+ *
+ * @param crc The CRC32 of the bytes before, 0 for the first block.
+ * @param data The next bytes.
+ * @param len The number of bytes.
+ * @return The CRC32 including the new bytes.
+ */
+uint32_t zip_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif  // ZIP_H
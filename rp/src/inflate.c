@@ -0,0 +1,286 @@
+/**
+ * File: inflate.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Streaming DEFLATE decoder (RFC 1951) with a fixed window
+ */
+
+#include "inflate.h"
+
+#define WINDOW_MASK (INFLATE_WINDOW_SIZE - 1)
+_Static_assert((INFLATE_WINDOW_SIZE & WINDOW_MASK) == 0,
+               "The window size must be a power of two");
+
+#define MAX_LIT_CODES 288
+#define MAX_DIST_CODES 30
+#define MAX_BITS 15
+
+// Base values and extra bits of the length and distance symbols
+static const uint16_t len_base[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                      11, 13, 15, 17,  19,  23,  27,  31,
+                                      35, 43, 51, 59,  67,  83,  99,  115,
+                                      131, 163, 195, 227, 258};
+static const uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                      1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order of the code length code lengths in a dynamic block header
+static const uint8_t clen_order[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                       11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+static bool fill_input(inflate_t *s) {
+  int n = s->read(s->readArg, s->input, sizeof(s->input));
+  if (n <= 0) {
+    DPRINTF("Compressed data ended early: %d\n", n);
+    return false;
+  }
+  s->inputPos = 0;
+  s->inputLen = n;
+  return true;
+}
+
+// Take the next bits of the stream, least significant first
+static bool get_bits(inflate_t *s, int need, uint32_t *value) {
+  while (s->bitCount < need) {
+    if (s->inputPos == s->inputLen && !fill_input(s)) return false;
+    s->bitBuf |= (uint32_t)s->input[s->inputPos++] << s->bitCount;
+    s->bitCount += 8;
+  }
+  *value = s->bitBuf & ((1u << need) - 1);
+  s->bitBuf >>= need;
+  s->bitCount -= need;
+  return true;
+}
+
+// Decode a symbol one bit at a time. Codes are packed most significant bit
+// first, and the codes of each length are consecutive.
+static int decode(inflate_t *s, const inflate_huffman_t *h) {
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  for (int len = 1; len <= MAX_BITS; len++) {
+    uint32_t bit;
+    if (!get_bits(s, 1, &bit)) return -1;
+    code |= (int)bit;
+    int count = h->count[len];
+    if (code - count < first) return h->symbol[index + (code - first)];
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -1;  // No code this long
+}
+
+// Build a code from the code lengths of its symbols. Returns 0 for a complete
+// code, a positive number if it is incomplete and -1 if it is oversubscribed.
+static int build(inflate_huffman_t *h, const uint8_t *lengths, int n) {
+  memset(h->count, 0, sizeof(h->count));
+  for (int symbol = 0; symbol < n; symbol++) h->count[lengths[symbol]]++;
+  if (h->count[0] == n) return 0;  // No codes: complete, but decode fails
+  int left = 1;
+  for (int len = 1; len <= MAX_BITS; len++) {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) return -1;
+  }
+  int16_t offs[MAX_BITS + 1];
+  offs[1] = 0;
+  for (int len = 1; len < MAX_BITS; len++) {
+    offs[len + 1] = offs[len] + h->count[len];
+  }
+  for (int symbol = 0; symbol < n; symbol++) {
+    if (lengths[symbol] != 0) h->symbol[offs[lengths[symbol]]++] = symbol;
+  }
+  return left;
+}
+
+static bool build_fixed(inflate_t *s) {
+  uint8_t lengths[MAX_LIT_CODES];
+  int symbol = 0;
+  for (; symbol < 144; symbol++) lengths[symbol] = 8;
+  for (; symbol < 256; symbol++) lengths[symbol] = 9;
+  for (; symbol < 280; symbol++) lengths[symbol] = 7;
+  for (; symbol < MAX_LIT_CODES; symbol++) lengths[symbol] = 8;
+  build(&s->lencode, lengths, MAX_LIT_CODES);
+  for (symbol = 0; symbol < MAX_DIST_CODES; symbol++) lengths[symbol] = 5;
+  build(&s->distcode, lengths, MAX_DIST_CODES);
+  return true;
+}
+
+static bool build_dynamic(inflate_t *s) {
+  uint32_t nlen, ndist, ncode;
+  if (!get_bits(s, 5, &nlen) || !get_bits(s, 5, &ndist) ||
+      !get_bits(s, 4, &ncode)) {
+    return false;
+  }
+  nlen += 257;
+  ndist += 1;
+  ncode += 4;
+  if (nlen > 286 || ndist > MAX_DIST_CODES) return false;
+  uint8_t lengths[MAX_LIT_CODES + MAX_DIST_CODES];
+  memset(lengths, 0, 19);
+  for (uint32_t i = 0; i < ncode; i++) {
+    uint32_t len;
+    if (!get_bits(s, 3, &len)) return false;
+    lengths[clen_order[i]] = (uint8_t)len;
+  }
+  // The code length code goes in the literal code until the lengths are read
+  if (build(&s->lencode, lengths, 19) != 0) return false;
+  uint32_t index = 0;
+  while (index < nlen + ndist) {
+    int symbol = decode(s, &s->lencode);
+    if (symbol < 0) return false;
+    if (symbol < 16) {
+      lengths[index++] = (uint8_t)symbol;
+      continue;
+    }
+    uint8_t len = 0;
+    uint32_t repeat;
+    if (symbol == 16) {
+      if (index == 0 || !get_bits(s, 2, &repeat)) return false;
+      len = lengths[index - 1];
+      repeat += 3;
+    } else if (symbol == 17) {
+      if (!get_bits(s, 3, &repeat)) return false;
+      repeat += 3;
+    } else {
+      if (!get_bits(s, 7, &repeat)) return false;
+      repeat += 11;
+    }
+    if (index + repeat > nlen + ndist) return false;
+    while (repeat--) lengths[index++] = len;
+  }
+  if (lengths[256] == 0) return false;  // No end of block code
+  // Incomplete codes are only allowed with a single code
+  int left = build(&s->lencode, lengths, nlen);
+  if (left < 0 || (left > 0 && nlen - s->lencode.count[0] != 1)) return false;
+  left = build(&s->distcode, lengths + nlen, ndist);
+  if (left < 0 || (left > 0 && ndist - s->distcode.count[0] != 1)) {
+    return false;
+  }
+  return true;
+}
+
+static bool start_block(inflate_t *s) {
+  uint32_t last, type;
+  if (!get_bits(s, 1, &last) || !get_bits(s, 2, &type)) return false;
+  s->last = last != 0;
+  switch (type) {
+    case 0: {
+      // Stored: the length and its complement start at a byte boundary
+      uint32_t len, nlen;
+      get_bits(s, s->bitCount & 7, &len);
+      if (!get_bits(s, 16, &len) || !get_bits(s, 16, &nlen)) return false;
+      if (len != (~nlen & 0xFFFF)) return false;
+      s->stored = len;
+      s->state = INFLATE_STATE_STORED;
+      return true;
+    }
+    case 1:
+      s->state = INFLATE_STATE_CODES;
+      return build_fixed(s);
+    case 2:
+      s->state = INFLATE_STATE_CODES;
+      return build_dynamic(s);
+    default:
+      return false;
+  }
+}
+
+static void end_block(inflate_t *s) {
+  s->state = s->last ? INFLATE_STATE_DONE : INFLATE_STATE_HEADER;
+}
+
+// Decode one symbol of a compressed block: a literal, the end of the block,
+// or a match, copied later
+static bool decode_symbol(inflate_t *s, uint8_t *out, uint32_t *n) {
+  int symbol = decode(s, &s->lencode);
+  if (symbol < 0) return false;
+  if (symbol < 256) {
+    out[(*n)++] = (uint8_t)symbol;
+    return true;
+  }
+  if (symbol == 256) {
+    end_block(s);
+    return true;
+  }
+  symbol -= 257;
+  if (symbol >= 29) return false;
+  uint32_t extra;
+  if (!get_bits(s, len_extra[symbol], &extra)) return false;
+  s->copyLen = len_base[symbol] + extra;
+  symbol = decode(s, &s->distcode);
+  if (symbol < 0 || symbol >= MAX_DIST_CODES) return false;
+  if (!get_bits(s, dist_extra[symbol], &extra)) return false;
+  s->copyDist = dist_base[symbol] + extra;
+  return true;
+}
+
+void inflate_init(inflate_t *s, uint8_t *window, inflate_read_fn read,
+                  void *arg) {
+  memset(s, 0, sizeof(inflate_t));
+  s->state = INFLATE_STATE_HEADER;
+  s->window = window;
+  s->read = read;
+  s->readArg = arg;
+}
+
+int inflate_read(inflate_t *s, const uint8_t **data, int max) {
+  uint32_t start = s->position;
+  uint8_t *out = s->window + start;
+  uint32_t room = INFLATE_WINDOW_SIZE - start;
+  if (room > (uint32_t)max) room = (uint32_t)max;
+  uint32_t n = 0;
+  bool ok = true;
+  while (ok && n < room) {
+    if (s->copyLen > 0) {
+      // The history is the bytes before the output, wrapping in the window
+      if (s->copyDist > s->total + n) {
+        ok = false;
+        break;
+      }
+      while (s->copyLen > 0 && n < room) {
+        out[n] = s->window[(start + n - s->copyDist) & WINDOW_MASK];
+        n++;
+        s->copyLen--;
+      }
+      continue;
+    }
+    if (s->state == INFLATE_STATE_HEADER) {
+      ok = start_block(s);
+    } else if (s->state == INFLATE_STATE_STORED) {
+      if (s->stored == 0) {
+        end_block(s);
+        continue;
+      }
+      uint32_t byte;
+      ok = get_bits(s, 8, &byte);
+      out[n++] = (uint8_t)byte;
+      s->stored--;
+    } else if (s->state == INFLATE_STATE_CODES) {
+      ok = decode_symbol(s, out, &n);
+    } else {
+      break;
+    }
+  }
+  if (!ok) {
+    DPRINTF("Corrupt compressed data after %lu bytes\n",
+            (unsigned long)s->total);
+    s->state = INFLATE_STATE_ERROR;
+  }
+  if (s->state == INFLATE_STATE_ERROR) return -1;
+  s->position = (start + n) & WINDOW_MASK;
+  s->total = (s->total + n > INFLATE_WINDOW_SIZE) ? INFLATE_WINDOW_SIZE
+                                                  : s->total + n;
+  *data = out;
+  return (int)n;
+}
@@ -0,0 +1,748 @@
+/**
+ * File: jobs.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Background file operations on the SD card
+ */
+
+#include "jobs.h"
+
+#include "zip.h"
+
+static const char *op_names[] = {"rmtree", "copy", "move", "unzip"};
+static const char *state_names[] = {"queued", "running", "done", "failed",
+                                    "cancelled"};
+
+static jobs_job_t jobs[JOBS_MAX_JOBS] = {0};
+static uint32_t nextId = 1;
+
+// State of the running job. Only the folder being read is open, FatFS locks
+// every open folder.
+typedef struct {
+  jobs_job_t *job;
+  bool isDir;  // The source is a folder
+  char rel[JOBS_PATH_SIZE];  // Folder being read, relative to the source
+  int relLen[JOBS_MAX_DEPTH + 1];  // Length of rel at each level
+  int depth;
+  DIR dir;
+  bool dirOpen;
+  int read;  // Entries of the folder read, skipped when reopening it
+  FIL in;
+  FIL out;
+  bool copying;
+  FILINFO copyInfo;              // Entry of the file being copied
+  char copyPath[JOBS_PATH_SIZE];  // Destination of the file being copied
+  uint8_t stack[JOBS_STACK_SIZE];  // Level and name of the folders to copy
+  size_t stackLen;
+  bool archiveOpen;  // The archive being extracted is open in the input
+  FSIZE_t cdPos;     // Next entry of its central directory
+  uint32_t entriesLeft;
+  FSIZE_t entryLeft;  // Compressed bytes of the entry not read yet
+  uint32_t entryCrc;
+  uint32_t crc;  // CRC32 of the bytes extracted
+  bool deflated;
+  inflate_t inflate;
+} jobs_runner_t;
+
+static jobs_runner_t runner = {0};
+
+#define COPY_BUFFER \
+  ((uint8_t *)&__rom_in_ram_start__ + JOBS_COPY_BUFFER_OFFSET)
+_Static_assert(JOBS_COPY_BUFFER_SIZE % FF_MAX_SS == 0,
+               "The copy buffer must be a multiple of the sector size");
+_Static_assert(JOBS_COPY_BUFFER_OFFSET + JOBS_COPY_BUFFER_SIZE <=
+                   2 * ROM_SIZE_BYTES,
+               "The copy buffer must fit in the ROM in RAM area");
+_Static_assert(JOBS_COPY_BUFFER_SIZE == INFLATE_WINDOW_SIZE,
+               "The copy buffer is the window of the decoder");
+
+// Full path of an entry of a folder below the source or the destination
+static bool join_path(char *out, const char *root, const char *rel,
+                      const char *name) {
+  int len = snprintf(out, JOBS_PATH_SIZE, "%s%s%s%s", root, rel,
+                     name ? "/" : "", name ? name : "");
+  return len < JOBS_PATH_SIZE;
+}
+
+// Copy a path without its trailing slashes. The root is not accepted.
+static bool normalize_path(const char *in, char *out) {
+  size_t len = strlen(in);
+  while (len > 0 && in[len - 1] == '/') len--;
+  if (len == 0 || len >= JOBS_PATH_SIZE) return false;
+  memcpy(out, in, len);
+  out[len] = '\0';
+  return true;
+}
+
+static void job_error(jobs_job_t *job, FRESULT fr, const char *path) {
+  DPRINTF("Job %lu: error %d on %s\n", (unsigned long)job->id, fr, path);
+  job->errors++;
+  job->lastError = fr;
+}
+
+static void close_dir(void) {
+  if (runner.dirOpen) {
+    f_closedir(&runner.dir);
+    runner.dirOpen = false;
+  }
+}
+
+static void finish_job(jobs_state_t state) {
+  jobs_job_t *job = runner.job;
+  close_dir();
+  if (runner.copying) {
+    if (!runner.archiveOpen) f_close(&runner.in);
+    f_close(&runner.out);
+    f_unlink(runner.copyPath);  // Partial copy
+    runner.copying = false;
+  }
+  if (runner.archiveOpen) {
+    f_close(&runner.in);
+    runner.archiveOpen = false;
+  }
+  if (job->op != JOBS_OP_COPY && job->op != JOBS_OP_UNZIP) {
+    dircache_invalidate(job->src);
+  }
+  if (job->op != JOBS_OP_RMTREE) dircache_invalidate(job->dst);
+  job->state = state;
+  DPRINTF("Job %lu %s: %lu files, %lu folders, %llu bytes, %lu errors\n",
+          (unsigned long)job->id, state_names[state],
+          (unsigned long)job->filesDone, (unsigned long)job->foldersDone,
+          (unsigned long long)job->bytesDone, (unsigned long)job->errors);
+  runner.job = NULL;
+}
+
+static void rmtree_step(void) {
+  jobs_job_t *job = runner.job;
+  char path[JOBS_PATH_SIZE];
+  join_path(path, job->src, runner.rel, NULL);
+  FRESULT fr;
+  if (!runner.isDir) {
+    fr = f_chmod(path, 0, AM_RDO);
+    if (fr == FR_OK) fr = f_unlink(path);
+    if (fr != FR_OK) {
+      job_error(job, fr, path);
+      finish_job(JOBS_STATE_FAILED);
+      return;
+    }
+    job->filesDone++;
+    finish_job(JOBS_STATE_DONE);
+    return;
+  }
+  if (!runner.dirOpen) {
+    fr = f_opendir(&runner.dir, path);
+    if (fr != FR_OK) {
+      job_error(job, fr, path);
+      finish_job(JOBS_STATE_FAILED);
+      return;
+    }
+    runner.dirOpen = true;
+  }
+  // Every entry read is deleted, so the folder is always read from the start
+  FILINFO fno;
+  fr = f_readdir(&runner.dir, &fno);
+  if (fr != FR_OK) {
+    job_error(job, fr, path);
+    finish_job(JOBS_STATE_FAILED);
+    return;
+  }
+  if (fno.fname[0] == '\0') {
+    // Empty now: remove the folder and go back to its parent
+    close_dir();
+    fr = f_chmod(path, 0, AM_RDO);
+    if (fr == FR_OK) fr = f_unlink(path);
+    dircache_invalidate(path);
+    if (fr != FR_OK) {
+      job_error(job, fr, path);
+      finish_job(JOBS_STATE_FAILED);
+      return;
+    }
+    job->foldersDone++;
+    if (runner.depth == 0) {
+      finish_job(JOBS_STATE_DONE);
+      return;
+    }
+    *strrchr(runner.rel, '/') = '\0';
+    runner.depth--;
+    return;
+  }
+  char child[JOBS_PATH_SIZE];
+  if (!join_path(child, job->src, runner.rel, fno.fname) ||
+      ((fno.fattrib & AM_DIR) && runner.depth >= JOBS_MAX_DEPTH)) {
+    job_error(job, FR_INVALID_NAME, child);
+    finish_job(JOBS_STATE_FAILED);
+    return;
+  }
+  if (fno.fattrib & AM_DIR) {
+    // Empty the subfolder first
+    close_dir();
+    strcat(runner.rel, "/");
+    strcat(runner.rel, fno.fname);
+    runner.depth++;
+    return;
+  }
+  fr = FR_OK;
+  if (fno.fattrib & AM_RDO) fr = f_chmod(child, 0, AM_RDO);
+  if (fr == FR_OK) fr = f_unlink(child);
+  if (fr != FR_OK) {
+    job_error(job, fr, child);
+    finish_job(JOBS_STATE_FAILED);
+    return;
+  }
+  dircache_invalidate(child);
+  job->filesDone++;
+  job->bytesDone += fno.fsize;
+}
+
+// Open a source file and create its copy. Errors are counted and the file
+// is skipped.
+static bool start_file_copy(const char *src, const char *dst,
+                            const FILINFO *fno) {
+  jobs_job_t *job = runner.job;
+  FRESULT fr = f_open(&runner.in, src, FA_READ);
+  if (fr != FR_OK) {
+    job_error(job, fr, src);
+    return false;
+  }
+  fr = f_open(&runner.out, dst, FA_WRITE | FA_CREATE_NEW);
+  if (fr != FR_OK) {
+    f_close(&runner.in);
+    job_error(job, fr, dst);
+    return false;
+  }
+  // Allocate the whole file at once in contiguous clusters, so the copy
+  // writes no FAT chain and reads back fast. Without room for it, the file
+  // grows as usual.
+  if (fno->fsize > 0) {
+    fr = f_expand(&runner.out, fno->fsize, 1);
+    if (fr != FR_OK) {
+      DPRINTF("No contiguous space for %s: %d\n", dst, fr);
+    }
+  }
+  dircache_invalidate(dst);
+  runner.copyInfo = *fno;
+  strcpy(runner.copyPath, dst);
+  runner.copying = true;
+  job->fileSize = fno->fsize;
+  job->fileDone = 0;
+  return true;
+}
+
+static void copy_chunk(void) {
+  jobs_job_t *job = runner.job;
+  UINT br = 0, bw = 0;
+  FRESULT fr = f_read(&runner.in, COPY_BUFFER, JOBS_COPY_BUFFER_SIZE, &br);
+  if (fr == FR_OK && br > 0) {
+    fr = f_write(&runner.out, COPY_BUFFER, br, &bw);
+    if (fr == FR_OK && bw < br) fr = FR_DENIED;  // Card full
+  }
+  job->bytesDone += bw;
+  job->fileDone += bw;
+  if (fr != FR_OK) {
+    job_error(job, fr, runner.copyPath);
+    f_close(&runner.in);
+    f_close(&runner.out);
+    f_unlink(runner.copyPath);
+    runner.copying = false;
+    return;
+  }
+  if (br < JOBS_COPY_BUFFER_SIZE) {
+    f_close(&runner.in);
+    fr = f_close(&runner.out);
+    if (fr != FR_OK) {
+      job_error(job, fr, runner.copyPath);
+    } else {
+      // Keep the timestamp of the original
+      f_utime(runner.copyPath, &runner.copyInfo);
+      job->filesDone++;
+    }
+    runner.copying = false;
+  }
+}
+
+// Remember a subfolder to copy as its level and its name
+static void push_folder(const char *name) {
+  size_t nameLen = strlen(name);
+  if (runner.depth >= JOBS_MAX_DEPTH ||
+      runner.stackLen + nameLen + 2 > JOBS_STACK_SIZE) {
+    job_error(runner.job, FR_NOT_ENOUGH_CORE, name);
+    return;
+  }
+  runner.stack[runner.stackLen++] = (uint8_t)(runner.depth + 1);
+  memcpy(runner.stack + runner.stackLen, name, nameLen + 1);
+  runner.stackLen += nameLen + 1;
+}
+
+// Move to the next subfolder to copy and create its copy. Its parent is still
+// the folder at the level below, as the subfolders of the folders copied in
+// between are all popped.
+static bool next_folder(void) {
+  jobs_job_t *job = runner.job;
+  while (runner.stackLen > 0) {
+    size_t start = runner.stackLen - 1;  // Terminator of the name
+    while (start > 0 && runner.stack[start - 1] != '\0') start--;
+    int depth = runner.stack[start];
+    const char *name = (const char *)&runner.stack[start + 1];
+    int len = runner.relLen[depth - 1];
+    len += snprintf(runner.rel + len, sizeof(runner.rel) - len, "/%s", name);
+    runner.stackLen = start;
+    char dst[JOBS_PATH_SIZE];
+    FRESULT fr = FR_INVALID_NAME;
+    if (len < (int)sizeof(runner.rel) &&
+        join_path(dst, job->dst, runner.rel, NULL)) {
+      fr = f_mkdir(dst);
+    }
+    if (fr != FR_OK) {
+      job_error(job, fr, runner.rel);
+      runner.rel[runner.relLen[depth - 1]] = '\0';
+      continue;
+    }
+    dircache_invalidate(dst);
+    job->foldersDone++;
+    runner.relLen[depth] = len;
+    runner.depth = depth;
+    runner.read = 0;
+    return true;
+  }
+  return false;
+}
+
+static void copy_step(void) {
+  jobs_job_t *job = runner.job;
+  if (runner.copying) {
+    copy_chunk();
+    return;
+  }
+  if (!runner.isDir) {
+    finish_job(job->errors ? JOBS_STATE_FAILED : JOBS_STATE_DONE);
+    return;
+  }
+  char path[JOBS_PATH_SIZE];
+  join_path(path, job->src, runner.rel, NULL);
+  FILINFO fno;
+  FRESULT fr = FR_OK;
+  if (!runner.dirOpen) {
+    fr = f_opendir(&runner.dir, path);
+    if (fr == FR_OK) {
+      runner.dirOpen = true;
+      for (int i = 0; i < runner.read && fr == FR_OK; i++) {
+        fr = f_readdir(&runner.dir, &fno);
+      }
+    }
+  }
+  if (fr == FR_OK) fr = f_readdir(&runner.dir, &fno);
+  if (fr != FR_OK || fno.fname[0] == '\0') {
+    if (fr != FR_OK) job_error(job, fr, path);
+    close_dir();
+    if (!next_folder()) finish_job(JOBS_STATE_DONE);
+    return;
+  }
+  runner.read++;
+  if (fno.fattrib & AM_DIR) {
+    push_folder(fno.fname);
+    return;
+  }
+  char src[JOBS_PATH_SIZE];
+  char dst[JOBS_PATH_SIZE];
+  if (!join_path(src, job->src, runner.rel, fno.fname) ||
+      !join_path(dst, job->dst, runner.rel, fno.fname)) {
+    job_error(job, FR_INVALID_NAME, fno.fname);
+    return;
+  }
+  start_file_copy(src, dst, &fno);
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Find the central directory of the archive in its end record, the last
+// record of the file before a comment
+static bool open_archive(void) {
+  jobs_job_t *job = runner.job;
+  FRESULT fr = f_open(&runner.in, job->src, FA_READ);
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    return false;
+  }
+  runner.archiveOpen = true;
+  FSIZE_t size = f_size(&runner.in);
+  UINT tail = size < JOBS_COPY_BUFFER_SIZE ? (UINT)size : JOBS_COPY_BUFFER_SIZE;
+  UINT br = 0;
+  fr = f_lseek(&runner.in, size - tail);
+  if (fr == FR_OK) fr = f_read(&runner.in, COPY_BUFFER, tail, &br);
+  const uint8_t *end = NULL;
+  for (int i = (int)br - ZIP_END_SIZE; fr == FR_OK && i >= 0; i--) {
+    if (get32(COPY_BUFFER + i) == ZIP_END_SIG) {
+      end = COPY_BUFFER + i;
+      break;
+    }
+  }
+  // ZIP64 archives, over 4GB or 65535 entries, are not supported
+  if (fr == FR_OK && (!end || get16(end + 10) == 0xFFFF ||
+                      get32(end + 16) == 0xFFFFFFFF)) {
+    fr = FR_INVALID_OBJECT;
+  }
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    return false;
+  }
+  runner.cdPos = get32(end + 16);
+  runner.entriesLeft = get16(end + 10);
+  return true;
+}
+
+// Destination of an entry of the archive. Absolute names and names going up
+// with ".." would write outside the folder.
+static bool entry_path(char *name, char *path) {
+  for (char *c = name; *c; c++) {
+    if (*c == '\\') *c = '/';
+  }
+  if (name[0] == '\0' || name[0] == '/' || strchr(name, ':')) return false;
+  for (const char *c = name; *c;) {
+    size_t len = strcspn(c, "/");
+    if (len == 2 && c[0] == '.' && c[1] == '.') return false;
+    c += len;
+    if (*c) c++;
+  }
+  return join_path(path, runner.job->dst, "", name);
+}
+
+// Create the folders of an entry missing in the destination. The last ones
+// are remembered, as the entries of a folder usually come together.
+static bool make_parents(char *path) {
+  jobs_job_t *job = runner.job;
+  size_t len = strrchr(path, '/') - path;
+  if (strlen(runner.rel) == len && strncmp(runner.rel, path, len) == 0) {
+    return true;
+  }
+  runner.rel[0] = '\0';
+  for (char *c = path + strlen(job->dst) + 1; (c = strchr(c, '/')); c++) {
+    *c = '\0';
+    FRESULT fr = f_mkdir(path);
+    if (fr == FR_OK) {
+      dircache_invalidate(path);
+      job->foldersDone++;
+    }
+    if (fr != FR_OK && fr != FR_EXIST) {
+      job_error(job, fr, path);
+      *c = '/';
+      return false;
+    }
+    *c = '/';
+  }
+  memcpy(runner.rel, path, len);
+  runner.rel[len] = '\0';
+  return true;
+}
+
+// Compressed data of the entry being extracted
+static int unzip_input(void *arg, uint8_t *buffer, int len) {
+  (void)arg;
+  if ((FSIZE_t)len > runner.entryLeft) len = (int)runner.entryLeft;
+  UINT br = 0;
+  if (f_read(&runner.in, buffer, len, &br) != FR_OK) return -1;
+  runner.entryLeft -= br;
+  return (int)br;
+}
+
+// Skip the local header of an entry and create its file. Errors are counted
+// and the entry is skipped.
+static void start_entry(const uint8_t *h, const char *path) {
+  jobs_job_t *job = runner.job;
+  uint8_t local[ZIP_LOCAL_SIZE];
+  UINT br = 0;
+  FRESULT fr = f_lseek(&runner.in, get32(h + 42));
+  if (fr == FR_OK) fr = f_read(&runner.in, local, sizeof(local), &br);
+  if (fr == FR_OK && (br < sizeof(local) || get32(local) != ZIP_LOCAL_SIG)) {
+    fr = FR_INT_ERR;
+  }
+  if (fr == FR_OK) {
+    fr = f_lseek(&runner.in, get32(h + 42) + ZIP_LOCAL_SIZE +
+                                 get16(local + 26) + get16(local + 28));
+  }
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    return;
+  }
+  fr = f_open(&runner.out, path, FA_WRITE | FA_CREATE_ALWAYS);
+  if (fr != FR_OK) {
+    job_error(job, fr, path);
+    return;
+  }
+  FSIZE_t size = get32(h + 24);
+  if (size > 0) {
+    fr = f_expand(&runner.out, size, 1);
+    if (fr != FR_OK) {
+      DPRINTF("No contiguous space for %s: %d\n", path, fr);
+    }
+  }
+  dircache_invalidate(path);
+  runner.copyInfo.fdate = get16(h + 14);
+  runner.copyInfo.ftime = get16(h + 12);
+  strcpy(runner.copyPath, path);
+  runner.entryLeft = get32(h + 20);
+  runner.entryCrc = get32(h + 16);
+  runner.crc = 0;
+  runner.deflated = get16(h + 10) == 8;
+  if (runner.deflated) {
+    inflate_init(&runner.inflate, COPY_BUFFER, unzip_input, NULL);
+  }
+  runner.copying = true;
+  job->fileSize = size;
+  job->fileDone = 0;
+}
+
+// Extract the next chunk of the entry. The file is removed if its data is
+// corrupt.
+static void unzip_chunk(void) {
+  jobs_job_t *job = runner.job;
+  const uint8_t *data = COPY_BUFFER;
+  int n;
+  if (runner.deflated) {
+    n = inflate_read(&runner.inflate, &data, JOBS_UNZIP_CHUNK_SIZE);
+  } else {
+    n = unzip_input(NULL, COPY_BUFFER, JOBS_COPY_BUFFER_SIZE);
+  }
+  FRESULT fr = FR_OK;
+  if (n < 0 || job->fileDone + n > job->fileSize) {
+    fr = FR_INT_ERR;
+  } else if (n > 0) {
+    UINT bw = 0;
+    fr = f_write(&runner.out, data, n, &bw);
+    if (fr == FR_OK && bw < (UINT)n) fr = FR_DENIED;  // Card full
+    runner.crc = zip_crc32(runner.crc, data, bw);
+    job->bytesDone += bw;
+    job->fileDone += bw;
+    if (fr == FR_OK) return;
+  } else if (job->fileDone != job->fileSize || runner.crc != runner.entryCrc) {
+    fr = FR_INT_ERR;
+  }
+  runner.copying = false;
+  FRESULT closed = f_close(&runner.out);
+  if (fr == FR_OK) fr = closed;
+  if (fr != FR_OK) {
+    job_error(job, fr, runner.copyPath);
+    f_unlink(runner.copyPath);
+    return;
+  }
+  f_utime(runner.copyPath, &runner.copyInfo);
+  job->filesDone++;
+}
+
+// Extract the next entry of the central directory, or a chunk of the current
+// one
+static void unzip_step(void) {
+  jobs_job_t *job = runner.job;
+  if (runner.copying) {
+    unzip_chunk();
+    return;
+  }
+  if (runner.entriesLeft == 0) {
+    finish_job(job->errors ? JOBS_STATE_FAILED : JOBS_STATE_DONE);
+    return;
+  }
+  runner.entriesLeft--;
+  uint8_t h[ZIP_CENTRAL_SIZE];
+  char name[JOBS_PATH_SIZE];
+  UINT br = 0;
+  FRESULT fr = f_lseek(&runner.in, runner.cdPos);
+  if (fr == FR_OK) fr = f_read(&runner.in, h, sizeof(h), &br);
+  if (fr == FR_OK && (br < sizeof(h) || get32(h) != ZIP_CENTRAL_SIG)) {
+    fr = FR_INT_ERR;
+  }
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    finish_job(JOBS_STATE_FAILED);
+    return;
+  }
+  uint16_t nameLen = get16(h + 28);
+  runner.cdPos += ZIP_CENTRAL_SIZE + nameLen + get16(h + 30) + get16(h + 32);
+  if (nameLen >= sizeof(name)) {
+    job_error(job, FR_INVALID_NAME, job->src);
+    return;
+  }
+  fr = f_read(&runner.in, name, nameLen, &br);
+  if (fr == FR_OK && br < nameLen) fr = FR_INT_ERR;
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    return;
+  }
+  name[nameLen] = '\0';
+  char path[JOBS_PATH_SIZE];
+  if (!entry_path(name, path)) {
+    job_error(job, FR_INVALID_NAME, name);
+    return;
+  }
+  // Folder entries end with a slash: creating their parents is enough
+  if (!make_parents(path) || path[strlen(path) - 1] == '/') return;
+  uint16_t method = get16(h + 10);
+  if ((get16(h + 8) & 0x0001) || (method != 0 && method != 8)) {
+    job_error(job, FR_INVALID_PARAMETER, path);  // Encrypted or unsupported
+    return;
+  }
+  start_entry(h, path);
+}
+
+// Start the next job: moves are done at once, copies create the top level
+// destination and extractions open the archive
+static void begin_job(jobs_job_t *job) {
+  memset(&runner, 0, sizeof(runner));
+  runner.job = job;
+  job->state = JOBS_STATE_RUNNING;
+  DPRINTF("Job %lu: %s %s %s\n", (unsigned long)job->id, op_names[job->op],
+          job->src, job->dst);
+  FILINFO fno;
+  FRESULT fr = f_stat(job->src, &fno);
+  if (fr != FR_OK) {
+    job_error(job, fr, job->src);
+    finish_job(JOBS_STATE_FAILED);
+    return;
+  }
+  runner.isDir = (fno.fattrib & AM_DIR) != 0;
+  switch (job->op) {
+    case JOBS_OP_MOVE:
+      fr = f_rename(job->src, job->dst);
+      if (fr != FR_OK) {
+        job_error(job, fr, job->dst);
+        finish_job(JOBS_STATE_FAILED);
+        return;
+      }
+      if (runner.isDir) {
+        job->foldersDone++;
+      } else {
+        job->filesDone++;
+        job->bytesDone += fno.fsize;
+      }
+      finish_job(JOBS_STATE_DONE);
+      return;
+    case JOBS_OP_COPY:
+      if (runner.isDir) {
+        fr = f_mkdir(job->dst);
+        if (fr != FR_OK) {
+          job_error(job, fr, job->dst);
+          finish_job(JOBS_STATE_FAILED);
+          return;
+        }
+        dircache_invalidate(job->dst);
+        job->foldersDone++;
+      } else if (!start_file_copy(job->src, job->dst, &fno)) {
+        finish_job(JOBS_STATE_FAILED);
+      }
+      return;
+    case JOBS_OP_UNZIP:
+      fr = runner.isDir ? FR_INVALID_OBJECT : f_mkdir(job->dst);
+      if (fr == FR_OK) {
+        dircache_invalidate(job->dst);
+        job->foldersDone++;
+      } else if (fr != FR_EXIST) {
+        job_error(job, fr, job->dst);
+        finish_job(JOBS_STATE_FAILED);
+        return;
+      }
+      if (!open_archive()) finish_job(JOBS_STATE_FAILED);
+      return;
+    default:
+      return;
+  }
+}
+
+uint32_t jobs_start(jobs_op_t op, const char *src, const char *dst,
+                    const char **error) {
+  char s[JOBS_PATH_SIZE];
+  char d[JOBS_PATH_SIZE] = {0};
+  if (!normalize_path(src, s)) {
+    *error = "invalid source";
+    return 0;
+  }
+  if (op != JOBS_OP_RMTREE) {
+    size_t len = strlen(s);
+    if (!dst || !normalize_path(dst, d)) {
+      *error = "invalid destination";
+      return 0;
+    }
+    // FAT paths ignore the case
+    if (strncasecmp(d, s, len) == 0 && (d[len] == '\0' || d[len] == '/')) {
+      *error = "destination inside source";
+      return 0;
+    }
+  }
+  // A free slot, or the oldest finished job
+  jobs_job_t *job = NULL;
+  for (int i = 0; i < JOBS_MAX_JOBS; i++) {
+    jobs_job_t *j = &jobs[i];
+    if (!j->in_use) {
+      job = j;
+      break;
+    }
+    if (j->state >= JOBS_STATE_DONE && (!job || j->id < job->id)) job = j;
+  }
+  if (!job) {
+    *error = "queue full";
+    return 0;
+  }
+  memset(job, 0, sizeof(jobs_job_t));
+  job->in_use = true;
+  job->id = nextId++;
+  job->op = op;
+  job->state = JOBS_STATE_QUEUED;
+  strcpy(job->src, s);
+  strcpy(job->dst, d);
+  DPRINTF("Job %lu queued\n", (unsigned long)job->id);
+  return job->id;
+}
+
+const jobs_job_t *jobs_get(uint32_t id) {
+  for (int i = 0; i < JOBS_MAX_JOBS; i++) {
+    if (jobs[i].in_use && jobs[i].id == id) return &jobs[i];
+  }
+  return NULL;
+}
+
+bool jobs_cancel(uint32_t id) {
+  jobs_job_t *job = (jobs_job_t *)jobs_get(id);
+  if (!job) return false;
+  if (job == runner.job) {
+    finish_job(JOBS_STATE_CANCELLED);
+    return true;
+  }
+  if (job->state != JOBS_STATE_QUEUED) return false;
+  job->state = JOBS_STATE_CANCELLED;
+  return true;
+}
+
+const char *jobs_opName(jobs_op_t op) { return op_names[op]; }
+
+const char *jobs_stateName(jobs_state_t state) { return state_names[state]; }
+
+void jobs_suspend(void) { close_dir(); }
+
+void jobs_poll(void) {
+  if (!runner.job) {
+    // Jobs run in the order they were queued
+    jobs_job_t *next = NULL;
+    for (int i = 0; i < JOBS_MAX_JOBS; i++) {
+      jobs_job_t *j = &jobs[i];
+      if (j->in_use && j->state == JOBS_STATE_QUEUED &&
+          (!next || j->id < next->id)) {
+        next = j;
+      }
+    }
+    if (!next) return;
+    begin_job(next);
+  }
+  absolute_time_t end = make_timeout_time_us(JOBS_STEP_BUDGET_US);
+  for (int i = 0; i < JOBS_STEP_OPS && runner.job && !time_reached(end);
+       i++) {
+    if (runner.job->op == JOBS_OP_RMTREE) {
+      rmtree_step();
+    } else if (runner.job->op == JOBS_OP_UNZIP) {
+      unzip_step();
+    } else {
+      copy_step();
+    }
+  }
+}
@@ -120,17 +120,26 @@
 // debug
 #define LWIP_HTTPD_SSI_INCLUDE_TAG 0
 #define LWIP_HTTPD_SSI_MULTIPART 1
+// Room for several directory entries in each part of a streamed listing
+#define LWIP_HTTPD_MAX_TAG_INSERT_LEN 512
 #define LWIP_HTTPD_DYNAMIC_HEADERS 0
 #define LWIP_HTTPD_SUPPORT_POST 1
+// The uploads to the SD card acknowledge the body once written
+#define LWIP_HTTPD_POST_MANUAL_WND 1
 #define LWIP_HTTPD_SUPPORT_11_KEEPALIVE 1
 
 #define LWIP_HTTPD_FS_ASYNC_READ 1
+// SD card files are served as custom files read in pieces from FatFS
+#define LWIP_HTTPD_CUSTOM_FILES 1
+#define LWIP_HTTPD_DYNAMIC_FILE_READ 1
+// Per-connection state of the files, used for the JSON response contexts
+#define LWIP_HTTPD_FILE_STATE 1
 #define HTTPD_POLL_INTERVAL 1
 #define HTTPD_PRECALCULATED_CHECKSUM 1
 #define HTTPD_USE_MEM_POOL 1
 
-#define MEMP_NUM_PARALLEL_HTTPD_CONNS 2
-#define MEMP_NUM_PARALLEL_HTTPD_SSI_CONNS 2
+#define MEMP_NUM_PARALLEL_HTTPD_CONNS 4
+#define MEMP_NUM_PARALLEL_HTTPD_SSI_CONNS 4
 
 #define LWIP_HTTPD_ABORT_ON_CLOSE_MEM_ERROR 1
 
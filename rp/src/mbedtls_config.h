@@ -94,6 +94,7 @@
 #define MBEDTLS_MD_C        // MD generic code
 #define MBEDTLS_MD5_C       // MD5
 #define MBEDTLS_POLY1305_C  // Poly1305 MAC
+#define MBEDTLS_SHA1_C      // SHA 1, for the WebSocket handshake
 #define MBEDTLS_SHA256_C    // SHA 256
 #define MBEDTLS_SHA512_C    // SHA 512
 
@@ -257,7 +257,9 @@ int mngr_init() {
   // Disable the SELECT button
   select_coreWaitPushDisable();
 
-  // Enable the SELECT button again, but only to reset the BOOSTER
+  // Enable the SELECT button again, but only to reset the BOOSTER. Core 1
+  // also writes the downloads and the uploads to the SD card meanwhile.
+  select_setIdleCallback(writeback_work);
   select_coreWaitPush(reset_device,
                       reset_deviceAndEraseFlash);  // Wait for the SELECT
                                                    // button to be pushed
@@ -274,8 +276,8 @@ int mngr_init() {
   // Start the HTTP server
   mngr_httpd_start(sdcard_err);
 
-  absolute_time_t start_download_time =
-      make_timeout_time_ms(86400 * 1000);  // 3 seconds to start the download
+  // Start the WebSocket channel of the file manager
+  mngr_ws_start();
 
   bool usbInitialized = false;  // USB not initialized yet
   while (!startBooster) {
@@ -288,6 +290,18 @@ int mngr_init() {
     // Check remote commands
     mngr_loop();
 
+    // Serve the pending SD card reads of the httpd files
+    mngr_files_poll();
+
+    // Serve the requests of the WebSocket channel
+    mngr_ws_poll();
+
+    // Advance the searches of the SD card a few entries at a time
+    search_poll();
+
+    // Advance the running file job a few FatFS operations at a time
+    jobs_poll();
+
     // Disable the USB if nothing is mounted
     if (!cyw43_arch_gpio_get(CYW43_WL_GPIO_VBUS_PIN) && usbInitialized) {
       // Disconnect the USB mass storage
@@ -320,41 +334,11 @@ int mngr_init() {
       DPRINTF("USB mass storage initialized\n");
     }
 
-    switch (download_getStatus()) {
-      case DOWNLOAD_STATUS_STARTED:
-      case DOWNLOAD_STATUS_IN_PROGRESS: {
-        download_poll();
-        break;
-      }
-      case DOWNLOAD_STATUS_REQUESTED: {
-        start_download_time =
-            make_timeout_time_ms(3 * 1000);  // 3 seconds to start the download
-        download_setStatus(DOWNLOAD_STATUS_NOT_STARTED);
-        break;
-      }
-      case DOWNLOAD_STATUS_NOT_STARTED: {
-        if ((absolute_time_diff_us(get_absolute_time(), start_download_time) <
-             0)) {
-          err = download_start();
-          if (err != DOWNLOAD_OK) {
-            DPRINTF("Error downloading app. Drive to error page.\n");
-          }
-        }
-        break;
-      }
-      case DOWNLOAD_STATUS_COMPLETED: {
-        // Save the app info to the SD card
-        download_err_t err = download_finish();
-        if (err != DOWNLOAD_OK) {
-          DPRINTF("Error finishing download app\n");
-          download_setStatus(DOWNLOAD_STATUS_FAILED);
-          break;
-        }
-        download_setStatus(DOWNLOAD_STATUS_IDLE);
-        DPRINTF("Download completed successfully.\n");
-        break;
-      }
-    }
+    // Acknowledge the data written by core 1 and queue the data waiting
+    writeback_poll();
+
+    // Start the queued downloads and close the finished ones
+    download_poll();
   }
 
 #define SLEEP_LOOP_MS 1000
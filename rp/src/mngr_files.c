@@ -0,0 +1,793 @@
+/**
+ * File: mngr_files.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: httpd custom files that stream the SD card to the browser
+ */
+
+#include "mngr_files.h"
+
+#include "mngr_httpd.h"
+
+typedef enum {
+  FILES_READ_IDLE,     // No read in flight
+  FILES_READ_PENDING,  // Read queued, waiting for mngr_files_poll()
+  FILES_READ_DONE      // Data is in the httpd buffer, waiting to be picked up
+} files_read_state_t;
+
+typedef struct {
+  bool in_use;
+  FIL file;
+  char header[MNGR_FILES_HEADER_SIZE];
+  int headerLen;
+  int headerSent;
+  files_read_state_t readState;
+  char *readBuf;
+  int readCount;
+  int readResult;
+  fs_wait_cb waitCb;
+  void *waitArg;
+  bool zip;                  // Sends the archive being built by zip.c
+  struct fs_file *httpFile;  // Its length is only known once sized
+  char name[128];            // Name of the archive for the browser
+  bool events;               // Sends the download progress as events
+  bool eventsDone;           // The downloads are over: end the stream
+  bool eventsLast;           // No download busy: end after this round
+  int eventIndex;            // Next download of the round, -1 between rounds
+  uint32_t eventVersion;     // Version of the queue at the last round
+  uint32_t eventReceived;    // Bytes received at the last round
+  absolute_time_t eventTime;
+} files_ctx_t;
+
+static files_ctx_t files_contexts[MNGR_FILES_MAX_CONTEXTS] = {0};
+
+typedef struct {
+  bool in_use;
+  void *connection;
+  FIL file;
+  writeback_stream_t *stream;  // Writes the body on core 1
+  char path[MNGR_FILES_PATH_SIZE];
+  int expected;
+  int written;
+  FRESULT error;
+  absolute_time_t deadline;
+} files_upload_t;
+
+static files_upload_t files_uploads[MNGR_FILES_MAX_CONTEXTS] = {0};
+
+static files_ctx_t *alloc_files_ctx(void) {
+  for (int i = 0; i < MNGR_FILES_MAX_CONTEXTS; i++) {
+    if (!files_contexts[i].in_use) {
+      memset(&files_contexts[i], 0, sizeof(files_ctx_t));
+      files_contexts[i].in_use = true;
+      return &files_contexts[i];
+    }
+  }
+  return NULL;
+}
+
+static void free_files_ctx(files_ctx_t *ctx) {
+  if (ctx->in_use) {
+    if (ctx->zip) zip_close();
+    f_close(&ctx->file);
+    ctx->in_use = false;
+  }
+}
+
+// Return the last path component, used as download file name
+static const char *path_basename(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+// Strip the quotes from the name so they don't break the header
+static void header_filename(const char *name, char *out, size_t outLen) {
+  size_t n = 0;
+  for (const char *c = name; *c && n < outLen - 1; c++) {
+    if (*c != '"') out[n++] = *c;
+  }
+  out[n] = '\0';
+}
+
+// Parse a "bytes=first-last" Range header value against the file size.
+// Returns 1 and the inclusive range if it is satisfiable, 0 if the header must
+// be ignored (malformed or multiple ranges) and -1 if it can't be satisfied.
+static int parse_range(const char *range, FSIZE_t size, FSIZE_t *first,
+                       FSIZE_t *last) {
+  if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',')) return 0;
+  const char *p = range + 6;
+  char *endp;
+  if (*p == '-') {
+    // Suffix range: the last N bytes
+    if (!isdigit((unsigned char)p[1])) return 0;
+    unsigned long long suffix = strtoull(p + 1, &endp, 10);
+    if (*endp) return 0;
+    if (suffix == 0 || size == 0) return -1;
+    *first = (suffix >= size) ? 0 : size - suffix;
+    *last = size - 1;
+    return 1;
+  }
+  if (!isdigit((unsigned char)*p)) return 0;
+  unsigned long long from = strtoull(p, &endp, 10);
+  if (*endp != '-') return 0;
+  p = endp + 1;
+  unsigned long long to = size ? size - 1 : 0;
+  if (*p) {
+    if (!isdigit((unsigned char)*p)) return 0;
+    to = strtoull(p, &endp, 10);
+    if (*endp) return 0;
+    if (to < from) return 0;
+    if (to >= size) to = size - 1;
+  }
+  if (from >= size) return -1;
+  *first = from;
+  *last = to;
+  return 1;
+}
+
+// Open a file of the SD card and build its response header: 200 OK for the
+// whole file, 206 Partial Content for a byte range or 416 when the range is
+// out of the file. The header travels as the first bytes of the custom file.
+static int open_sdcard_file(struct fs_file *file, const char *path,
+                            const char *range) {
+  FILINFO fno;
+  FRESULT fr = f_stat(path, &fno);
+  if (fr != FR_OK || (fno.fattrib & AM_DIR)) {
+    DPRINTF("Not a file %s: %d\n", path, fr);
+    return 0;
+  }
+  files_ctx_t *ctx = alloc_files_ctx();
+  if (!ctx) {
+    DPRINTF("No files context available for %s\n", path);
+    return 0;
+  }
+  fr = f_open(&ctx->file, path, FA_READ);
+  if (fr != FR_OK) {
+    DPRINTF("Cannot open %s: %d\n", path, fr);
+    ctx->in_use = false;
+    return 0;
+  }
+  FSIZE_t size = f_size(&ctx->file);
+  FSIZE_t first = 0;
+  FSIZE_t last = size ? size - 1 : 0;
+  int ranged = range ? parse_range(range, size, &first, &last) : 0;
+  if (ranged < 0) {
+    DPRINTF("Range not satisfiable for %s: %s\n", path, range);
+    ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                              "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                              "Content-Range: bytes */%llu\r\n"
+                              "Content-Length: 0\r\n"
+                              "\r\n",
+                              (unsigned long long)size);
+    file->len = ctx->headerLen;
+  } else {
+    FSIZE_t length = (ranged > 0) ? last - first + 1 : size;
+    if (ranged > 0 && f_lseek(&ctx->file, first) != FR_OK) {
+      DPRINTF("Cannot seek %s to %llu\n", path, (unsigned long long)first);
+      free_files_ctx(ctx);
+      return 0;
+    }
+    char name[128];
+    header_filename(path_basename(path), name, sizeof(name));
+    int len = snprintf(ctx->header, sizeof(ctx->header),
+                       ranged > 0 ? "HTTP/1.1 206 Partial Content\r\n"
+                                  : "HTTP/1.1 200 OK\r\n");
+    if (ranged > 0) {
+      len += snprintf(ctx->header + len, sizeof(ctx->header) - len,
+                      "Content-Range: bytes %llu-%llu/%llu\r\n",
+                      (unsigned long long)first, (unsigned long long)last,
+                      (unsigned long long)size);
+    }
+    len += snprintf(ctx->header + len, sizeof(ctx->header) - len,
+                    "Content-Type: application/octet-stream\r\n"
+                    "Content-Length: %llu\r\n"
+                    "Accept-Ranges: bytes\r\n"
+                    "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                    "\r\n",
+                    (unsigned long long)length, name);
+    ctx->headerLen = len;
+    if (ctx->headerLen >= (int)sizeof(ctx->header) ||
+        length > (FSIZE_t)(INT_MAX - ctx->headerLen)) {
+      // fs_file lengths are ints: larger files can't go through lwIP httpd
+      DPRINTF("File too large to serve: %s\n", path);
+      free_files_ctx(ctx);
+      return 0;
+    }
+    file->len = ctx->headerLen + (int)length;
+    DPRINTF("Serving %s (%llu of %llu bytes from %llu)\n", path,
+            (unsigned long long)length, (unsigned long long)size,
+            (unsigned long long)first);
+  }
+  file->data = NULL;
+  file->index = 0;
+  file->pextension = ctx;
+  file->flags = FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT;
+  return 1;
+}
+
+// Send a folder as a ZIP archive. Its size is only known once the folder is
+// walked, so the header waits: the first read stays pending while
+// mngr_files_poll() sizes the archive, and the length of the file is set then.
+static int open_zip_folder(struct fs_file *file, const char *folder) {
+  FILINFO fno;
+  if (strcmp(folder, "/") != 0 &&
+      (f_stat(folder, &fno) != FR_OK || !(fno.fattrib & AM_DIR))) {
+    DPRINTF("Not a folder %s\n", folder);
+    return 0;
+  }
+  files_ctx_t *ctx = alloc_files_ctx();
+  if (!ctx) {
+    DPRINTF("No files context available for %s\n", folder);
+    return 0;
+  }
+  file->data = NULL;
+  file->index = 0;
+  file->pextension = ctx;
+  file->flags = FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT;
+  if (!zip_open(folder)) {
+    ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                              "HTTP/1.1 503 Service Unavailable\r\n"
+                              "Retry-After: 10\r\n"
+                              "Content-Length: 0\r\n"
+                              "\r\n");
+    file->len = ctx->headerLen;
+    return 1;
+  }
+  ctx->zip = true;
+  ctx->httpFile = file;
+  const char *base = path_basename(folder);
+  char name[sizeof(ctx->name) - 4];
+  header_filename(*base ? base : "sdcard", name, sizeof(name));
+  snprintf(ctx->name, sizeof(ctx->name), "%s.zip", name);
+  file->len = INT_MAX;
+  return 1;
+}
+
+// Build the header of the archive once it is sized, and hand its first bytes
+// to the pending read. Returns false while the folder is still being walked.
+static bool start_zip_response(files_ctx_t *ctx) {
+  const char *error = NULL;
+  int ready = zip_prepare(&error);
+  if (ready == 0) return false;
+  uint32_t size = ready > 0 ? zip_size() : 0;
+  if (ready > 0) {
+    ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                              "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: application/zip\r\n"
+                              "Content-Length: %lu\r\n"
+                              "Content-Disposition: attachment; "
+                              "filename=\"%s\"\r\n"
+                              "\r\n",
+                              (unsigned long)size, ctx->name);
+    if (ctx->headerLen >= (int)sizeof(ctx->header) ||
+        size > (uint32_t)(INT_MAX - ctx->headerLen)) {
+      // fs_file lengths are ints: larger archives can't go through lwIP httpd
+      ready = -1;
+      error = "too large";
+    }
+  }
+  if (ready < 0) {
+    DPRINTF("Cannot archive the folder: %s\n", error);
+    zip_close();
+    ctx->zip = false;
+    size = 0;
+    ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                              "HTTP/1.1 500 Internal Server Error\r\n"
+                              "Content-Type: text/plain\r\n"
+                              "Content-Length: %d\r\n"
+                              "\r\n"
+                              "%s",
+                              (int)strlen(error), error);
+  }
+  ctx->httpFile->len = ctx->headerLen + (int)size;
+  int n = LWIP_MIN(ctx->readCount, ctx->headerLen);
+  memcpy(ctx->readBuf, ctx->header, n);
+  ctx->headerSent = n;
+  ctx->readResult = n;
+  return true;
+}
+
+// Stream the progress of the download queue as Server-Sent Events. The stream
+// has no length: every read stays pending until the next event is due, and
+// the connection closes once no download is queued or running.
+static int open_download_events(struct fs_file *file) {
+  files_ctx_t *ctx = alloc_files_ctx();
+  if (!ctx) {
+    DPRINTF("No files context available for the events\n");
+    return 0;
+  }
+  memset(file, 0, sizeof(struct fs_file));
+  file->pextension = ctx;
+  // Not persistent, so httpd closes the connection at the end of the stream
+  file->flags = FS_FILE_FLAGS_HEADER_INCLUDED;
+  file->len = INT_MAX;
+  ctx->events = true;
+  ctx->eventIndex = -1;
+  ctx->eventTime = get_absolute_time();
+  ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/event-stream\r\n"
+                            "Cache-Control: no-cache\r\n"
+                            "Connection: close\r\n"
+                            "\r\n");
+  return 1;
+}
+
+// Build the next event in the header buffer, and hand its first bytes to the
+// pending read. A round sends one progress event per download, and starts
+// when a status changes, after some bytes, or as a heartbeat. Returns false
+// while no event is due.
+static bool next_download_event(files_ctx_t *ctx) {
+  if (ctx->eventsDone) {
+    ctx->readResult = 0;
+    return true;
+  }
+  if (ctx->eventIndex < 0) {
+    download_summary_t s;
+    download_getSummary(&s);
+    if (s.version == ctx->eventVersion &&
+        s.received - ctx->eventReceived < MNGR_FILES_EVENT_BYTES &&
+        absolute_time_diff_us(get_absolute_time(), ctx->eventTime) > 0) {
+      return false;
+    }
+    ctx->eventVersion = s.version;
+    ctx->eventReceived = s.received;
+    ctx->eventTime = make_timeout_time_ms(MNGR_FILES_EVENT_INTERVAL_MS);
+    ctx->eventsLast = s.busy == 0;
+    ctx->eventIndex = 0;
+  }
+  const download_item_t *item = NULL;
+  while (!item && ctx->eventIndex < DOWNLOAD_MAX_QUEUE) {
+    item = download_getItem(ctx->eventIndex++);
+  }
+  if (item) {
+    const char *name = strrchr(item->filepath, '/');
+    ctx->headerLen = snprintf(
+        ctx->header, sizeof(ctx->header),
+        "event: progress\n"
+        "data: {\"id\":%lu,\"name\":\"%s\",\"status\":\"%s\","
+        "\"received\":%lu,\"total\":%lu,\"rate\":%lu,\"error\":\"%s\"}\n\n",
+        (unsigned long)item->id, name ? name + 1 : item->filepath,
+        download_getStatusName(item->status), (unsigned long)item->received,
+        (unsigned long)item->total, (unsigned long)download_getRate(item),
+        item->status == DOWNLOAD_STATUS_FAILED
+            ? download_getErrorString(item->error)
+            : "");
+  } else {
+    ctx->eventIndex = -1;
+    if (!ctx->eventsLast) return false;
+    ctx->eventsDone = true;
+    ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                              "event: done\ndata: {}\n\n");
+  }
+  int n = LWIP_MIN(ctx->readCount, ctx->headerLen);
+  memcpy(ctx->readBuf, ctx->header, n);
+  ctx->headerSent = n;
+  ctx->readResult = n;
+  return true;
+}
+
+// Scripts and style sheets have a gzip variant in the embedded file system.
+// Only these are negotiated: httpd never opens them on its own, like the
+// default index pages or the pages returned by the CGIs, so the name always
+// points into the request and its headers can be read.
+static bool has_gzip_variant(const char *name) {
+  const char *dot = strrchr(name, '.');
+  return dot && (strcmp(dot, ".css") == 0 || strcmp(dot, ".js") == 0);
+}
+
+// Copy the value of a header stored in front of an embedded file
+static bool get_file_header(const struct fs_file *file, const char *name,
+                            char *value, size_t valueLen) {
+  size_t nameLen = strlen(name);
+  const char *p = file->data;
+  const char *end = file->data + file->len;
+  while (p < end) {
+    const char *eol = p;
+    while (eol + 1 < end && !(eol[0] == '\r' && eol[1] == '\n')) eol++;
+    if (eol + 1 >= end || eol == p) break;  // End of the header
+    if ((size_t)(eol - p) > nameLen && p[nameLen] == ':' &&
+        lwip_strnicmp(p, name, nameLen) == 0) {
+      const char *v = p + nameLen + 1;
+      while (v < eol && *v == ' ') v++;
+      size_t n = LWIP_MIN((size_t)(eol - v), valueLen - 1);
+      memcpy(value, v, n);
+      value[n] = '\0';
+      return true;
+    }
+    p = eol + 2;
+  }
+  return false;
+}
+
+// Weak comparison of If-None-Match: the W/ prefix is ignored
+static bool etag_matches(const char *match, const char *etag) {
+  if (strcmp(match, "*") == 0) return true;
+  const char *tag = (strncmp(etag, "W/", 2) == 0) ? etag + 2 : etag;
+  return strstr(match, tag) != NULL;
+}
+
+static bool accepts_gzip(const char *accept) {
+  const char *p = strstr(accept, "gzip");
+  if (!p) return false;
+  p += 4;
+  while (*p == ' ') p++;
+  // "gzip;q=0" explicitly refuses it
+  if (strncmp(p, ";q=", 3) == 0) return strtod(p + 3, NULL) > 0;
+  return true;
+}
+
+// Answer 304 Not Modified: a header-only custom file with no file behind it
+static int open_not_modified(struct fs_file *file, const char *etag) {
+  files_ctx_t *ctx = alloc_files_ctx();
+  if (!ctx) return 0;
+  ctx->headerLen = snprintf(ctx->header, sizeof(ctx->header),
+                            "HTTP/1.1 304 Not Modified\r\n"
+                            "ETag: %s\r\n"
+                            "Cache-Control: no-cache\r\n"
+                            "Vary: Accept-Encoding\r\n"
+                            "\r\n",
+                            etag);
+  memset(file, 0, sizeof(struct fs_file));
+  file->len = ctx->headerLen;
+  file->pextension = ctx;
+  file->flags = FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT;
+  return 1;
+}
+
+// Serve an embedded script or style sheet: 304 if the browser copy is still
+// valid, the precompressed <name>.gz variant if the browser accepts gzip, or
+// the plain file from the embedded file system otherwise.
+static int open_static_file(struct fs_file *file, const char *name) {
+  char gzName[MNGR_FILES_PATH_SIZE];
+  if (snprintf(gzName, sizeof(gzName), "%s.gz", name) >= (int)sizeof(gzName)) {
+    return 0;
+  }
+  // Both variants carry the same ETag, take it from the gzip one
+  struct fs_file gz;
+  if (fs_open(&gz, gzName) != ERR_OK) return 0;
+  char etag[MNGR_FILES_ETAG_SIZE];
+  char value[MNGR_FILES_VALIDATOR_SIZE];
+  if (get_file_header(&gz, "ETag", etag, sizeof(etag)) &&
+      mngr_httpd_getRequestHeader(name, "If-None-Match", value,
+                                  sizeof(value)) &&
+      etag_matches(value, etag)) {
+    fs_close(&gz);
+    DPRINTF("Not modified: %s\n", name);
+    return open_not_modified(file, etag);
+  }
+  if (mngr_httpd_getRequestHeader(name, "Accept-Encoding", value,
+                                  sizeof(value)) &&
+      accepts_gzip(value)) {
+    *file = gz;
+    file->pextension = NULL;
+    return 1;
+  }
+  fs_close(&gz);
+  return 0;
+}
+
+int fs_open_custom(struct fs_file *file, const char *name) {
+  if (strcmp(name, MNGR_FILES_EVENTS_URI) == 0) {
+    return open_download_events(file);
+  }
+  if (strncmp(name, MNGR_FILES_ZIP_PREFIX "/",
+              MNGR_FILES_ZIP_PREFIX_LEN + 1) == 0) {
+    memset(file, 0, sizeof(struct fs_file));
+    char folder[MNGR_FILES_PATH_SIZE];
+    if (!url_decode(name + MNGR_FILES_ZIP_PREFIX_LEN, folder, sizeof(folder))) {
+      return 0;
+    }
+    return open_zip_folder(file, folder);
+  }
+  if (strncmp(name, MNGR_FILES_URI_PREFIX "/", MNGR_FILES_URI_PREFIX_LEN + 1) !=
+      0) {
+    // Not a SD card file: let the embedded file system handle it
+    return has_gzip_variant(name) ? open_static_file(file, name) : 0;
+  }
+  memset(file, 0, sizeof(struct fs_file));
+  char path[MNGR_FILES_PATH_SIZE];
+  // Keep the leading '/' of the path after the prefix
+  if (!url_decode(name + MNGR_FILES_URI_PREFIX_LEN, path, sizeof(path))) {
+    return 0;
+  }
+  char range[MNGR_FILES_RANGE_SIZE];
+  bool hasRange =
+      mngr_httpd_getRequestHeader(name, "Range", range, sizeof(range));
+  return open_sdcard_file(file, path, hasRange ? range : NULL);
+}
+
+void fs_close_custom(struct fs_file *file) {
+  files_ctx_t *ctx = (files_ctx_t *)file->pextension;
+  if (ctx) {
+    free_files_ctx(ctx);
+    file->pextension = NULL;
+  }
+}
+
+u8_t fs_canread_custom(struct fs_file *file) {
+  files_ctx_t *ctx = (files_ctx_t *)file->pextension;
+  return (ctx == NULL) || (ctx->readState != FILES_READ_PENDING);
+}
+
+u8_t fs_wait_read_custom(struct fs_file *file, fs_wait_cb callback_fn,
+                         void *callback_arg) {
+  files_ctx_t *ctx = (files_ctx_t *)file->pextension;
+  if (ctx) {
+    ctx->waitCb = callback_fn;
+    ctx->waitArg = callback_arg;
+  }
+  return 1;
+}
+
+int fs_read_async_custom(struct fs_file *file, char *buffer, int count,
+                         fs_wait_cb callback_fn, void *callback_arg) {
+  files_ctx_t *ctx = (files_ctx_t *)file->pextension;
+  if (!ctx) return FS_READ_EOF;
+
+  // The response header goes first, straight from memory
+  if (ctx->headerSent < ctx->headerLen) {
+    int n = LWIP_MIN(count, ctx->headerLen - ctx->headerSent);
+    memcpy(buffer, &ctx->header[ctx->headerSent], n);
+    ctx->headerSent += n;
+    file->index += n;
+    return n;
+  }
+
+  switch (ctx->readState) {
+    case FILES_READ_PENDING:
+      ctx->waitCb = callback_fn;
+      ctx->waitArg = callback_arg;
+      return FS_READ_DELAYED;
+    case FILES_READ_DONE:
+      if (ctx->readResult <= 0) {
+        ctx->readState = FILES_READ_IDLE;
+        return FS_READ_EOF;
+      }
+      if (ctx->readBuf != buffer) {
+        // httpd moved to another buffer. The file, the archive or the events
+        // are already past the data read, so hand it over from the old one,
+        // in pieces if the new buffer is smaller.
+        int n = LWIP_MIN(ctx->readResult, count);
+        memmove(buffer, ctx->readBuf, n);
+        ctx->readBuf += n;
+        ctx->readResult -= n;
+        if (ctx->readResult == 0) ctx->readState = FILES_READ_IDLE;
+        file->index += n;
+        return n;
+      }
+      ctx->readState = FILES_READ_IDLE;
+      file->index += ctx->readResult;
+      return ctx->readResult;
+    default:
+      break;
+  }
+
+  int left = file->len - file->index;
+  if (left <= 0) return FS_READ_EOF;
+  ctx->readBuf = buffer;
+  ctx->readCount = LWIP_MIN(count, left);
+  ctx->waitCb = callback_fn;
+  ctx->waitArg = callback_arg;
+  ctx->readState = FILES_READ_PENDING;
+  return FS_READ_DELAYED;
+}
+
+// Close and delete the file of an upload dropped, once core 1 let it go
+static void upload_dropped(void *arg) {
+  files_upload_t *up = (files_upload_t *)arg;
+  f_close(&up->file);
+  f_unlink(up->path);
+  dircache_invalidate(up->path);
+  up->in_use = false;
+}
+
+// Stop an upload that didn't end. Its connection is gone: it is no longer
+// found, and the data not written yet is dropped without waiting for core 1.
+static void drop_upload(files_upload_t *up) {
+  up->connection = NULL;
+  writeback_abort(up->stream, upload_dropped, up);
+}
+
+void mngr_files_poll(void) {
+  for (int i = 0; i < MNGR_FILES_MAX_CONTEXTS; i++) {
+    files_ctx_t *ctx = &files_contexts[i];
+    if (!ctx->in_use || ctx->readState != FILES_READ_PENDING) continue;
+    if (ctx->events) {
+      if (!next_download_event(ctx)) continue;
+    } else if (ctx->zip && ctx->headerLen == 0) {
+      if (!start_zip_response(ctx)) continue;
+    } else if (ctx->zip) {
+      ctx->readResult = zip_read((uint8_t *)ctx->readBuf, ctx->readCount);
+    } else {
+      UINT br = 0;
+      FRESULT fr = f_read(&ctx->file, ctx->readBuf, (UINT)ctx->readCount, &br);
+      if (fr != FR_OK) {
+        DPRINTF("Error reading file: %d\n", fr);
+      }
+      ctx->readResult = (fr == FR_OK) ? (int)br : -1;
+    }
+    ctx->readState = FILES_READ_DONE;
+    // The callback may close the file and release the context
+    fs_wait_cb cb = ctx->waitCb;
+    void *arg = ctx->waitArg;
+    if (cb) {
+      cyw43_arch_lwip_begin();
+      cb(arg);
+      cyw43_arch_lwip_end();
+    }
+  }
+
+  // httpd doesn't report POST requests reset before the end of the body.
+  // Those with data being written are dropped when it is acknowledged, and
+  // those that stop receiving data are dropped here.
+  for (int i = 0; i < MNGR_FILES_MAX_CONTEXTS; i++) {
+    files_upload_t *up = &files_uploads[i];
+    if (up->in_use && up->connection &&
+        absolute_time_diff_us(get_absolute_time(), up->deadline) < 0) {
+      DPRINTF("Upload of %s timed out\n", up->path);
+      drop_upload(up);
+    }
+  }
+}
+
+static files_upload_t *find_upload(void *connection) {
+  for (int i = 0; i < MNGR_FILES_MAX_CONTEXTS; i++) {
+    if (files_uploads[i].in_use && files_uploads[i].connection == connection) {
+      return &files_uploads[i];
+    }
+  }
+  return NULL;
+}
+
+// The body is acknowledged as core 1 writes it, so the sender waits for the
+// SD card instead of core 0. httpd calls uploadFinished() once all of it is.
+// This runs from the main loop, and the client may have reset the connection
+// since the data arrived.
+static void upload_recved(void *arg, u16_t len) {
+  files_upload_t *up = (files_upload_t *)arg;
+  if (!mngr_httpd_isConnectionOpen(up->connection)) {
+    DPRINTF("Upload of %s reset\n", up->path);
+    drop_upload(up);
+    return;
+  }
+  httpd_post_data_recved(up->connection, len);
+}
+
+static files_upload_t *alloc_upload(void *connection) {
+  for (int i = 0; i < MNGR_FILES_MAX_CONTEXTS; i++) {
+    if (!files_uploads[i].in_use) {
+      memset(&files_uploads[i], 0, sizeof(files_upload_t));
+      files_uploads[i].in_use = true;
+      files_uploads[i].connection = connection;
+      return &files_uploads[i];
+    }
+  }
+  return NULL;
+}
+
+bool mngr_files_isUpload(void *connection) {
+  return find_upload(connection) != NULL;
+}
+
+void mngr_files_uploadRelease(void *connection) {
+  files_upload_t *up = find_upload(connection);
+  if (up) {
+    DPRINTF("Upload of %s aborted\n", up->path);
+    drop_upload(up);
+  }
+}
+
+const char *mngr_files_uploadBegin(void *connection, const char *uri,
+                                   int content_len) {
+  // Drop the query string, if any, before decoding the path
+  char encoded[MNGR_FILES_PATH_SIZE];
+  const char *start = uri + MNGR_FILES_URI_PREFIX_LEN;
+  size_t len = strcspn(start, "?");
+  if (len >= sizeof(encoded)) return "path too long";
+  memcpy(encoded, start, len);
+  encoded[len] = '\0';
+  if (content_len < 0) return "missing content length";
+  files_upload_t *up = alloc_upload(connection);
+  if (!up) return "no context available";
+  if (!url_decode(encoded, up->path, sizeof(up->path)) ||
+      up->path[1] == '\0') {
+    up->in_use = false;
+    return "invalid path";
+  }
+  FRESULT fr = f_open(&up->file, up->path, FA_WRITE | FA_CREATE_ALWAYS);
+  if (fr != FR_OK) {
+    DPRINTF("Cannot create %s: %d\n", up->path, fr);
+    up->in_use = false;
+    return "cannot open file";
+  }
+  dircache_invalidate(up->path);
+  // Reserve the whole file in contiguous clusters, and check the free space
+  // before the body arrives. A short upload is deleted.
+  fr = sdcard_preallocate(&up->file, (FSIZE_t)content_len);
+  if (fr != FR_OK) {
+    DPRINTF("Cannot reserve %d bytes for %s: %d\n", content_len, up->path, fr);
+    f_close(&up->file);
+    f_unlink(up->path);
+    up->in_use = false;
+    return fr == FR_DENIED ? "not enough space" : "cannot open file";
+  }
+  up->stream = writeback_open(&up->file, upload_recved, up);
+  if (!up->stream) {
+    f_close(&up->file);
+    f_unlink(up->path);
+    up->in_use = false;
+    return "no memory available";
+  }
+  up->expected = content_len;
+  up->deadline = make_timeout_time_ms(MNGR_FILES_UPLOAD_TIMEOUT_MS);
+  DPRINTF("Receiving %s (%d bytes)\n", up->path, content_len);
+  return NULL;
+}
+
+err_t mngr_files_uploadReceive(void *connection, struct pbuf *p) {
+  files_upload_t *up = find_upload(connection);
+  u16_t len = p->tot_len;
+  err_t err = ERR_VAL;
+  if (up && up->error == FR_OK) {
+    up->deadline = make_timeout_time_ms(MNGR_FILES_UPLOAD_TIMEOUT_MS);
+    // Core 1 writes the data, so an error shows up on a later piece
+    err = writeback_receive(up->stream, p);
+    if (err != ERR_OK) {
+      // Without memory to keep the data, the stream itself is still fine
+      up->error = err == ERR_MEM ? FR_NOT_ENOUGH_CORE : up->stream->error;
+      DPRINTF("Error writing %s: %d\n", up->path, up->error);
+    }
+  } else {
+    pbuf_free(p);
+  }
+  if (err != ERR_OK) {
+    // httpd waits for the data refused to be acknowledged too
+    httpd_post_data_recved(connection, len);
+    return err;
+  }
+  up->written += len;
+  // The last buffer is only written once full or flushed
+  if (up->written >= up->expected) writeback_flush(up->stream);
+  return ERR_OK;
+}
+
+bool mngr_files_uploadFinished(void *connection, char *json, size_t jsonLen) {
+  files_upload_t *up = find_upload(connection);
+  if (!up) {
+    snprintf(json, jsonLen, "{\"error\":\"invalid upload\"}");
+    return false;
+  }
+  // httpd also ends the POSTs of the connections it closes, with the body not
+  // acknowledged yet. Waiting for core 1 here would stall lwIP.
+  if (!writeback_isDrained(up->stream)) {
+    DPRINTF("Upload of %s closed: %d of %d bytes\n", up->path, up->written,
+            up->expected);
+    drop_upload(up);
+    snprintf(json, jsonLen, "{\"error\":\"connection closed\"}");
+    return false;
+  }
+  // All the body was acknowledged, so the stream is drained and this doesn't
+  // wait for core 1
+  FRESULT fr = writeback_close(up->stream);
+  if (up->error == FR_OK) up->error = fr;
+  fr = f_close(&up->file);
+  if (up->error == FR_OK) up->error = fr;
+  bool ok = (up->error == FR_OK) && (up->written == up->expected);
+  if (ok) {
+    snprintf(json, jsonLen, "{\"status\":\"completed\",\"size\":%d}",
+             up->written);
+  } else {
+    // Don't leave a truncated file behind
+    f_unlink(up->path);
+    snprintf(json, jsonLen,
+             "{\"error\":\"write failed\",\"code\":%d,\"received\":%d}",
+             up->error, up->written);
+  }
+  dircache_invalidate(up->path);
+  DPRINTF("Upload of %s finished: %d of %d bytes\n", up->path, up->written,
+          up->expected);
+  up->in_use = false;
+  return ok;
+}
@@ -11,15 +11,25 @@
 #include "network.h"
 
 // Add includes for download and settings
+#include "dircache.h"
 #include "download.h"
+#include "floppy.h"
 #include "include/aconfig.h"
+#include "jobs.h"
+#include "lwip/memp.h"
+#include "lwip/priv/memp_priv.h"
+#include "mngr_files.h"
+#include "search.h"
+#include "sdcard.h"
 #include "settings/settings.h"
+#include "writeback.h"
 
-#define MAX_JSON_PAYLOAD_SIZE 4096
+#define MAX_JSON_PAYLOAD_SIZE 3072
 static mngr_httpd_response_status_t response_status = MNGR_HTTPD_RESPONSE_OK;
-static char json_buff[MAX_JSON_PAYLOAD_SIZE] = {0};  // Buffer for JSON payload
+// Buffer for the JSON payload of the response being prepared. It belongs to
+// the response context the next /json.shtml will take.
+static char *json_buff = NULL;
 static char httpd_response_message[128] = {0};
-static void *current_connection;
 static int sdcard_status = SDCARD_INIT_ERROR;
 
 #define UPLOAD_CHUNK_SIZE 4096
@@ -29,7 +39,7 @@ static int sdcard_status = SDCARD_INIT_ERROR;
 #endif
 
 // Default download chunk size (raw bytes) to fit JSON buffer after base64
-// (~4KB)
+// (~3KB)
 #ifndef DOWNLOAD_CHUNK_SIZE
 #define DOWNLOAD_CHUNK_SIZE 2048
 #endif
@@ -40,7 +50,7 @@ static int sdcard_status = SDCARD_INIT_ERROR;
 // Output buffer must be at least outLen bytes.
 // Returns false if input is NULL, output is NULL, or output buffer is too
 // small.
-static bool url_decode(const char *in, char *out, size_t outLen) {
+bool url_decode(const char *in, char *out, size_t outLen) {
   if (!in || !out || outLen == 0) return false;
 
   DPRINTF("Decoding '%s'. Length=%d\n", in, outLen);
@@ -66,6 +76,64 @@ static bool url_decode(const char *in, char *out, size_t outLen) {
   return true;
 }
 
+// Request headers are not handed to the httpd hooks, but they follow the URI
+// passed to fs_open() in the request buffer. lwIP only parses a request once
+// the empty line ending its headers is in the data received, and that data
+// holds no '\0' but the ones lwIP writes in the request line. The header block
+// is found first, up to that empty line, so the scan never goes past the
+// request received: without it, the request is taken as having no headers.
+// Only valid for URIs pointing into the request buffer.
+bool mngr_httpd_getRequestHeader(const char *uri, const char *name,
+                                 char *value, size_t valueLen) {
+  if (!uri || !name || !value || valueLen == 0) return false;
+  size_t nameLen = strlen(name);
+  // The URI starts after the method, so the buffer ends beyond this
+  const char *limit = uri + LWIP_HTTPD_MAX_REQ_LENGTH - 4;
+  // Skip the rest of the request line. lwIP may have replaced the separators
+  // in and after the URI with '\0', so don't stop at them.
+  const char *p = uri;
+  while (p + 1 < limit && !(p[0] == '\r' && p[1] == '\n')) p++;
+  const char *end = NULL;
+  for (const char *q = p; q + 3 < limit && *q; q++) {
+    if (q[0] == '\r' && q[1] == '\n' && q[2] == '\r' && q[3] == '\n') {
+      end = q + 2;
+      break;
+    }
+  }
+  if (!end) return false;
+  // Each line ends before the empty line at end
+  for (p += 2; p < end;) {
+    const char *eol = p;
+    while (!(eol[0] == '\r' && eol[1] == '\n')) eol++;
+    if ((size_t)(eol - p) > nameLen && p[nameLen] == ':' &&
+        lwip_strnicmp(p, name, nameLen) == 0) {
+      const char *v = p + nameLen + 1;
+      while (v < eol && (*v == ' ' || *v == '\t')) v++;
+      size_t n = LWIP_MIN((size_t)(eol - v), valueLen - 1);
+      memcpy(value, v, n);
+      value[n] = '\0';
+      return true;
+    }
+    p = eol + 2;
+  }
+  return false;
+}
+
+// httpd takes the state of each connection from its own pool, which
+// LWIP_MEMPOOL_DECLARE() makes public. The states freed are on its list.
+#if !HTTPD_USE_MEM_POOL || MEMP_MEM_MALLOC
+#error "mngr_httpd_isConnectionOpen() needs the pool of httpd connections"
+#endif
+extern const struct memp_desc memp_HTTPD_STATE;
+
+bool mngr_httpd_isConnectionOpen(void *connection) {
+  if (!connection) return false;
+  for (struct memp *m = *memp_HTTPD_STATE.tab; m; m = m->next) {
+    if ((u8_t *)m + MEMP_SIZE == (u8_t *)connection) return false;
+  }
+  return true;
+}
+
 /**
  * @brief Array of SSI tags for the HTTP server.
  *
@@ -142,6 +210,345 @@ static const char *cgi_test(int iIndex, int iNumParams, char *pcParam[],
   return "/test.shtml";
 }
 
+// Directory listings are not built in json_buff. The ls and folder CGIs only
+// open the directory, and the JSONPLD tag formats the entries one by one while
+// httpd sends them, so the size of the listing is not limited.
+typedef enum {
+  JSON_DIR_NONE,    // No listing in progress, JSONPLD sends json_buff
+  JSON_DIR_LS,      // Objects with name, attributes, size and timestamp
+  JSON_DIR_FOLDER,  // Names of the subfolders
+} json_dir_mode_t;
+
+#define JSON_DIR_ENTRY_SIZE (FF_MAX_LFN + 64)
+
+// Open directories kept between the pages of a listing, so the next page
+// continues reading where the previous one stopped instead of rescanning the
+// folder from the first entry. Cursors are keyed by a token chosen by the
+// client and closed when idle for too long.
+#define MAX_DIR_CURSORS 4
+#define DIR_CURSOR_TIMEOUT_MS (30 * 1000)
+typedef struct {
+  bool in_use;
+  char token[32];  // Empty for listings sent in a single response
+  char folder[256];
+  json_dir_mode_t mode;
+  DIR dir;
+  int index;  // Entries already listed
+  absolute_time_t deadline;
+} dir_cursor_t;
+static dir_cursor_t dir_cursors[MAX_DIR_CURSORS] = {0};
+
+static void free_dir_cursor(dir_cursor_t *cursor) {
+  if (cursor->in_use) {
+    f_closedir(&cursor->dir);
+    cursor->in_use = false;
+  }
+}
+
+// Close the cursors idle for too long
+static void reap_dir_cursors(void) {
+  absolute_time_t now = get_absolute_time();
+  for (int i = 0; i < MAX_DIR_CURSORS; i++) {
+    if (dir_cursors[i].in_use &&
+        absolute_time_diff_us(now, dir_cursors[i].deadline) < 0) {
+      DPRINTF("Closing idle cursor %s\n", dir_cursors[i].token);
+      free_dir_cursor(&dir_cursors[i]);
+    }
+  }
+}
+
+// Find the cursor of a token positioned at the requested entry
+static dir_cursor_t *find_dir_cursor(const char *token, const char *folder,
+                                     json_dir_mode_t mode, int index) {
+  if (!token || !token[0]) return NULL;
+  for (int i = 0; i < MAX_DIR_CURSORS; i++) {
+    dir_cursor_t *c = &dir_cursors[i];
+    if (c->in_use && c->mode == mode && c->index == index &&
+        strcmp(c->token, token) == 0 && strcmp(c->folder, folder) == 0) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+// Take a free cursor, closing the least recently used one if needed
+static dir_cursor_t *alloc_dir_cursor(const char *token) {
+  dir_cursor_t *cursor = NULL;
+  for (int i = 0; i < MAX_DIR_CURSORS; i++) {
+    dir_cursor_t *c = &dir_cursors[i];
+    if (!c->in_use) {
+      cursor = c;
+      break;
+    }
+    if (token && token[0] && strcmp(c->token, token) == 0) {
+      // A client only pages one listing at a time
+      cursor = c;
+      break;
+    }
+    if (!cursor || absolute_time_diff_us(c->deadline, cursor->deadline) > 0) {
+      cursor = c;
+    }
+  }
+  free_dir_cursor(cursor);
+  memset(cursor, 0, sizeof(dir_cursor_t));
+  if (token) {
+    strncpy(cursor->token, token, sizeof(cursor->token) - 1);
+  }
+  return cursor;
+}
+
+typedef struct {
+  json_dir_mode_t mode;
+  dir_cursor_t *cursor;          // Source when reading the SD card
+  dircache_listing_t *cached;    // Source when reading the cache
+  size_t cachedPos;
+  int remaining;  // Entries left in this page, -1 for no limit
+  bool first;     // No entry emitted yet, no comma needed
+  bool closed;    // Closing bracket is in the entry buffer
+  char entry[JSON_DIR_ENTRY_SIZE];  // Pending output
+  int entryLen;
+  int entryPos;
+} json_dir_stream_t;
+
+// Each JSON response has its own context, bound to the httpd connection
+// through the file state of /json.shtml, so parallel requests don't share
+// their payloads. CGI handlers run synchronously right before httpd opens the
+// file they return: they write into the pending context, and
+// fs_state_init() hands it over to the connection.
+#define MAX_RESPONSE_CONTEXTS (MEMP_NUM_PARALLEL_HTTPD_CONNS + 1)
+typedef struct {
+  bool in_use;
+  char json[MAX_JSON_PAYLOAD_SIZE];
+  json_dir_stream_t dir;
+} response_ctx_t;
+static response_ctx_t response_contexts[MAX_RESPONSE_CONTEXTS] = {0};
+// Used when all the contexts are busy, shared by the responses
+static response_ctx_t overflow_response = {0};
+static response_ctx_t *pending_response = NULL;
+
+// Close all the cursors not used by a listing being sent, and the folders of
+// the searches, of the running job and of the archive being sent. Open
+// directories are locked by FatFS, so they must be released before renaming
+// or deleting anything.
+static void close_dir_cursors(void) {
+  search_suspend();
+  jobs_suspend();
+  zip_suspend();
+  mngr_ws_suspend();
+  for (int i = 0; i < MAX_DIR_CURSORS; i++) {
+    bool busy = false;
+    for (int j = 0; j <= MAX_RESPONSE_CONTEXTS && !busy; j++) {
+      json_dir_stream_t *jd = (j < MAX_RESPONSE_CONTEXTS)
+                                  ? &response_contexts[j].dir
+                                  : &overflow_response.dir;
+      busy = jd->mode != JSON_DIR_NONE && !jd->closed &&
+             jd->cursor == &dir_cursors[i];
+    }
+    if (!busy) free_dir_cursor(&dir_cursors[i]);
+  }
+}
+
+// Let go of the source of the listing. A cursor cut by the page limit is
+// kept for the next page.
+static void json_dir_release(json_dir_stream_t *jd, bool keepCursor) {
+  if (jd->cached) {
+    dircache_release(jd->cached);
+    jd->cached = NULL;
+  } else if (jd->cursor) {
+    if (keepCursor) {
+      jd->cursor->deadline = make_timeout_time_ms(DIR_CURSOR_TIMEOUT_MS);
+    } else {
+      free_dir_cursor(jd->cursor);
+    }
+  }
+  jd->cursor = NULL;
+}
+
+static void json_dir_abort(json_dir_stream_t *jd) {
+  if (jd->mode != JSON_DIR_NONE) {
+    if (!jd->closed) json_dir_release(jd, false);
+    jd->mode = JSON_DIR_NONE;
+  }
+}
+
+// Read the next entry of the folder from the cache or the SD card
+static bool json_dir_read(json_dir_stream_t *jd, FILINFO *fno) {
+  if (jd->cached) {
+    return dircache_read(jd->cached, &jd->cachedPos, fno);
+  }
+  FRESULT fr = f_readdir(&jd->cursor->dir, fno);
+  return fr == FR_OK && fno->fname[0] != '\0';
+}
+
+// Start a listing at the given entry, continuing the cursor of the token if
+// it is positioned there. Otherwise the listing comes from the cache, or from
+// the SD card opening the folder and skipping the first entries. The opening
+// bracket is the first pending output.
+static FRESULT json_dir_start(json_dir_stream_t *jd, json_dir_mode_t mode,
+                              const char *folder, const char *token, int start,
+                              int limit) {
+  json_dir_abort(jd);
+  reap_dir_cursors();
+  dir_cursor_t *cursor = find_dir_cursor(token, folder, mode, start);
+  dircache_listing_t *cached = NULL;
+  size_t cachedPos = 0;
+  if (cursor) {
+    DPRINTF("Continuing cursor %s at entry %d\n", token, start);
+  } else if ((cached = dircache_get(folder)) != NULL) {
+    FILINFO fno;
+    for (int skip = start; skip > 0;) {
+      if (!dircache_read(cached, &cachedPos, &fno)) break;
+      if (mode == JSON_DIR_LS || (fno.fattrib & AM_DIR)) skip--;
+    }
+  } else {
+    cursor = alloc_dir_cursor(token);
+    FRESULT fr = f_opendir(&cursor->dir, folder);
+    if (fr != FR_OK) return fr;
+    cursor->in_use = true;
+    cursor->mode = mode;
+    strncpy(cursor->folder, folder, sizeof(cursor->folder) - 1);
+    FILINFO fno;
+    while (cursor->index < start) {
+      fr = f_readdir(&cursor->dir, &fno);
+      if (fr != FR_OK || fno.fname[0] == '\0') break;
+      if (mode == JSON_DIR_LS || (fno.fattrib & AM_DIR)) cursor->index++;
+    }
+  }
+  if (cursor) cursor->deadline = make_timeout_time_ms(DIR_CURSOR_TIMEOUT_MS);
+  jd->mode = mode;
+  jd->cursor = cursor;
+  jd->cached = cached;
+  jd->cachedPos = cachedPos;
+  jd->remaining = (limit > 0) ? limit : -1;
+  jd->first = true;
+  jd->closed = false;
+  jd->entry[0] = '[';
+  jd->entryLen = 1;
+  jd->entryPos = 0;
+  return FR_OK;
+}
+
+// Format the next entry of the folder into the pending output, or the closing
+// bracket after the last one. A page cut by the limit ends with an empty
+// object to tell the client there is more. Returns false when the listing is
+// over.
+static bool json_dir_next(json_dir_stream_t *jd) {
+  if (jd->closed) return false;
+  const char *sep = jd->first ? "" : ",";
+  if (jd->remaining == 0) {
+    // Keep the directory open for the next page
+    jd->entryLen = snprintf(jd->entry, sizeof(jd->entry),
+                                 "%s{}]", sep);
+    jd->entryPos = 0;
+    jd->closed = true;
+    json_dir_release(jd, true);
+    return true;
+  }
+  FILINFO fno;
+  while (json_dir_read(jd, &fno)) {
+    if (jd->mode == JSON_DIR_LS) {
+      // Combine date and time into a single ts field
+      unsigned ts = ((unsigned)fno.fdate << 16) | (unsigned)fno.ftime;
+      jd->entryLen = snprintf(
+          jd->entry, sizeof(jd->entry),
+          "%s{\"n\":\"%s\",\"a\":%u,\"s\":%lu,\"t\":%u}", sep, fno.fname,
+          (unsigned)fno.fattrib, (unsigned long)fno.fsize, ts);
+    } else if (fno.fattrib & AM_DIR) {
+      jd->entryLen = snprintf(jd->entry, sizeof(jd->entry),
+                                   "%s\"%s\"", sep, fno.fname);
+    } else {
+      continue;
+    }
+    if (jd->cursor) jd->cursor->index++;
+    if (jd->remaining > 0) jd->remaining--;
+    jd->first = false;
+    jd->entryPos = 0;
+    return true;
+  }
+  json_dir_release(jd, false);
+  jd->closed = true;
+  jd->entry[0] = ']';
+  jd->entryLen = 1;
+  jd->entryPos = 0;
+  return true;
+}
+
+// Copy as much of the listing as fits in the buffer. Returns the number of
+// bytes written, the mode goes back to JSON_DIR_NONE once everything is out.
+static int json_dir_fill(json_dir_stream_t *jd, char *out, int outLen) {
+  int len = 0;
+  while (len < outLen) {
+    if (jd->entryPos >= jd->entryLen && !json_dir_next(jd)) {
+      jd->mode = JSON_DIR_NONE;
+      break;
+    }
+    int n = LWIP_MIN(outLen - len, jd->entryLen - jd->entryPos);
+    memcpy(out + len, &jd->entry[jd->entryPos], n);
+    jd->entryPos += n;
+    len += n;
+  }
+  return len;
+}
+
+// Take a free response context for the next JSON response. CGI handlers and
+// POST hooks write into json_buff, which points to it.
+static void reserve_response(void) {
+  pending_response = &overflow_response;
+  for (int i = 0; i < MAX_RESPONSE_CONTEXTS; i++) {
+    if (!response_contexts[i].in_use) {
+      pending_response = &response_contexts[i];
+      break;
+    }
+  }
+  if (pending_response == &overflow_response) {
+    DPRINTF("No response context available, sharing the overflow one\n");
+  }
+  json_dir_abort(&pending_response->dir);
+  pending_response->json[0] = '\0';
+  json_buff = pending_response->json;
+}
+
+// httpd file state hook: /json.shtml takes the pending response
+void *fs_state_init(struct fs_file *file, const char *name) {
+  LWIP_UNUSED_ARG(file);
+  if (strcmp(name, "/json.shtml") != 0 ||
+      pending_response == &overflow_response) {
+    return NULL;
+  }
+  response_ctx_t *ctx = pending_response;
+  ctx->in_use = true;
+  reserve_response();
+  return ctx;
+}
+
+// httpd file state hook: release the response when the connection is done
+void fs_state_free(struct fs_file *file, void *state) {
+  LWIP_UNUSED_ARG(file);
+  response_ctx_t *ctx = (response_ctx_t *)state;
+  if (ctx) {
+    json_dir_abort(&ctx->dir);
+    ctx->in_use = false;
+  }
+}
+
+// Decode the 'folder' query parameter in place. Returns NULL if it is
+// missing or invalid.
+static const char *get_folder_param(int iNumParams, char *pcParam[],
+                                    char *pcValue[]) {
+  for (int i = 0; i < iNumParams; i++) {
+    if (strcmp(pcParam[i], "folder") == 0) {
+      if (!url_decode(pcValue[i], pcValue[i], strlen(pcValue[i]) + 1)) {
+        DPRINTF("Invalid folder parameter: %s\n", pcValue[i]);
+        return NULL;
+      }
+      DPRINTF("Folder parameter: %s\n", pcValue[i]);
+      return pcValue[i];
+    }
+  }
+  DPRINTF("No folder parameter provided\n");
+  return NULL;
+}
+
 /**
  * @brief Show the folder content
  *
@@ -155,74 +562,22 @@ static const char *cgi_test(int iIndex, int iNumParams, char *pcParam[],
 static const char *cgi_folder(int iIndex, int iNumParams, char *pcParam[],
                               char *pcValue[]) {
   DPRINTF("FOLDER CGI handler called with index %d\n", iIndex);
-  /* Parse 'folder' query parameter */
-  const char *req_folder = NULL;
-  for (int i = 0; i < iNumParams; i++) {
-    if (strcmp(pcParam[i], "folder") == 0) {
-      req_folder = pcValue[i];
-      bool valid = url_decode(req_folder, pcValue[i], strlen(pcValue[i]) + 1);
-      if (!valid) {
-        DPRINTF("Invalid folder parameter: %s\n", pcValue[i]);
-        /* Return empty JSON array */
-        strcpy(json_buff, "[]");
-        return "/json.shtml";
-      }
-      DPRINTF("Folder parameter: %s\n", req_folder);
-      break;
-    }
-  }
+  json_dir_abort(&pending_response->dir);
+  const char *req_folder = get_folder_param(iNumParams, pcParam, pcValue);
   if (req_folder == NULL) {
-    DPRINTF("No folder parameter provided\n");
     /* Return empty JSON array */
     strcpy(json_buff, "[]");
     return "/json.shtml";
   }
   DPRINTF("Listing subfolders of: %s\n", req_folder);
-  /* Prepare JSON array */
-  json_buff[0] = '\0';
-  strcat(json_buff, "[");
-  /* FatFS list directories in the given folder */
-  DIR dir;
-  FILINFO fno;
-  FRESULT fr;
-  bool apps_installed_found = false;
-  fr = f_opendir(&dir, req_folder);
+  FRESULT fr = json_dir_start(&pending_response->dir, JSON_DIR_FOLDER,
+                              req_folder, NULL, 0, 0);
   if (fr != FR_OK) {
     DPRINTF("Failed to open directory %s, error %d\n", req_folder, fr);
     /* Return empty JSON array */
     strcpy(json_buff, "[]");
-    return "/json.shtml";
-  }
-  for (;;) {
-    fr = f_readdir(&dir, &fno);
-    if (fr != FR_OK || fno.fname[0] == '\0') break;
-    if (fno.fattrib & AM_DIR) {
-      DPRINTF("DIR: %s/%s\n", req_folder, fno.fname);
-      /* Append folder name to JSON array */
-      char tmp[256];
-      snprintf(tmp, sizeof(tmp), "\"%s\",", fno.fname);
-      strcat(json_buff, tmp);
-      apps_installed_found = true;
-    }
-  }
-  f_closedir(&dir);
-  /* Close JSON array */
-  if (apps_installed_found) {
-    size_t len = strlen(json_buff);
-    if (len > 1 && json_buff[len - 1] == ',') {
-      json_buff[len - 1] = ']';
-      json_buff[len] = '\0';
-    } else {
-      strcat(json_buff, "]");
-    }
-  } else {
-    /* Empty array */
-    strcat(json_buff, "]");
   }
-  if (!apps_installed_found) {
-    DPRINTF("No subfolders found in %s\n", req_folder);
-  }
-  /* Return JSON page (json_buff contains array or empty) */
+  /* The JSONPLD tag streams the subfolders */
   return "/json.shtml";
 }
 // CGI: make directory
@@ -244,16 +599,45 @@ static const char *cgi_mkdir(int iIndex, int iNumParams, char *pcParam[],
   }
   snprintf(path, sizeof(path), "%s/%s", df, ds);
   FRESULT r = f_mkdir(path);
+  dircache_invalidate(path);
   if (r != FR_OK)
-    snprintf(json_buff, sizeof(json_buff), "{\"error\":\"mkdir failed %d\"}",
-             r);
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"mkdir failed %d\"}", r);
   else
     strcpy(json_buff, "{\"status\":\"created\"}");
   return "/json.shtml";
 }
 
+// CGI: send a folder as a ZIP archive. The archive is the custom file
+// /zip/<folder>, the folder encoded again as httpd decodes nothing.
+static const char *cgi_zip(int iIndex, int iNumParams, char *pcParam[],
+                           char *pcValue[]) {
+  static char zip_uri[MNGR_FILES_ZIP_PREFIX_LEN + 3 * MNGR_FILES_PATH_SIZE];
+  const char *folder = get_folder_param(iNumParams, pcParam, pcValue);
+  if (!folder || folder[0] != '/') {
+    strcpy(json_buff, "{\"error\":\"invalid folder\"}");
+    return "/json.shtml";
+  }
+  size_t len = strlen(strcpy(zip_uri, MNGR_FILES_ZIP_PREFIX));
+  for (const char *c = folder; *c && len < sizeof(zip_uri) - 4; c++) {
+    if (isalnum((unsigned char)*c) || strchr("/-._~", *c)) {
+      zip_uri[len++] = *c;
+    } else {
+      len += snprintf(zip_uri + len, 4, "%%%02X", (unsigned char)*c);
+    }
+  }
+  zip_uri[len] = '\0';
+  return zip_uri;
+}
+
 /**
- * @brief Download the selected app from the folder and URL parameters.
+ * @brief Queue the download of the selected app from the folder and URL
+ * parameters.
+ *
+ * The page follows the progress of the queue. With queue=1 the download is
+ * only queued, and the response is its id as JSON, so a page can queue many
+ * downloads without leaving. With md5 or sha256, the checksum of the file in
+ * hexadecimal, the file only takes its name if the checksum matches.
  */
 const char *cgi_download(int iIndex, int iNumParams, char *pcParam[],
                          char *pcValue[]) {
@@ -261,7 +645,8 @@ const char *cgi_download(int iIndex, int iNumParams, char *pcParam[],
 
   char decoded_folder[256] = {0};
   char decoded_url[DOWNLOAD_BUFFLINE_SIZE] = {0};
-  bool has_folder = false, has_url = false;
+  const char *hash = NULL;
+  bool has_folder = false, has_url = false, unzip = false, queue = false;
   for (int i = 0; i < iNumParams; i++) {
     if (strcmp(pcParam[i], "folder") == 0) {
       if (!url_decode(pcValue[i], decoded_folder, sizeof(decoded_folder))) {
@@ -283,6 +668,13 @@ const char *cgi_download(int iIndex, int iNumParams, char *pcParam[],
         return error_url;
       }
       has_url = true;
+    } else if (strcmp(pcParam[i], "unzip") == 0) {
+      unzip = atoi(pcValue[i]) != 0;
+    } else if (strcmp(pcParam[i], "queue") == 0) {
+      queue = atoi(pcValue[i]) != 0;
+    } else if (strcmp(pcParam[i], "md5") == 0 ||
+               strcmp(pcParam[i], "sha256") == 0) {
+      hash = pcValue[i];
     }
   }
   if (!has_folder || !has_url) {
@@ -294,10 +686,29 @@ const char *cgi_download(int iIndex, int iNumParams, char *pcParam[],
     return error_url;
   }
   DPRINTF("Download request: folder=%s, url=%s\n", decoded_folder, decoded_url);
-  download_setDstFolder(decoded_folder);
-  download_setUrl(decoded_url);
-  download_setStatus(DOWNLOAD_STATUS_REQUESTED);
-
+  download_err_t err;
+  uint32_t id =
+      download_queue(decoded_url, decoded_folder, unzip, hash, &err);
+  if (queue) {
+    if (id == 0) {
+      snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"error\":\"%s\"}",
+               download_getErrorString(err));
+    } else {
+      snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"id\":%lu}",
+               (unsigned long)id);
+    }
+    return "/json.shtml";
+  }
+  if (id == 0) {
+    static char error_url[128];
+    const char *reason = "invalid%20URL";
+    if (err == DOWNLOAD_QUEUEFULL_ERROR) reason = "queue%20full";
+    if (err == DOWNLOAD_PARSEMD5_ERROR) reason = "invalid%20checksum";
+    snprintf(error_url, sizeof(error_url),
+             "/error.shtml?error=%d&error_msg=Download%%20error:%%20%s",
+             MNGR_HTTPD_RESPONSE_BAD_REQUEST, reason);
+    return error_url;
+  }
   return "/downloading.shtml";
 }
 
@@ -314,101 +725,99 @@ const char *cgi_download(int iIndex, int iNumParams, char *pcParam[],
 static const char *cgi_ls(int iIndex, int iNumParams, char *pcParam[],
                           char *pcValue[]) {
   DPRINTF("LS CGI handler called with index %d\n", iIndex);
-  /* Parse 'folder' query parameter */
-  const char *req_folder = NULL;
-  for (int i = 0; i < iNumParams; i++) {
-    if (strcmp(pcParam[i], "folder") == 0) {
-      req_folder = pcValue[i];
-      bool valid = url_decode(req_folder, pcValue[i], strlen(pcValue[i]) + 1);
-      if (!valid) {
-        DPRINTF("Invalid folder parameter: %s\n", pcValue[i]);
-        /* Return empty JSON array */
-        strcpy(json_buff, "[]");
-        return "/json.shtml";
-      }
-      DPRINTF("Folder parameter: %s\n", req_folder);
-      break;
-    }
-  }
+  json_dir_abort(&pending_response->dir);
+  const char *req_folder = get_folder_param(iNumParams, pcParam, pcValue);
   if (req_folder == NULL) {
-    DPRINTF("No folder parameter provided\n");
     /* Return empty JSON array */
     strcpy(json_buff, "[]");
     return "/json.shtml";
   }
   DPRINTF("Listing entries of: %s\n", req_folder);
-  // Parse optional pagination start index
-  int nextItem = 0;
+  // Optional pagination: start index, page size and cursor token
+  int nextItem = 0, limit = 0;
+  const char *token = NULL;
   for (int j = 0; j < iNumParams; j++) {
-    if (strcmp(pcParam[j], "nextItem") == 0) {
-      nextItem = atoi(pcValue[j]);
-      DPRINTF("cgi_ls: start from item %d\n", nextItem);
-      break;
-    }
+    if (strcmp(pcParam[j], "nextItem") == 0) nextItem = atoi(pcValue[j]);
+    if (strcmp(pcParam[j], "limit") == 0) limit = atoi(pcValue[j]);
+    if (strcmp(pcParam[j], "token") == 0) token = pcValue[j];
   }
-  unsigned idx = 0;
-  bool truncated = false;
-  /* Prepare JSON array */
-  json_buff[0] = '\0';
-  strcat(json_buff, "[");
-  /* FatFS list directory entries */
-  DIR dir;
-  FILINFO fno;
-  FRESULT fr;
-  bool apps_installed_found = false;
-  fr = f_opendir(&dir, req_folder);
+  DPRINTF("cgi_ls: start from item %d, limit %d\n", nextItem, limit);
+  FRESULT fr = json_dir_start(&pending_response->dir, JSON_DIR_LS,
+                              req_folder, token, nextItem, limit);
   if (fr != FR_OK) {
     DPRINTF("Failed to open directory %s, error %d\n", req_folder, fr);
     /* Return empty JSON array */
     strcpy(json_buff, "[]");
+  }
+  /* The JSONPLD tag streams the listing, or a page of it */
+  return "/json.shtml";
+}
+
+/**
+ * @brief Search a folder and its subfolders for names matching a pattern
+ *
+ * The search runs in the background from the main loop. Each call returns the
+ * matches found since the previous one, so the client polls with the same
+ * token until done is true. nextItem is the number of matches the client
+ * already has: a search that was lost is restarted and skips them.
+ *
+ * @param iIndex The index of the CGI handler.
+ * @param iNumParams The number of parameters passed to the CGI handler.
+ * @param pcParam An array of parameter names.
+ * @param pcValue An array of parameter values.
+ * @return The URL of the page with the JSON result.
+ */
+static const char *cgi_find(int iIndex, int iNumParams, char *pcParam[],
+                            char *pcValue[]) {
+  DPRINTF("FIND CGI handler called with index %d\n", iIndex);
+  json_dir_abort(&pending_response->dir);
+  const char *folder = get_folder_param(iNumParams, pcParam, pcValue);
+  char *pattern = NULL;
+  const char *token = NULL;
+  int nextItem = 0, limit = 0;
+  for (int i = 0; i < iNumParams; i++) {
+    if (strcmp(pcParam[i], "pattern") == 0) pattern = pcValue[i];
+    if (strcmp(pcParam[i], "token") == 0) token = pcValue[i];
+    if (strcmp(pcParam[i], "nextItem") == 0) nextItem = atoi(pcValue[i]);
+    if (strcmp(pcParam[i], "limit") == 0) limit = atoi(pcValue[i]);
+  }
+  if (!folder || !pattern || !token) {
+    strcpy(json_buff, "{\"error\":\"missing parameters\"}");
     return "/json.shtml";
   }
-  for (;;) {
-    fr = f_readdir(&dir, &fno);
-    if (fr != FR_OK || fno.fname[0] == '\0') break;
-    // Skip until reaching nextItem index
-    if (idx++ < nextItem) continue;
-    // Stop if JSON buffer size approaches limit (buffer size minus 100 bytes)
-    if (strlen(json_buff) >= sizeof(json_buff) - 100) {
-      DPRINTF("JSON payload too large (%u chars), truncating listing\n",
-              (unsigned)strlen(json_buff));
-      truncated = true;
-      break;
-    }
-    /* Build JSON object for each entry */
-    char tmp[256];
-    /* Combine date and time into a single ts field */
-    unsigned ts = ((unsigned)fno.fdate << 16) | (unsigned)fno.ftime;
-    snprintf(tmp, sizeof(tmp), "{\"n\":\"%s\",\"a\":%u,\"s\":%lu,\"t\":%u},",
-             fno.fname, (unsigned)fno.fattrib, (unsigned long)fno.fsize, ts);
-    strcat(json_buff, tmp);
-    apps_installed_found = true;
-  }
-  f_closedir(&dir);
-  /* Close JSON array, handle truncation sentinel */
-  if (truncated) {
-    size_t len = strlen(json_buff);
-    if (len > 1 && json_buff[len - 1] == ',') {
-      json_buff[len - 1] = '\0';
-    }
-    strcat(json_buff, ",{}]");
-  } else if (apps_installed_found) {
-    /* Remove trailing comma if any */
-    size_t len = strlen(json_buff);
-    if (len > 1 && json_buff[len - 1] == ',') {
-      json_buff[len - 1] = ']';
-      json_buff[len] = '\0';
-    } else {
-      strcat(json_buff, "]");
-    }
-  } else {
-    /* No entries and not truncated */
-    strcpy(json_buff, "[]");
+  if (!url_decode(pattern, pattern, strlen(pattern) + 1) || !pattern[0]) {
+    strcpy(json_buff, "{\"error\":\"invalid pattern\"}");
+    return "/json.shtml";
   }
-  if (!apps_installed_found) {
-    DPRINTF("No subfolders found in %s\n", req_folder);
+  search_job_t *job = search_get(token, folder, pattern, nextItem);
+  if (!job) {
+    strcpy(json_buff, "{\"error\":\"invalid parameters\"}");
+    return "/json.shtml";
   }
-  /* Return JSON page (json_buff contains array or empty) */
+  if (job->error != FR_OK) {
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"search failed %d\"}", job->error);
+    search_release(job);
+    return "/json.shtml";
+  }
+  // Leave room for the longest match and the closing fields
+  int len = snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"results\":[");
+  int count = 0;
+  search_result_t result;
+  while (len < MAX_JSON_PAYLOAD_SIZE - JSON_DIR_ENTRY_SIZE - 64 &&
+         (limit <= 0 || count < limit) && search_read(job, &result)) {
+    unsigned ts = ((unsigned)result.fdate << 16) | (unsigned)result.ftime;
+    len += snprintf(json_buff + len, MAX_JSON_PAYLOAD_SIZE - len,
+                    "%s{\"p\":\"%s\",\"a\":%u,\"s\":%lu,\"t\":%u}",
+                    count ? "," : "", result.path, (unsigned)result.fattrib,
+                    (unsigned long)result.fsize, ts);
+    count++;
+  }
+  bool done = search_finished(job);
+  snprintf(json_buff + len, MAX_JSON_PAYLOAD_SIZE - len,
+           "],\"next\":%d,\"done\":%s,\"truncated\":%s}", job->delivered,
+           done ? "true" : "false", job->truncated ? "true" : "false");
+  if (done) search_release(job);
   return "/json.shtml";
 }
 
@@ -416,18 +825,68 @@ static const char *cgi_ls(int iIndex, int iNumParams, char *pcParam[],
 #define MAX_UPLOAD_CONTEXTS 4
 typedef struct {
   char token[32];
+  char path[256];
   FIL file;
+  writeback_stream_t *stream;  // Writes the chunks on core 1
   bool in_use;
+  uint32_t id;        // Tells apart the uploads using the context in turn
+  FSIZE_t size;       // Expected file size, 0 if unknown
+  uint32_t chunks;    // Number of chunks of the file
+  uint32_t received;  // Number of distinct chunks written
+  uint8_t *bitmap;    // One bit per chunk written, NULL if size is unknown
 } upload_ctx_t;
 static upload_ctx_t upload_contexts[MAX_UPLOAD_CONTEXTS] = {0};
-// Context for ongoing POST-based chunk upload
-static upload_ctx_t *current_chunk_ctx = NULL;
-static unsigned current_chunk_idx = 0;
+static uint32_t upload_counter = 0;
+// POST-based chunk uploads in progress, by connection. Each one writes at its
+// own offset, so chunks of the same file can arrive in parallel.
+#define MAX_POST_CHUNKS MEMP_NUM_PARALLEL_HTTPD_CONNS
+typedef struct {
+  void *connection;
+  upload_ctx_t *upload;
+  uint32_t uploadId;  // The upload may end while the chunk is received
+  uint32_t index;     // Chunk number
+  FSIZE_t offset;
+  UINT written;
+  bool failed;
+} post_chunk_t;
+static post_chunk_t post_chunks[MAX_POST_CHUNKS] = {0};
 
-// Find context by token
+static post_chunk_t *find_post_chunk(void *connection) {
+  for (int i = 0; i < MAX_POST_CHUNKS; i++) {
+    if (post_chunks[i].connection == connection) return &post_chunks[i];
+  }
+  return NULL;
+}
+
+// An entry left by an aborted POST is reused by the next POST of its
+// connection. Returns NULL if all the entries are taken: an entry in use is
+// never taken over, its data would go to the wrong chunk.
+static post_chunk_t *alloc_post_chunk(void *connection) {
+  post_chunk_t *chunk = find_post_chunk(connection);
+  for (int i = 0; i < MAX_POST_CHUNKS && !chunk; i++) {
+    if (post_chunks[i].connection == NULL) chunk = &post_chunks[i];
+  }
+  if (!chunk) return NULL;
+  memset(chunk, 0, sizeof(post_chunk_t));
+  chunk->connection = connection;
+  return chunk;
+}
+
+// The upload of a chunk, if it is still open for writing. It may have ended,
+// been cancelled, or its context reused by another upload.
+static upload_ctx_t *chunk_upload(const post_chunk_t *chunk) {
+  upload_ctx_t *upload = chunk->upload;
+  if (!upload || !upload->in_use || upload->id != chunk->uploadId ||
+      !upload->stream) {
+    return NULL;
+  }
+  return upload;
+}
+
+// Find context by token. An upload being cancelled has no stream anymore.
 static upload_ctx_t *find_upload_ctx(const char *token) {
   for (int i = 0; i < MAX_UPLOAD_CONTEXTS; i++) {
-    if (upload_contexts[i].in_use &&
+    if (upload_contexts[i].in_use && upload_contexts[i].stream &&
         strcmp(upload_contexts[i].token, token) == 0) {
       return &upload_contexts[i];
     }
@@ -440,6 +899,7 @@ static upload_ctx_t *alloc_upload_ctx(const char *token) {
   for (int i = 0; i < MAX_UPLOAD_CONTEXTS; i++) {
     if (!upload_contexts[i].in_use) {
       upload_contexts[i].in_use = true;
+      upload_contexts[i].id = ++upload_counter;
       strncpy(upload_contexts[i].token, token,
               sizeof(upload_contexts[i].token) - 1);
       upload_contexts[i].token[sizeof(upload_contexts[i].token) - 1] = '\0';
@@ -491,22 +951,78 @@ static void free_download_ctx(download_ctx_t *ctx) {
   }
 }
 
-// Free context and close file
-static void free_upload_ctx(upload_ctx_t *ctx) {
+// Free context and close file, once the chunks queued are written. Returns
+// the first error writing the file.
+static FRESULT free_upload_ctx(upload_ctx_t *ctx) {
+  FRESULT res = FR_OK;
   if (ctx->in_use) {
-    f_close(&ctx->file);
+    if (ctx->stream) res = writeback_close(ctx->stream);
+    ctx->stream = NULL;
+    FRESULT closed = f_close(&ctx->file);
+    if (res == FR_OK) res = closed;
+    free(ctx->bitmap);
+    ctx->bitmap = NULL;
     ctx->in_use = false;
   }
+  return res;
+}
+
+// Length of a chunk of an upload of known size
+static UINT upload_chunk_len(const upload_ctx_t *ctx, uint32_t chunk) {
+  FSIZE_t offset = (FSIZE_t)chunk * UPLOAD_CHUNK_SIZE;
+  FSIZE_t left = ctx->size - offset;
+  return (left < UPLOAD_CHUNK_SIZE) ? (UINT)left : UPLOAD_CHUNK_SIZE;
+}
+
+// Parse the number of a chunk, which must belong to the file: the data of a
+// chunk is written at its offset before the chunk is recorded
+static bool upload_parse_chunk(const upload_ctx_t *ctx, const char *str,
+                               uint32_t *chunk) {
+  if (!isdigit((unsigned char)*str)) return false;
+  char *end;
+  unsigned long n = strtoul(str, &end, 10);
+  if ((*end != '\0' && *end != '&') || n >= ctx->chunks) {
+    DPRINTF("Unexpected chunk %s\n", str);
+    return false;
+  }
+  *chunk = (uint32_t)n;
+  return true;
+}
+
+// Record a chunk written completely. Chunks may arrive in any order and more
+// than once. Returns false if the chunk doesn't belong to the file.
+static bool upload_mark_chunk(upload_ctx_t *ctx, uint32_t chunk, UINT len) {
+  if (!ctx->bitmap) return true;
+  if (chunk >= ctx->chunks || len != upload_chunk_len(ctx, chunk)) {
+    DPRINTF("Unexpected chunk %u of %u bytes\n", (unsigned)chunk,
+            (unsigned)len);
+    return false;
+  }
+  uint8_t mask = 1u << (chunk & 7);
+  if (!(ctx->bitmap[chunk >> 3] & mask)) {
+    ctx->bitmap[chunk >> 3] |= mask;
+    ctx->received++;
+  }
+  return true;
+}
+
+// First chunk not written yet, or the number of chunks if all are in
+static uint32_t upload_first_missing(const upload_ctx_t *ctx) {
+  for (uint32_t i = 0; i < ctx->chunks; i++) {
+    if (!(ctx->bitmap[i >> 3] & (1u << (i & 7)))) return i;
+  }
+  return ctx->chunks;
 }
 
 // CGI: start upload
 static const char *cgi_upload_start(int iIndex, int iNumParams, char *pcParam[],
                                     char *pcValue[]) {
-  const char *token = NULL, *fullpath = NULL;
+  const char *token = NULL, *fullpath = NULL, *sizeStr = NULL;
   char decoded_path[256];
   for (int i = 0; i < iNumParams; i++) {
     if (strcmp(pcParam[i], "token") == 0) token = pcValue[i];
     if (strcmp(pcParam[i], "fullpath") == 0) fullpath = pcValue[i];
+    if (strcmp(pcParam[i], "size") == 0) sizeStr = pcValue[i];
   }
   if (!token || !fullpath) {
     strcpy(json_buff, "{\"error\":\"missing parameters\"}");
@@ -523,13 +1039,49 @@ static const char *cgi_upload_start(int iIndex, int iNumParams, char *pcParam[],
   }
   // Open file for writing
   FRESULT res = f_open(&ctx->file, decoded_path, FA_WRITE | FA_CREATE_ALWAYS);
+  strcpy(ctx->path, decoded_path);
+  dircache_invalidate(decoded_path);
+  ctx->stream = NULL;
+  ctx->bitmap = NULL;
   if (res != FR_OK) {
     free_upload_ctx(ctx);
     strcpy(json_buff, "{\"error\":\"cannot open file\"}");
     return "/json.shtml";
   }
+  // Reserve the whole file in contiguous clusters, and check the free space
+  // before any chunk is sent. All the chunks are written before the end.
+  ctx->size = sizeStr ? (FSIZE_t)strtoull(sizeStr, NULL, 10) : 0;
+  res = sdcard_preallocate(&ctx->file, ctx->size);
+  if (res != FR_OK) {
+    free_upload_ctx(ctx);
+    f_unlink(decoded_path);
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"error\":\"%s\"}",
+             res == FR_DENIED ? "not enough space" : "cannot open file");
+    return "/json.shtml";
+  }
+  ctx->stream = writeback_open(&ctx->file, NULL, NULL);
+  if (!ctx->stream) {
+    free_upload_ctx(ctx);
+    f_unlink(decoded_path);
+    strcpy(json_buff, "{\"error\":\"no memory available\"}");
+    return "/json.shtml";
+  }
+  // With the file size known, track the chunks received so the end of the
+  // upload can be verified whatever the order of arrival
+  ctx->chunks = (uint32_t)((ctx->size + UPLOAD_CHUNK_SIZE - 1) /
+                           UPLOAD_CHUNK_SIZE);
+  ctx->received = 0;
+  if (ctx->chunks > 0) {
+    ctx->bitmap = calloc((ctx->chunks + 7) / 8, 1);
+    if (!ctx->bitmap) {
+      free_upload_ctx(ctx);
+      f_unlink(decoded_path);
+      strcpy(json_buff, "{\"error\":\"file too large\"}");
+      return "/json.shtml";
+    }
+  }
   // Return status, chunk size, and preferred method for client
-  snprintf(json_buff, sizeof(json_buff),
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
            "{\"status\":\"started\",\"chunkSize\":%d,\"method\":\"%s\"}",
            UPLOAD_CHUNK_SIZE, UPLOAD_CHUNK_METHOD);
 
@@ -550,7 +1102,11 @@ static const char *cgi_upload_chunk(int iIndex, int iNumParams, char *pcParam[],
     strcpy(json_buff, "{\"error\":\"invalid parameters\"}");
     return "/json.shtml";
   }
-  int chunk = atoi(chunkStr);
+  uint32_t chunk;
+  if (!upload_parse_chunk(ctx, chunkStr, &chunk)) {
+    strcpy(json_buff, "{\"error\":\"invalid chunk\"}");
+    return "/json.shtml";
+  }
   // URL-decode the base64 payload parameter
   size_t plen = strlen(payload) + 1;
   char *decodedPayload = malloc(plen);
@@ -562,6 +1118,11 @@ static const char *cgi_upload_chunk(int iIndex, int iNumParams, char *pcParam[],
   // Base64-decode the payload
   size_t outLen = strlen(decodedPayload) * 3 / 4;
   unsigned char *buffer = malloc(outLen);
+  if (!buffer) {
+    free(decodedPayload);
+    strcpy(json_buff, "{\"error\":\"no memory available\"}");
+    return "/json.shtml";
+  }
   size_t decodedLen;
   if (mbedtls_base64_decode(buffer, outLen, &decodedLen,
                             (const unsigned char *)decodedPayload,
@@ -572,15 +1133,23 @@ static const char *cgi_upload_chunk(int iIndex, int iNumParams, char *pcParam[],
     return "/json.shtml";
   }
   free(decodedPayload);
+  if (decodedLen != upload_chunk_len(ctx, chunk)) {
+    free(buffer);
+    strcpy(json_buff, "{\"error\":\"invalid chunk\"}");
+    return "/json.shtml";
+  }
   // Seek to chunk offset using fixed chunk size
-  f_lseek(&ctx->file, (DWORD)(chunk * UPLOAD_CHUNK_SIZE));
-  UINT written;
-  FRESULT res = f_write(&ctx->file, buffer, decodedLen, &written);
+  writeback_seek(ctx->stream, (FSIZE_t)chunk * UPLOAD_CHUNK_SIZE);
+  err_t err = writeback_write(ctx->stream, buffer, decodedLen);
   free(buffer);
-  if (res != FR_OK || written != decodedLen) {
+  if (err != ERR_OK) {
     strcpy(json_buff, "{\"error\":\"write failed\"}");
     return "/json.shtml";
   }
+  if (!upload_mark_chunk(ctx, chunk, (UINT)decodedLen)) {
+    strcpy(json_buff, "{\"error\":\"invalid chunk\"}");
+    return "/json.shtml";
+  }
   strcpy(json_buff, "{\"status\":\"chunk_ok\"}");
   return "/json.shtml";
 }
@@ -596,11 +1165,45 @@ static const char *cgi_upload_end(int iIndex, int iNumParams, char *pcParam[],
     strcpy(json_buff, "{\"error\":\"invalid token\"}");
     return "/json.shtml";
   }
-  free_upload_ctx(ctx);
+  if (ctx->bitmap && ctx->received < ctx->chunks) {
+    // Keep the upload open so the client can send the missing chunks
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"incomplete\",\"missing\":%u,\"next\":%u}",
+             (unsigned)(ctx->chunks - ctx->received),
+             (unsigned)upload_first_missing(ctx));
+    return "/json.shtml";
+  }
+  // Don't wait for core 1 inside lwIP: the client asks again until the chunks
+  // queued are on the card
+  writeback_flush(ctx->stream);
+  if (!writeback_isDrained(ctx->stream)) {
+    strcpy(json_buff, "{\"status\":\"writing\"}");
+    return "/json.shtml";
+  }
+  FRESULT res = free_upload_ctx(ctx);
+  // The size of the file changed since the upload started
+  dircache_invalidate(ctx->path);
+  if (res != FR_OK) {
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"write failed\",\"code\":%d}", res);
+    return "/json.shtml";
+  }
   strcpy(json_buff, "{\"status\":\"completed\"}");
   return "/json.shtml";
 }
 
+// Close and delete the file of a cancelled upload, once core 1 let it go. It
+// was preallocated to its full size, so it can't be kept with stale sectors.
+static void upload_cancelled(void *arg) {
+  upload_ctx_t *ctx = (upload_ctx_t *)arg;
+  f_close(&ctx->file);
+  f_unlink(ctx->path);
+  dircache_invalidate(ctx->path);
+  free(ctx->bitmap);
+  ctx->bitmap = NULL;
+  ctx->in_use = false;
+}
+
 // CGI: cancel upload
 static const char *cgi_upload_cancel(int iIndex, int iNumParams,
                                      char *pcParam[], char *pcValue[]) {
@@ -612,11 +1215,10 @@ static const char *cgi_upload_cancel(int iIndex, int iNumParams,
     strcpy(json_buff, "{\"error\":\"invalid token\"}");
     return "/json.shtml";
   }
-  // Optionally delete partial file
-  char path[256];
-  f_getcwd(path, sizeof(path));  // stub, adjust if needed
-  // Remove file using fullpath stored? Skipped
-  free_upload_ctx(ctx);
+  // The chunks not written yet are dropped without waiting for core 1
+  writeback_stream_t *stream = ctx->stream;
+  ctx->stream = NULL;
+  writeback_abort(stream, upload_cancelled, ctx);
   strcpy(json_buff, "{\"status\":\"cancelled\"}");
   return "/json.shtml";
 }
@@ -650,7 +1252,7 @@ static const char *cgi_download_start(int iIndex, int iNumParams,
     return "/json.shtml";
   }
   DWORD size = f_size(&ctx->file);
-  snprintf(json_buff, sizeof(json_buff),
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
            "{\"status\":\"started\",\"chunkSize\":%d,\"fileSize\":%lu}",
            DOWNLOAD_CHUNK_SIZE, (unsigned long)size);
   return "/json.shtml";
@@ -687,7 +1289,7 @@ static const char *cgi_download_chunk(int iIndex, int iNumParams,
     return "/json.shtml";
   }
   // JSON response with base64 data
-  snprintf(json_buff, sizeof(json_buff),
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
            "{\"status\":\"chunk\",\"length\":%u,\"data\":\"%.*s\"}",
            (unsigned)readBytes, (int)olen, b64buf);
   return "/json.shtml";
@@ -747,10 +1349,13 @@ static const char *cgi_ren(int iIndex, int iNumParams, char *pcParam[],
   char from[512], to[512];
   snprintf(from, sizeof(from), "%s/%s", df, ds);
   snprintf(to, sizeof(to), "%s/%s", df, dd);
+  close_dir_cursors();
   FRESULT r = f_rename(from, to);
+  dircache_invalidate(from);
+  dircache_invalidate(to);
   if (r != FR_OK)
-    snprintf(json_buff, sizeof(json_buff), "{\"error\":\"rename failed %d\"}",
-             r);
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"rename failed %d\"}", r);
   else
     strcpy(json_buff, "{\"status\":\"renamed\"}");
   return "/json.shtml";
@@ -797,13 +1402,15 @@ static const char *cgi_del(int iIndex, int iNumParams, char *pcParam[],
   }
   char path[512];
   snprintf(path, sizeof(path), "%s/%s", df, ds);
+  close_dir_cursors();
   FRESULT r = delete_path(path);
+  dircache_invalidate(path);
   if (r == FR_DENIED) {
-    snprintf(json_buff, sizeof(json_buff),
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
              "{\"error\":\"directory not empty\"}");
   } else if (r != FR_OK) {
-    snprintf(json_buff, sizeof(json_buff), "{\"error\":\"delete failed %d\"}",
-             r);
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"delete failed %d\"}", r);
   } else {
     strcpy(json_buff, "{\"status\":\"deleted\"}");
   }
@@ -837,14 +1444,268 @@ static const char *cgi_attr(int iIndex, int iNumParams, char *pcParam[],
   if (hide) attr |= AM_HID;
   // Apply only hidden and read-only bits
   FRESULT r = f_chmod(path, attr, AM_RDO | AM_HID);
+  dircache_invalidate(path);
   if (r != FR_OK)
-    snprintf(json_buff, sizeof(json_buff), "{\"error\":\"chmod failed %d\"}",
-             r);
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"chmod failed %d\"}", r);
   else
     strcpy(json_buff, "{\"status\":\"attributes updated\"}");
   return "/json.shtml";
 }
 
+// Batches of file operations POSTed to /batch.cgi, by connection. The body
+// has one operation per line, with the parameters of its CGI in query string
+// format, like "op=del&folder=%2Fgames&src=a.st". Each line runs as soon as it
+// is received, and the results are sent together when the body ends.
+#define MAX_BATCHES 2
+#define BATCH_LINE_SIZE 512
+#define BATCH_MAX_OPS 32
+#define BATCH_MAX_PARAMS 8
+#define BATCH_RESULTS_SIZE 1536
+typedef struct {
+  void *connection;
+  char line[BATCH_LINE_SIZE];
+  size_t lineLen;
+  bool overflow;  // The line is too long and is not run
+  char results[BATCH_RESULTS_SIZE];  // Responses of the operations run
+  size_t resultsLen;
+  bool truncated;  // The results of the last operations didn't fit
+  int ops;
+  int failed;
+  int skipped;  // Operations beyond BATCH_MAX_OPS, not run
+  uint32_t started;
+} batch_ctx_t;
+static batch_ctx_t batches[MAX_BATCHES] = {0};
+static uint32_t batch_counter = 0;
+
+// Operations of a batch, run by the handlers of their CGIs
+static const struct {
+  const char *name;
+  tCGIHandler handler;
+} batch_ops[] = {
+    {"ren", cgi_ren},
+    {"mkdir", cgi_mkdir},
+    {"del", cgi_del},
+    {"attr", cgi_attr},
+};
+
+static batch_ctx_t *find_batch(void *connection) {
+  for (int i = 0; i < MAX_BATCHES; i++) {
+    if (batches[i].connection == connection) return &batches[i];
+  }
+  return NULL;
+}
+
+// The oldest batch is assumed dead when all are taken. A batch still running
+// then gets an error when its body ends.
+static batch_ctx_t *alloc_batch(void *connection) {
+  batch_ctx_t *batch = find_batch(connection);
+  for (int i = 0; i < MAX_BATCHES && !batch; i++) {
+    if (batches[i].connection == NULL) batch = &batches[i];
+  }
+  if (!batch) {
+    batch = &batches[0];
+    for (int i = 1; i < MAX_BATCHES; i++) {
+      if (batches[i].started < batch->started) batch = &batches[i];
+    }
+  }
+  memset(batch, 0, sizeof(batch_ctx_t));
+  batch->connection = connection;
+  batch->started = ++batch_counter;
+  return batch;
+}
+
+// Split a query string in place into its parameters. The values are not
+// decoded, as CGI handlers get them.
+static int split_query(char *query, char *params[], char *values[], int max) {
+  int n = 0;
+  char *p = query;
+  while (*p && n < max) {
+    char *next = strchr(p, '&');
+    if (next) *next++ = '\0';
+    char *eq = strchr(p, '=');
+    if (eq) *eq++ = '\0';
+    params[n] = p;
+    values[n] = eq ? eq : p + strlen(p);
+    n++;
+    p = next ? next : p + strlen(p);
+  }
+  return n;
+}
+
+static void batch_run_line(batch_ctx_t *batch) {
+  char *line = batch->line;
+  line[batch->lineLen] = '\0';
+  if (batch->lineLen > 0 && line[batch->lineLen - 1] == '\r') {
+    line[batch->lineLen - 1] = '\0';
+  }
+  if (line[0] == '\0' && !batch->overflow) return;
+  if (batch->ops >= BATCH_MAX_OPS) {
+    batch->skipped++;
+    return;
+  }
+  const char *result = "{\"error\":\"line too long\"}";
+  if (!batch->overflow) {
+    char *params[BATCH_MAX_PARAMS], *values[BATCH_MAX_PARAMS];
+    int n = split_query(line, params, values, BATCH_MAX_PARAMS);
+    const char *op = NULL;
+    for (int i = 0; i < n; i++) {
+      if (!strcmp(params[i], "op")) op = values[i];
+    }
+    result = "{\"error\":\"unknown operation\"}";
+    for (size_t i = 0; op && i < sizeof(batch_ops) / sizeof(batch_ops[0]);
+         i++) {
+      if (!strcmp(op, batch_ops[i].name)) {
+        batch_ops[i].handler(0, n, params, values);
+        result = json_buff;
+        break;
+      }
+    }
+  }
+  DPRINTF("Batch operation %d: %s\n", batch->ops, result);
+  if (strncmp(result, "{\"status\"", 9) != 0) batch->failed++;
+  // Only whole results are kept, so the array stays valid JSON. Once one
+  // doesn't fit, the next ones are dropped too to keep them in order.
+  if (!batch->truncated) {
+    size_t room = sizeof(batch->results) - batch->resultsLen;
+    int len = snprintf(batch->results + batch->resultsLen, room, "%s%s",
+                       batch->ops > 0 ? "," : "", result);
+    if (len > 0 && (size_t)len < room) {
+      batch->resultsLen += len;
+    } else {
+      batch->results[batch->resultsLen] = '\0';
+      batch->truncated = true;
+    }
+  }
+  batch->ops++;
+}
+
+// Decode a path parameter into the buffer. Returns NULL if it is missing or
+// invalid.
+static const char *get_path_param(int iNumParams, char *pcParam[],
+                                  char *pcValue[], const char *name, char *out,
+                                  size_t outLen) {
+  for (int i = 0; i < iNumParams; i++) {
+    if (strcmp(pcParam[i], name) == 0) {
+      return url_decode(pcValue[i], out, outLen) ? out : NULL;
+    }
+  }
+  return NULL;
+}
+
+// CGI: queue a recursive delete, copy, move or extraction, run by the main
+// loop
+static const char *cgi_job_start(int iIndex, int iNumParams, char *pcParam[],
+                                 char *pcValue[]) {
+  const char *op_s = NULL;
+  char src[JOBS_PATH_SIZE], dst[JOBS_PATH_SIZE];
+  for (int i = 0; i < iNumParams; i++) {
+    if (!strcmp(pcParam[i], "op")) op_s = pcValue[i];
+  }
+  const char *s = get_path_param(iNumParams, pcParam, pcValue, "src", src,
+                                 sizeof(src));
+  const char *d = get_path_param(iNumParams, pcParam, pcValue, "dst", dst,
+                                 sizeof(dst));
+  jobs_op_t op;
+  if (op_s && !strcmp(op_s, "rmtree")) {
+    op = JOBS_OP_RMTREE;
+  } else if (op_s && !strcmp(op_s, "copy")) {
+    op = JOBS_OP_COPY;
+  } else if (op_s && !strcmp(op_s, "move")) {
+    op = JOBS_OP_MOVE;
+  } else if (op_s && !strcmp(op_s, "unzip")) {
+    op = JOBS_OP_UNZIP;
+  } else {
+    strcpy(json_buff, "{\"error\":\"invalid operation\"}");
+    return "/json.shtml";
+  }
+  if (!s || (op != JOBS_OP_RMTREE && !d)) {
+    strcpy(json_buff, "{\"error\":\"missing parameters\"}");
+    return "/json.shtml";
+  }
+  // The job deletes and renames folders that listings may have open
+  close_dir_cursors();
+  const char *error = NULL;
+  uint32_t id = jobs_start(op, s, d, &error);
+  if (id == 0) {
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"error\":\"%s\"}", error);
+  } else {
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"id\":%lu}",
+             (unsigned long)id);
+  }
+  return "/json.shtml";
+}
+
+static uint32_t get_job_id(int iNumParams, char *pcParam[], char *pcValue[]) {
+  for (int i = 0; i < iNumParams; i++) {
+    if (!strcmp(pcParam[i], "id")) return strtoul(pcValue[i], NULL, 10);
+  }
+  return 0;
+}
+
+// CGI: progress of a job
+static const char *cgi_job_status(int iIndex, int iNumParams, char *pcParam[],
+                                  char *pcValue[]) {
+  const jobs_job_t *job = jobs_get(get_job_id(iNumParams, pcParam, pcValue));
+  if (!job) {
+    strcpy(json_buff, "{\"error\":\"unknown job\"}");
+    return "/json.shtml";
+  }
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+           "{\"id\":%lu,\"op\":\"%s\",\"state\":\"%s\",\"files\":%lu,"
+           "\"folders\":%lu,\"bytes\":%llu,\"fileSize\":%llu,"
+           "\"fileDone\":%llu,\"errors\":%lu,\"lastError\":%d}",
+           (unsigned long)job->id, jobs_opName(job->op),
+           jobs_stateName(job->state), (unsigned long)job->filesDone,
+           (unsigned long)job->foldersDone,
+           (unsigned long long)job->bytesDone,
+           (unsigned long long)job->fileSize,
+           (unsigned long long)job->fileDone, (unsigned long)job->errors,
+           job->lastError);
+  return "/json.shtml";
+}
+
+// CGI: cancel a queued or running job
+static const char *cgi_job_cancel(int iIndex, int iNumParams, char *pcParam[],
+                                  char *pcValue[]) {
+  if (jobs_cancel(get_job_id(iNumParams, pcParam, pcValue))) {
+    strcpy(json_buff, "{\"status\":\"cancelled\"}");
+  } else {
+    strcpy(json_buff, "{\"error\":\"job not running\"}");
+  }
+  return "/json.shtml";
+}
+
+// CGI: list a folder inside a .st or .msa floppy image, reading only the
+// sectors needed
+static const char *cgi_image_ls(int iIndex, int iNumParams, char *pcParam[],
+                                char *pcValue[]) {
+  char image[MNGR_FILES_PATH_SIZE], folder[MNGR_FILES_PATH_SIZE];
+  const char *i = get_path_param(iNumParams, pcParam, pcValue, "image", image,
+                                 sizeof(image));
+  const char *f = get_path_param(iNumParams, pcParam, pcValue, "folder",
+                                 folder, sizeof(folder));
+  int nextItem = 0;
+  for (int j = 0; j < iNumParams; j++) {
+    if (strcmp(pcParam[j], "nextItem") == 0) nextItem = atoi(pcValue[j]);
+  }
+  if (!i || !floppy_isImage(i)) {
+    strcpy(json_buff, "{\"error\":\"not a floppy image\"}");
+    return "/json.shtml";
+  }
+  FRESULT fr = floppy_list(i, f ? f : "/", nextItem, json_buff,
+                           MAX_JSON_PAYLOAD_SIZE);
+  if (fr == FR_NO_FILESYSTEM) {
+    strcpy(json_buff, "{\"error\":\"invalid image\"}");
+  } else if (fr == FR_NO_PATH) {
+    strcpy(json_buff, "{\"error\":\"folder not found\"}");
+  } else if (fr != FR_OK) {
+    snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+             "{\"error\":\"read failed %d\"}", fr);
+  }
+  return "/json.shtml";
+}
+
 /**
  * @brief Array of CGI handlers for floppy select and eject operations.
  *
@@ -857,6 +1718,8 @@ static const tCGI cgi_handlers[] = {
     {"/folder.cgi", cgi_folder},
     {"/download.cgi", cgi_download},
     {"/ls.cgi", cgi_ls},
+    {"/find.cgi", cgi_find},
+    {"/zip.cgi", cgi_zip},
     {"/upload_start.cgi", cgi_upload_start},
     {"/upload_chunk.cgi", cgi_upload_chunk},
     {"/upload_end.cgi", cgi_upload_end},
@@ -865,6 +1728,10 @@ static const tCGI cgi_handlers[] = {
     {"/mkdir.cgi", cgi_mkdir},
     {"/del.cgi", cgi_del},
     {"/attr.cgi", cgi_attr},
+    {"/job_start.cgi", cgi_job_start},
+    {"/job_status.cgi", cgi_job_status},
+    {"/job_cancel.cgi", cgi_job_cancel},
+    {"/image_ls.cgi", cgi_image_ls},
     {"/download_start.cgi", cgi_download_start},
     {"/download_chunk.cgi", cgi_download_chunk},
     {"/download_end.cgi", cgi_download_end},
@@ -917,61 +1784,213 @@ static void httpd_server_init(const char *ssi_tags[], size_t num_tags,
   DPRINTF("HTTP server initialized.\n");
 }
 
+// POST /upload_chunk.cgi?token=...&chunk=...: one chunk of a started upload
+static const char *chunk_post_begin(void *connection, const char *uri,
+                                    int content_len) {
+  upload_ctx_t *upload = NULL;
+  const char *c = NULL;
+  // parse token and chunk index from querystring
+  const char *qs = strchr(uri, '?');
+  if (qs) {
+    // find token
+    const char *t = strstr(qs, "token=");
+    if (t) {
+      t += 6;  // skip 'token='
+      char buf[32];
+      int i = 0;
+      while (*t && *t != '&' && i < (int)sizeof(buf) - 1) buf[i++] = *t++;
+      buf[i] = '\0';
+      upload = find_upload_ctx(buf);
+    }
+    // find chunk
+    c = strstr(qs, "chunk=");
+  }
+  if (!upload) return "invalid token";
+  // Nothing is written outside of the file. The chunk also waits in pbufs
+  // while the ring is full, and its length bounds them.
+  uint32_t chunk_idx;
+  if (!c || !upload_parse_chunk(upload, c + 6, &chunk_idx) ||
+      content_len != (int)upload_chunk_len(upload, chunk_idx)) {
+    return "invalid chunk";
+  }
+  post_chunk_t *chunk = alloc_post_chunk(connection);
+  if (!chunk) return "too many chunks in progress";
+  chunk->upload = upload;
+  chunk->uploadId = upload->id;
+  chunk->index = chunk_idx;
+  chunk->offset = (FSIZE_t)chunk_idx * UPLOAD_CHUNK_SIZE;
+  return NULL;
+}
+
+static bool chunk_post_owns(void *connection) {
+  return find_post_chunk(connection) != NULL;
+}
+
+static void chunk_post_release(void *connection) {
+  post_chunk_t *chunk = find_post_chunk(connection);
+  if (chunk) memset(chunk, 0, sizeof(post_chunk_t));
+}
+
+// Queue binary chunk data for the file, at the offset of the chunk. Chunks
+// received in parallel share the stream of the upload.
+static err_t chunk_post_receive(void *connection, struct pbuf *p) {
+  post_chunk_t *chunk = find_post_chunk(connection);
+  upload_ctx_t *upload = chunk ? chunk_upload(chunk) : NULL;
+  if (!upload) {
+    if (chunk) chunk->failed = true;
+    pbuf_free(p);
+    return ERR_VAL;
+  }
+  UINT len = p->tot_len;
+  if (chunk->written + len > upload_chunk_len(upload, chunk->index)) {
+    chunk->failed = true;
+    pbuf_free(p);
+    return ERR_VAL;
+  }
+  writeback_seek(upload->stream, chunk->offset);
+  if (writeback_receive(upload->stream, p) == ERR_OK) {
+    chunk->offset += len;
+    chunk->written += len;
+  } else {
+    chunk->failed = true;
+  }
+  return ERR_OK;
+}
+
+static void chunk_post_finished(void *connection) {
+  post_chunk_t *chunk = find_post_chunk(connection);
+  upload_ctx_t *upload = chunk_upload(chunk);
+  bool failed = chunk->failed || !upload ||
+                !upload_mark_chunk(upload, chunk->index, chunk->written);
+  // clear context
+  memset(chunk, 0, sizeof(post_chunk_t));
+  strcpy(json_buff, failed ? "{\"error\":\"write failed\"}"
+                           : "{\"status\":\"chunk_ok\"}");
+}
+
+// POST /batch.cgi: file operations, one per line
+static const char *batch_post_begin(void *connection, const char *uri,
+                                    int content_len) {
+  LWIP_UNUSED_ARG(uri);
+  LWIP_UNUSED_ARG(content_len);
+  alloc_batch(connection);
+  return NULL;
+}
+
+static bool batch_post_owns(void *connection) {
+  return find_batch(connection) != NULL;
+}
+
+static void batch_post_release(void *connection) {
+  batch_ctx_t *batch = find_batch(connection);
+  if (batch) memset(batch, 0, sizeof(batch_ctx_t));
+}
+
+static err_t batch_post_receive(void *connection, struct pbuf *p) {
+  batch_ctx_t *batch = find_batch(connection);
+  for (struct pbuf *q = p; q != NULL; q = q->next) {
+    const char *data = (const char *)q->payload;
+    for (u16_t i = 0; i < q->len; i++) {
+      if (data[i] == '\n') {
+        batch_run_line(batch);
+        batch->lineLen = 0;
+        batch->overflow = false;
+      } else if (batch->lineLen < sizeof(batch->line) - 1) {
+        batch->line[batch->lineLen++] = data[i];
+      } else {
+        batch->overflow = true;
+      }
+    }
+  }
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static void batch_post_finished(void *connection) {
+  batch_ctx_t *batch = find_batch(connection);
+  // The last line may have no newline
+  batch_run_line(batch);
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE,
+           "{\"results\":[%s],\"truncated\":%s,\"ok\":%d,\"failed\":%d,"
+           "\"skipped\":%d}",
+           batch->results, batch->truncated ? "true" : "false",
+           batch->ops - batch->failed, batch->failed, batch->skipped);
+  memset(batch, 0, sizeof(batch_ctx_t));
+}
+
+static void files_post_finished(void *connection) {
+  mngr_files_uploadFinished(connection, json_buff, MAX_JSON_PAYLOAD_SIZE);
+}
+
+// POST handlers, by URI prefix. begin() returns an error message, or NULL if
+// it takes the body. The handler that owns a connection receives its body,
+// and finished() writes the response into json_buff. release() drops what a
+// handler keeps for a connection, left behind by a POST that was aborted.
+// A handler holding the window acknowledges the body itself with
+// httpd_post_data_recved(), and finished() waits until all of it is.
+typedef struct {
+  const char *prefix;
+  const char *(*begin)(void *connection, const char *uri, int content_len);
+  bool (*owns)(void *connection);
+  err_t (*receive)(void *connection, struct pbuf *p);
+  void (*finished)(void *connection);
+  void (*release)(void *connection);
+  bool holds_window;
+} post_route_t;
+static const post_route_t post_routes[] = {
+    // Whole file upload streamed into the SD card: POST /files/<path>
+    {MNGR_FILES_URI_PREFIX "/", mngr_files_uploadBegin, mngr_files_isUpload,
+     mngr_files_uploadReceive, files_post_finished, mngr_files_uploadRelease,
+     true},
+    {"/upload_chunk.cgi", chunk_post_begin, chunk_post_owns,
+     chunk_post_receive, chunk_post_finished, chunk_post_release, false},
+    {"/batch.cgi", batch_post_begin, batch_post_owns, batch_post_receive,
+     batch_post_finished, batch_post_release, false},
+};
+#define NUM_POST_ROUTES (sizeof(post_routes) / sizeof(post_routes[0]))
+
+static const post_route_t *find_post_route(void *connection) {
+  for (size_t i = 0; i < NUM_POST_ROUTES; i++) {
+    if (post_routes[i].owns(connection)) return &post_routes[i];
+  }
+  return NULL;
+}
+
 err_t httpd_post_begin(void *connection, const char *uri,
                        const char *http_request, u16_t http_request_len,
                        int content_len, char *response_uri,
                        u16_t response_uri_len, u8_t *post_auto_wnd) {
-  LWIP_UNUSED_ARG(connection);
   LWIP_UNUSED_ARG(http_request);
   LWIP_UNUSED_ARG(http_request_len);
-  LWIP_UNUSED_ARG(content_len);
-  LWIP_UNUSED_ARG(post_auto_wnd);
   DPRINTF("POST request for URI: %s\n", uri);
-  // Handle binary chunk upload via POST
-  if (strncmp(uri, "/upload_chunk.cgi", 17) == 0) {
-    // parse token and chunk index from querystring
-    const char *qs = strchr(uri, '?');
-    if (qs) {
-      // find token
-      const char *t = strstr(qs, "token=");
-      if (t) {
-        t += 6;  // skip 'token='
-        char buf[32];
-        int i = 0;
-        while (*t && *t != '&' && i < (int)sizeof(buf) - 1) buf[i++] = *t++;
-        buf[i] = '\0';
-        current_chunk_ctx = find_upload_ctx(buf);
-      }
-      // find chunk
-      const char *c = strstr(qs, "chunk=");
-      if (c) current_chunk_idx = atoi(c + 6);
-      if (current_chunk_ctx) {
-        // seek to correct offset
-        f_lseek(&current_chunk_ctx->file,
-                (DWORD)(current_chunk_idx * UPLOAD_CHUNK_SIZE));
-        current_connection = connection;
-        // allow immediate receive
-        *post_auto_wnd = 1;
-        return ERR_OK;
-      }
+  // httpd doesn't report the POSTs aborted, and reuses their connection
+  // pointers. Whatever a handler still keeps for this one belongs to a request
+  // gone, and would take the new body from the handler of its URI.
+  for (size_t i = 0; i < NUM_POST_ROUTES; i++) {
+    post_routes[i].release(connection);
+  }
+  const char *error = "not found";
+  const post_route_t *route = NULL;
+  for (size_t i = 0; i < NUM_POST_ROUTES && !route; i++) {
+    const char *prefix = post_routes[i].prefix;
+    if (strncmp(uri, prefix, strlen(prefix)) == 0) {
+      route = &post_routes[i];
+      error = route->begin(connection, uri, content_len);
     }
   }
+  if (!error) {
+    // allow immediate receive, unless the handler holds the window
+    *post_auto_wnd = route->holds_window ? 0 : 1;
+    return ERR_OK;
+  }
+  snprintf(json_buff, MAX_JSON_PAYLOAD_SIZE, "{\"error\":\"%s\"}", error);
+  strncpy(response_uri, "/json.shtml", response_uri_len);
   return ERR_VAL;
 }
 
 err_t httpd_post_receive_data(void *connection, struct pbuf *p) {
-  LWIP_UNUSED_ARG(connection);
-  // Write binary chunk data directly to file
-  if (connection == current_connection && current_chunk_ctx && p) {
-    UINT written;
-    // p->payload may be chained; write each segment
-    struct pbuf *q;
-    for (q = p; q != NULL; q = q->next) {
-      f_write(&current_chunk_ctx->file, q->payload, q->len, &written);
-    }
-    pbuf_free(p);
-    return ERR_OK;
-  }
+  const post_route_t *route = find_post_route(connection);
+  if (route) return route->receive(connection, p);
   // If the connection is not valid, return an error
   DPRINTF("POST data received for invalid connection\n");
   return ERR_VAL;
@@ -980,11 +1999,12 @@ err_t httpd_post_receive_data(void *connection, struct pbuf *p) {
 void httpd_post_finished(void *connection, char *response_uri,
                          u16_t response_uri_len) {
   DPRINTF("POST finished for connection\n");
-  // clear context
-  current_chunk_ctx = NULL;
-  current_chunk_idx = 0;
-  // respond with JSON status
-  strcpy(json_buff, "{\"status\":\"chunk_ok\"}");
+  const post_route_t *route = find_post_route(connection);
+  if (route) {
+    route->finished(connection);
+  } else {
+    strcpy(json_buff, "{\"error\":\"write failed\"}");
+  }
   // ensure LWIP returns our json
   strncpy(response_uri, "/json.shtml", response_uri_len);
 }
@@ -1004,6 +2024,7 @@ void httpd_post_finished(void *connection, char *response_uri,
  * for multipart SSI tags).
  * @param next_tag_part A pointer to the next part of the SSI tag to be
  * processed (used for multipart SSI tags).
+ * @param connection_state The response context of the connection, if any.
  * @return The length of the generated content.
  */
 static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
@@ -1011,6 +2032,10 @@ static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
                          ,
                          u16_t current_tag_part, u16_t *next_tag_part
 #endif /* LWIP_HTTPD_SSI_MULTIPART */
+#if LWIP_HTTPD_FILE_STATE
+                         ,
+                         void *connection_state
+#endif /* LWIP_HTTPD_FILE_STATE */
 ) {
   DPRINTF("SSI handler called with index %d\n", iIndex);
   size_t printed;
@@ -1032,11 +2057,25 @@ static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
     }
     case 7: /* JSONPLD */
     {
+#if LWIP_HTTPD_FILE_STATE
+      response_ctx_t *ctx = connection_state ? connection_state
+                                             : &overflow_response;
+#else
+      response_ctx_t *ctx = &overflow_response;
+#endif
+      if (ctx->dir.mode != JSON_DIR_NONE) {
+        printed = json_dir_fill(&ctx->dir, pcInsert, iInsertLen - 1);
+        pcInsert[printed] = '\0';
+        if (ctx->dir.mode != JSON_DIR_NONE) {
+          *next_tag_part = current_tag_part + 1;
+        }
+        break;
+      }
       // DPRINTF("SSI JSONPLD handler called with index %d\n", iIndex);
       int chunk_size = 128;
       /* The offset into json based on current tag part */
       size_t offset = current_tag_part * chunk_size;
-      size_t json_len = strlen(json_buff);
+      size_t json_len = strlen(ctx->json);
 
       /* If offset is beyond the end, we have no more data */
       if (offset >= json_len) {
@@ -1057,7 +2096,7 @@ static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
       }
 
       /* Copy that chunk into pcInsert */
-      memcpy(pcInsert, &json_buff[offset], chunk_len);
+      memcpy(pcInsert, &ctx->json[offset], chunk_len);
       pcInsert[chunk_len] = '\0'; /* null-terminate */
 
       printed = (u16_t)chunk_len;
@@ -1070,30 +2109,17 @@ static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
     }
     case 8: /* DWNLDSTS */
     {
-      download_status_t status = download_getStatus();
-
-      switch (status) {
-        case DOWNLOAD_STATUS_IDLE:
-        case DOWNLOAD_STATUS_COMPLETED:
-          printed = snprintf(pcInsert, iInsertLen, "%s",
-                             "<meta http-equiv='refresh' "
-                             "content='0;url=/browser_home.shtml'>");
-          break;
-          break;
-        case DOWNLOAD_STATUS_FAILED:
-          printed = snprintf(
-              pcInsert, iInsertLen,
-              "<meta http-equiv='refresh' "
-              "content='0;url=/"
-              "error.shtml?error=%d&error_msg=Download%%20error:%%20%s'>",
-              status, download_getErrorString());
-          break;
-          break;
-        default:
-          printed = snprintf(
-              pcInsert, iInsertLen, "%s",
-              "<meta http-equiv='refresh' content='5;url=/downloading.shtml'>");
-          break;
+      download_summary_t summary;
+      download_getSummary(&summary);
+      if (summary.busy == 0) {
+        printed = snprintf(pcInsert, iInsertLen, "%s",
+                           "<meta http-equiv='refresh' "
+                           "content='0;url=/browser_home.shtml'>");
+      } else {
+        // The page follows the progress events. Without scripts, reload.
+        printed = snprintf(pcInsert, iInsertLen, "%s",
+                           "<noscript><meta http-equiv='refresh' "
+                           "content='5;url=/downloading.shtml'></noscript>");
       }
       break;
     }
@@ -1122,6 +2148,8 @@ static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
 void mngr_httpd_start(int sdcard_err) {
   // Set the SD card status based on the error code
   sdcard_status = sdcard_err;
+  // Response context for the first JSON response
+  reserve_response();
   // Initialize the HTTP server with SSI tags and CGI handlers
   httpd_server_init(ssi_tags, LWIP_ARRAYSIZE(ssi_tags), ssi_handler,
                     cgi_handlers, LWIP_ARRAYSIZE(cgi_handlers));
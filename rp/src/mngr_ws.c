@@ -0,0 +1,551 @@
+/**
+ * File: mngr_ws.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: WebSocket channel of the file manager (RFC 6455)
+ */
+
+#include "mngr_ws.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// Close status codes
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOO_BIG 1009
+
+// Room for the header of the frames sent, never longer than 64K
+#define WS_FRAME_HEADER_SIZE 4
+
+// Operation, flags and id of the requests and responses
+#define WS_REQUEST_HEADER_SIZE 4
+
+// Size of an entry of a listing without its name
+#define WS_ENTRY_SIZE 14
+
+typedef enum {
+  WS_STATE_HANDSHAKE,  // Waiting for the HTTP upgrade request
+  WS_STATE_OPEN,
+  WS_STATE_CLOSING  // Closed once the last bytes are sent
+} ws_state_t;
+
+typedef struct {
+  struct tcp_pcb *pcb;
+  ws_state_t state;
+  uint8_t rx[MNGR_WS_RX_SIZE];
+  size_t rxLen;
+  uint8_t tx[MNGR_WS_TX_SIZE];
+  size_t txLen;
+  size_t txSent;  // Bytes of tx handed to lwIP
+  FIL file;
+  bool fileOpen;
+  bool fileWrite;  // Opened for writing
+  char filePath[MNGR_WS_PATH_SIZE];
+  absolute_time_t fileDeadline;
+} ws_client_t;
+
+static struct tcp_pcb *listener = NULL;
+static ws_client_t client = {0};
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const uint8_t *p) {
+  return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, v & 0xFFFF);
+  put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+  put32(p, (uint32_t)v);
+  put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void close_file(void) {
+  if (client.fileOpen) {
+    f_close(&client.file);
+    // The size of the file changed
+    if (client.fileWrite) dircache_invalidate(client.filePath);
+    client.fileOpen = false;
+  }
+}
+
+// Open the file of a read or write request, unless it is already open
+static FRESULT open_file(const char *path, bool write, bool truncate) {
+  if (client.fileOpen && client.fileWrite == write && !truncate &&
+      strcmp(client.filePath, path) == 0) {
+    return FR_OK;
+  }
+  close_file();
+  BYTE mode = FA_READ;
+  if (write) mode = FA_WRITE | (truncate ? FA_CREATE_ALWAYS : FA_OPEN_ALWAYS);
+  FRESULT fr = f_open(&client.file, path, mode);
+  if (fr != FR_OK) return fr;
+  if (write) dircache_invalidate(path);
+  client.fileOpen = true;
+  client.fileWrite = write;
+  strcpy(client.filePath, path);
+  return FR_OK;
+}
+
+// Returns ERR_ABRT if the PCB had to be aborted, to return it from the lwIP
+// callbacks
+static err_t close_client(void) {
+  err_t err = ERR_OK;
+  close_file();
+  if (client.pcb) {
+    tcp_arg(client.pcb, NULL);
+    tcp_recv(client.pcb, NULL);
+    tcp_sent(client.pcb, NULL);
+    tcp_err(client.pcb, NULL);
+    if (tcp_close(client.pcb) != ERR_OK) {
+      tcp_abort(client.pcb);
+      err = ERR_ABRT;
+    }
+    client.pcb = NULL;
+  }
+  DPRINTF("WebSocket client closed\n");
+  return err;
+}
+
+// Hand the response to lwIP as far as the send buffer allows. Called with the
+// lwIP lock held.
+static err_t flush_tx(void) {
+  if (!client.pcb) return ERR_OK;
+  size_t left = client.txLen - client.txSent;
+  u16_t room = tcp_sndbuf(client.pcb);
+  u16_t n = (left < room) ? (u16_t)left : room;
+  if (n > 0 &&
+      tcp_write(client.pcb, client.tx + client.txSent, n,
+                TCP_WRITE_FLAG_COPY) == ERR_OK) {
+    client.txSent += n;
+    tcp_output(client.pcb);
+  }
+  if (client.txSent < client.txLen) return ERR_OK;
+  client.txLen = 0;
+  client.txSent = 0;
+  return (client.state == WS_STATE_CLOSING) ? close_client() : ERR_OK;
+}
+
+// Send the payload written after the room for the frame header
+static void send_frame(uint8_t opcode, size_t len) {
+  uint8_t *h = client.tx;
+  if (len < 126) {
+    h += 2;
+    h[0] = 0x80 | opcode;
+    h[1] = (uint8_t)len;
+  } else {
+    h[0] = 0x80 | opcode;
+    h[1] = 126;
+    h[2] = (uint8_t)(len >> 8);
+    h[3] = (uint8_t)len;
+  }
+  client.txSent = h - client.tx;
+  client.txLen = WS_FRAME_HEADER_SIZE + len;
+}
+
+static void send_close(uint16_t code) {
+  uint8_t *payload = client.tx + WS_FRAME_HEADER_SIZE;
+  payload[0] = code >> 8;
+  payload[1] = code & 0xFF;
+  send_frame(WS_OPCODE_CLOSE, 2);
+  client.state = WS_STATE_CLOSING;
+}
+
+static err_t ws_recv(__unused void *arg, struct tcp_pcb *pcb, struct pbuf *p,
+                     err_t err) {
+  if (!p || err != ERR_OK) {
+    if (p) pbuf_free(p);
+    return close_client();
+  }
+  // lwIP offers the data again later, once the buffered requests are served
+  if (client.rxLen + p->tot_len > sizeof(client.rx)) return ERR_MEM;
+  pbuf_copy_partial(p, client.rx + client.rxLen, p->tot_len, 0);
+  client.rxLen += p->tot_len;
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t ws_sent(__unused void *arg, __unused struct tcp_pcb *pcb,
+                     __unused u16_t len) {
+  return flush_tx();
+}
+
+static void ws_err(__unused void *arg, err_t err) {
+  // The PCB is already freed
+  DPRINTF("WebSocket client error: %d\n", err);
+  client.pcb = NULL;
+  close_client();
+}
+
+static err_t ws_accept(__unused void *arg, struct tcp_pcb *pcb, err_t err) {
+  if (err != ERR_OK || !pcb) return ERR_VAL;
+  if (client.pcb) {
+    DPRINTF("WebSocket channel busy\n");
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  memset(&client, 0, sizeof(client));
+  client.pcb = pcb;
+  client.state = WS_STATE_HANDSHAKE;
+  tcp_nagle_disable(pcb);
+  tcp_recv(pcb, ws_recv);
+  tcp_sent(pcb, ws_sent);
+  tcp_err(pcb, ws_err);
+  DPRINTF("WebSocket client connected\n");
+  return ERR_OK;
+}
+
+// Value of a request header, case insensitive, in the NUL terminated request
+static bool find_header(const char *request, const char *name, char *out,
+                        size_t outLen) {
+  size_t nameLen = strlen(name);
+  for (const char *line = strstr(request, "\r\n"); line;
+       line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, name, nameLen) != 0 || line[nameLen] != ':') {
+      continue;
+    }
+    const char *value = line + nameLen + 1;
+    while (*value == ' ') value++;
+    size_t len = strcspn(value, "\r\n");
+    if (len >= outLen) return false;
+    memcpy(out, value, len);
+    out[len] = '\0';
+    return true;
+  }
+  return false;
+}
+
+// Answer the HTTP upgrade request with the accept key derived from the key of
+// the client. Returns false if more bytes are needed.
+static bool handle_handshake(void) {
+  char *end = NULL;
+  if (client.rxLen < sizeof(client.rx)) {
+    client.rx[client.rxLen] = '\0';
+    end = strstr((char *)client.rx, "\r\n\r\n");
+  }
+  if (!end) {
+    if (client.rxLen >= MNGR_WS_HANDSHAKE_SIZE) {
+      DPRINTF("WebSocket upgrade request too long\n");
+      client.rxLen = 0;
+      client.state = WS_STATE_CLOSING;
+    }
+    return false;
+  }
+  *end = '\0';
+  char key[64];
+  char *response = (char *)client.tx;
+  int len;
+  if (strncmp((char *)client.rx, "GET ", 4) == 0 &&
+      find_header((char *)client.rx, "Sec-WebSocket-Key", key,
+                  sizeof(key) - sizeof(WS_GUID))) {
+    strcat(key, WS_GUID);
+    unsigned char digest[20];
+    unsigned char accept[32];
+    size_t acceptLen = 0;
+    mbedtls_sha1_ret((const unsigned char *)key, strlen(key), digest);
+    mbedtls_base64_encode(accept, sizeof(accept), &acceptLen, digest,
+                          sizeof(digest));
+    len = snprintf(response, sizeof(client.tx),
+                   "HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: %s\r\n"
+                   "\r\n",
+                   accept);
+    client.state = WS_STATE_OPEN;
+  } else {
+    DPRINTF("Not a WebSocket upgrade request\n");
+    len = snprintf(response, sizeof(client.tx),
+                   "HTTP/1.1 400 Bad Request\r\n"
+                   "Connection: close\r\n"
+                   "Content-Length: 0\r\n"
+                   "\r\n");
+    client.state = WS_STATE_CLOSING;
+  }
+  size_t used = (uint8_t *)end + 4 - client.rx;
+  memmove(client.rx, client.rx + used, client.rxLen - used);
+  client.rxLen -= used;
+  client.txSent = 0;
+  client.txLen = len;
+  return true;
+}
+
+// Copy a path of a request into a NUL terminated string
+static bool get_path(const uint8_t *p, size_t len, char *path) {
+  if (len == 0 || len >= MNGR_WS_PATH_SIZE) return false;
+  memcpy(path, p, len);
+  path[len] = '\0';
+  return strlen(path) == len;
+}
+
+static uint8_t *put_entry(uint8_t *out, const uint8_t *end,
+                          const FILINFO *fno) {
+  size_t nameLen = strlen(fno->fname);
+  if (nameLen > 255 || out + WS_ENTRY_SIZE + nameLen > end) return NULL;
+  out[0] = fno->fattrib;
+  put16(out + 1, fno->fdate);
+  put16(out + 3, fno->ftime);
+  put64(out + 5, fno->fsize);
+  out[13] = (uint8_t)nameLen;
+  memcpy(out + WS_ENTRY_SIZE, fno->fname, nameLen);
+  return out + WS_ENTRY_SIZE + nameLen;
+}
+
+// Entries of a folder from the first one asked, as many as fit. Listings are
+// read from the directory cache, or straight from the SD card when they
+// don't fit in it.
+static FRESULT op_list(const char *path, uint32_t first, uint8_t *out,
+                       const uint8_t *end, size_t *outLen) {
+  uint16_t count = 0;
+  uint8_t more = 0;
+  uint8_t *entry = out + 3;
+  uint32_t index = 0;
+  FILINFO fno;
+  FRESULT fr = FR_OK;
+  dircache_listing_t *listing = dircache_get(path);
+  if (listing) {
+    size_t pos = 0;
+    while (dircache_read(listing, &pos, &fno)) {
+      if (index++ < first) continue;
+      uint8_t *next = put_entry(entry, end, &fno);
+      if (!next) {
+        more = 1;
+        break;
+      }
+      entry = next;
+      count++;
+    }
+    dircache_release(listing);
+  } else {
+    DIR dir;
+    fr = f_opendir(&dir, path);
+    bool opened = fr == FR_OK;
+    while (fr == FR_OK) {
+      fr = f_readdir(&dir, &fno);
+      if (fr != FR_OK || fno.fname[0] == '\0') break;
+      if (index++ < first) continue;
+      uint8_t *next = put_entry(entry, end, &fno);
+      if (!next) {
+        more = 1;
+        break;
+      }
+      entry = next;
+      count++;
+    }
+    if (opened) f_closedir(&dir);
+  }
+  if (fr != FR_OK) return fr;
+  put16(out, count);
+  out[2] = more;
+  *outLen = entry - out;
+  return FR_OK;
+}
+
+static FRESULT op_stat(const char *path, uint8_t *out, size_t *outLen) {
+  FILINFO fno;
+  FRESULT fr = f_stat(path, &fno);
+  if (fr != FR_OK) return fr;
+  out[0] = fno.fattrib;
+  put16(out + 1, fno.fdate);
+  put16(out + 3, fno.ftime);
+  put64(out + 5, fno.fsize);
+  *outLen = 13;
+  return FR_OK;
+}
+
+static FRESULT op_read(const char *path, FSIZE_t offset, uint32_t len,
+                       uint8_t *out, size_t *outLen) {
+  if (len > MNGR_WS_MAX_DATA) len = MNGR_WS_MAX_DATA;
+  FRESULT fr = open_file(path, false, false);
+  if (fr == FR_OK) fr = f_lseek(&client.file, offset);
+  UINT br = 0;
+  if (fr == FR_OK) fr = f_read(&client.file, out, len, &br);
+  if (fr != FR_OK) close_file();
+  *outLen = br;
+  return fr;
+}
+
+static FRESULT op_write(const char *path, bool truncate, FSIZE_t offset,
+                        const uint8_t *data, size_t len, uint8_t *out,
+                        size_t *outLen) {
+  FRESULT fr = open_file(path, true, truncate);
+  if (fr == FR_OK) fr = f_lseek(&client.file, offset);
+  UINT bw = 0;
+  if (fr == FR_OK) fr = f_write(&client.file, data, (UINT)len, &bw);
+  if (fr == FR_OK && bw < len) fr = FR_DENIED;  // Card full
+  if (fr != FR_OK) close_file();
+  put32(out, bw);
+  *outLen = 4;
+  return fr;
+}
+
+// Serve a binary request and build its response
+static void handle_request(const uint8_t *req, size_t len) {
+  uint8_t *res = client.tx + WS_FRAME_HEADER_SIZE;
+  uint8_t *body = res + WS_REQUEST_HEADER_SIZE;
+  const uint8_t *end = client.tx + sizeof(client.tx);
+  size_t bodyLen = 0;
+  uint8_t status = MNGR_WS_STATUS_BAD_REQUEST;
+  char path[MNGR_WS_PATH_SIZE];
+  if (len < WS_REQUEST_HEADER_SIZE) {
+    memset(res, 0, WS_REQUEST_HEADER_SIZE);
+    res[1] = status;
+    send_frame(WS_OPCODE_BINARY, WS_REQUEST_HEADER_SIZE);
+    return;
+  }
+  uint8_t op = req[0];
+  uint8_t flags = req[1];
+  const uint8_t *args = req + WS_REQUEST_HEADER_SIZE;
+  size_t argsLen = len - WS_REQUEST_HEADER_SIZE;
+  res[0] = op;
+  res[2] = req[2];
+  res[3] = req[3];
+  switch (op) {
+    case MNGR_WS_OP_LIST:
+      if (argsLen > 4 && get_path(args + 4, argsLen - 4, path)) {
+        status = op_list(path, get32(args), body, end, &bodyLen);
+      }
+      break;
+    case MNGR_WS_OP_STAT:
+      if (get_path(args, argsLen, path)) {
+        status = op_stat(path, body, &bodyLen);
+      }
+      break;
+    case MNGR_WS_OP_READ:
+      if (argsLen > 12 && get_path(args + 12, argsLen - 12, path)) {
+        status = op_read(path, get64(args), get32(args + 8), body, &bodyLen);
+      }
+      break;
+    case MNGR_WS_OP_WRITE: {
+      uint16_t pathLen = argsLen > 10 ? get16(args + 8) : 0;
+      if (pathLen > 0 && 10 + (size_t)pathLen <= argsLen &&
+          argsLen - 10 - pathLen <= MNGR_WS_MAX_DATA &&
+          get_path(args + 10, pathLen, path)) {
+        status = op_write(path, flags & MNGR_WS_FLAG_TRUNCATE, get64(args),
+                          args + 10 + pathLen, argsLen - 10 - pathLen, body,
+                          &bodyLen);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  if (status != FR_OK) bodyLen = 0;
+  res[1] = status;
+  send_frame(WS_OPCODE_BINARY, WS_REQUEST_HEADER_SIZE + bodyLen);
+  client.fileDeadline = make_timeout_time_ms(MNGR_WS_FILE_IDLE_MS);
+}
+
+// Serve the first frame received if it is complete. Returns false if more
+// bytes are needed.
+static bool handle_frame(void) {
+  uint8_t *rx = client.rx;
+  if (client.rxLen < 2) return false;
+  uint8_t opcode = rx[0] & 0x0F;
+  bool fin = (rx[0] & 0x80) != 0;
+  uint64_t len = rx[1] & 0x7F;
+  size_t header = 2;
+  if (len == 126) {
+    if (client.rxLen < 4) return false;
+    len = (rx[2] << 8) | rx[3];
+    header = 4;
+  } else if (len == 127) {
+    if (client.rxLen < 10) return false;
+    len = 0;
+    for (int i = 2; i < 10; i++) len = (len << 8) | rx[i];
+    header = 10;
+  }
+  // Frames of the clients are always masked
+  if (!(rx[1] & 0x80)) {
+    send_close(WS_CLOSE_PROTOCOL_ERROR);
+    return false;
+  }
+  if (len > sizeof(client.rx) - header - 4) {
+    send_close(WS_CLOSE_TOO_BIG);
+    return false;
+  }
+  if (client.rxLen < header + 4 + len) return false;
+  const uint8_t *mask = rx + header;
+  uint8_t *payload = rx + header + 4;
+  for (size_t i = 0; i < len; i++) payload[i] ^= mask[i & 3];
+  if (!fin || opcode == WS_OPCODE_CONTINUATION || opcode == WS_OPCODE_TEXT) {
+    // Requests are single binary frames
+    send_close(WS_CLOSE_UNSUPPORTED);
+  } else if (opcode == WS_OPCODE_BINARY) {
+    handle_request(payload, len);
+  } else if (opcode == WS_OPCODE_CLOSE) {
+    send_close(len >= 2 ? (payload[0] << 8) | payload[1] : 1000);
+  } else if (opcode == WS_OPCODE_PING) {
+    if (len <= sizeof(client.tx) - WS_FRAME_HEADER_SIZE) {
+      memcpy(client.tx + WS_FRAME_HEADER_SIZE, payload, len);
+      send_frame(WS_OPCODE_PONG, len);
+    }
+  }
+  size_t used = header + 4 + len;
+  memmove(client.rx, client.rx + used, client.rxLen - used);
+  client.rxLen -= used;
+  return true;
+}
+
+void mngr_ws_start(void) {
+  cyw43_arch_lwip_begin();
+  struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+  if (pcb && tcp_bind(pcb, IP_ANY_TYPE, MNGR_WS_PORT) == ERR_OK) {
+    listener = tcp_listen_with_backlog(pcb, 1);
+  }
+  if (listener) {
+    tcp_accept(listener, ws_accept);
+    DPRINTF("WebSocket channel listening on port %d\n", MNGR_WS_PORT);
+  } else {
+    DPRINTF("Cannot listen on port %d\n", MNGR_WS_PORT);
+    if (pcb) tcp_close(pcb);
+  }
+  cyw43_arch_lwip_end();
+}
+
+void mngr_ws_poll(void) {
+  if (client.fileOpen &&
+      absolute_time_diff_us(get_absolute_time(), client.fileDeadline) < 0) {
+    close_file();
+  }
+  if (!client.pcb) return;
+  cyw43_arch_lwip_begin();
+  flush_tx();
+  cyw43_arch_lwip_end();
+  for (int i = 0; i < MNGR_WS_STEP_REQUESTS; i++) {
+    // The response of the previous request must be handed to lwIP first
+    if (!client.pcb || client.txLen > 0 || client.state == WS_STATE_CLOSING) {
+      break;
+    }
+    bool served = (client.state == WS_STATE_HANDSHAKE) ? handle_handshake()
+                                                       : handle_frame();
+    cyw43_arch_lwip_begin();
+    flush_tx();
+    cyw43_arch_lwip_end();
+    if (!served) break;
+  }
+}
+
+void mngr_ws_suspend(void) { close_file(); }
@@ -142,3 +142,29 @@ void sdcard_getInfo(FATFS *fsPtr, uint32_t *totalSizeMb,
   // Convert bytes to megabytes
   *freeSpaceMb = freeSpaceBytes / SDCARD_MEGABYTE;
 }
+
+FRESULT sdcard_preallocate(FIL *file, FSIZE_t size) {
+  if (size == 0) return FR_OK;
+  FRESULT res = f_expand(file, size, 1);
+  if (res != FR_DENIED) return res;
+
+  // No contiguous area is large enough. The file can still be written if the
+  // free clusters add up to its size.
+  DWORD freClust;
+  FATFS *fsPtr;
+  res = f_getfree("", &freClust, &fsPtr);
+  if (res != FR_OK) {
+    DPRINTF("Error getting free space information: %d\n", res);
+    return res;
+  }
+  uint64_t clusterBytes = (uint64_t)fsPtr->csize * NUM_BYTES_PER_SECTOR;
+  uint64_t needed = ((uint64_t)size + clusterBytes - 1) / clusterBytes;
+  if (needed > freClust) {
+    DPRINTF("Not enough free space: %llu clusters needed, %lu free\n",
+            (unsigned long long)needed, (unsigned long)freClust);
+    return FR_DENIED;
+  }
+  DPRINTF("Free space fragmented, %llu bytes not preallocated\n",
+          (unsigned long long)size);
+  return FR_OK;
+}
@@ -0,0 +1,280 @@
+/**
+ * File: search.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Background recursive search of the SD card
+ */
+
+#include "search.h"
+
+// Fixed part of a packed match, followed by the path without terminator
+typedef struct {
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  BYTE fattrib;
+  uint16_t pathLen;
+} search_packed_t;
+
+static search_job_t search_jobs[SEARCH_MAX_JOBS] = {0};
+
+static bool char_equal(char a, char b) {
+  return tolower((unsigned char)a) == tolower((unsigned char)b);
+}
+
+// '*' matches any run of characters and '?' any single one
+static bool glob_match(const char *pattern, const char *name) {
+  const char *star = NULL;
+  const char *retry = NULL;
+  while (*name) {
+    if (*pattern == '*') {
+      star = pattern++;
+      retry = name;
+    } else if (*pattern == '?' || char_equal(*pattern, *name)) {
+      pattern++;
+      name++;
+    } else if (star) {
+      // Let the last star take one more character
+      pattern = star + 1;
+      name = ++retry;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') pattern++;
+  return *pattern == '\0';
+}
+
+static bool name_matches(const char *pattern, const char *name) {
+  if (strpbrk(pattern, "*?")) return glob_match(pattern, name);
+  size_t len = strlen(pattern);
+  for (const char *p = name; strlen(p) >= len; p++) {
+    size_t i = 0;
+    while (i < len && char_equal(p[i], pattern[i])) i++;
+    if (i == len) return true;
+  }
+  return false;
+}
+
+// No separator after the root folder
+static const char *separator(const char *path) {
+  size_t len = strlen(path);
+  return (len > 0 && path[len - 1] == '/') ? "" : "/";
+}
+
+static void close_folder(search_job_t *job) {
+  if (job->open) {
+    f_closedir(&job->dir);
+    job->open = false;
+  }
+}
+
+static void free_job(search_job_t *job) {
+  close_folder(job);
+  job->in_use = false;
+}
+
+// Make room at the end of the results buffer for the longest match
+static bool results_room(search_job_t *job) {
+  size_t need = sizeof(search_packed_t) + SEARCH_PATH_SIZE;
+  if (job->head == job->tail) job->head = job->tail = 0;
+  if (job->tail + need <= SEARCH_RESULTS_SIZE) return true;
+  if (job->head == 0) return false;
+  memmove(job->results, job->results + job->head, job->tail - job->head);
+  job->tail -= job->head;
+  job->head = 0;
+  return job->tail + need <= SEARCH_RESULTS_SIZE;
+}
+
+static void add_result(search_job_t *job, const char *path,
+                       const FILINFO *fno) {
+  if (job->skip > 0) {
+    // Already sent before the search was restarted
+    job->skip--;
+    return;
+  }
+  search_packed_t packed = {.fsize = fno->fsize,
+                            .fdate = fno->fdate,
+                            .ftime = fno->ftime,
+                            .fattrib = fno->fattrib,
+                            .pathLen = (uint16_t)strlen(path)};
+  memcpy(job->results + job->tail, &packed, sizeof(packed));
+  memcpy(job->results + job->tail + sizeof(packed), path, packed.pathLen);
+  job->tail += sizeof(packed) + packed.pathLen;
+}
+
+// Remember a subfolder to visit as its level and its name
+static void push_folder(search_job_t *job, const char *name) {
+  size_t nameLen = strlen(name);
+  if (job->depth >= SEARCH_MAX_DEPTH ||
+      job->stackLen + nameLen + 2 > SEARCH_STACK_SIZE) {
+    DPRINTF("Search skips %s/%s\n", job->path, name);
+    job->truncated = true;
+    return;
+  }
+  job->stack[job->stackLen++] = (uint8_t)(job->depth + 1);
+  memcpy(job->stack + job->stackLen, name, nameLen + 1);
+  job->stackLen += nameLen + 1;
+}
+
+// Move to the last subfolder pushed. Its parent is still the path at the level
+// below, as the subfolders of the folders visited in between are all popped.
+static bool pop_folder(search_job_t *job) {
+  if (job->stackLen == 0) return false;
+  size_t start = job->stackLen - 1;  // Terminator of the name
+  while (start > 0 && job->stack[start - 1] != '\0') start--;
+  int depth = job->stack[start];
+  const char *name = (const char *)&job->stack[start + 1];
+  int len = job->pathLen[depth - 1];
+  job->path[len] = '\0';
+  len += snprintf(job->path + len, sizeof(job->path) - len, "%s%s",
+                  separator(job->path), name);
+  job->pathLen[depth] = len;
+  job->depth = depth;
+  job->read = 0;
+  job->stackLen = start;
+  return true;
+}
+
+// Open the current folder, skipping the entries read before it was closed
+static bool open_folder(search_job_t *job) {
+  FRESULT fr = f_opendir(&job->dir, job->path);
+  if (fr != FR_OK) {
+    DPRINTF("Search cannot open %s: %d\n", job->path, fr);
+    if (job->depth == 0) job->error = fr;
+    return false;
+  }
+  job->open = true;
+  FILINFO fno;
+  for (int i = 0; i < job->read; i++) {
+    if (f_readdir(&job->dir, &fno) != FR_OK || fno.fname[0] == '\0') break;
+  }
+  return true;
+}
+
+static void search_step(search_job_t *job) {
+  FILINFO fno;
+  for (int n = 0; n < SEARCH_STEP_ENTRIES; n++) {
+    if (!results_room(job)) return;  // Wait for the client to fetch them
+    // A folder that can't be opened or read is searched as if it was empty
+    FRESULT fr = FR_INT_ERR;
+    if (job->open || open_folder(job)) fr = f_readdir(&job->dir, &fno);
+    if (fr != FR_OK || fno.fname[0] == '\0') {
+      close_folder(job);
+      if (job->error != FR_OK || !pop_folder(job)) {
+        DPRINTF("Search of %s in %s done\n", job->pattern, job->folder);
+        job->done = true;
+        return;
+      }
+      continue;
+    }
+    job->read++;
+    char path[SEARCH_PATH_SIZE];
+    int len = snprintf(path, sizeof(path), "%s%s%s", job->path,
+                       separator(job->path), fno.fname);
+    if (len >= (int)sizeof(path)) {
+      job->truncated = true;
+      continue;
+    }
+    if (name_matches(job->pattern, fno.fname)) add_result(job, path, &fno);
+    if (fno.fattrib & AM_DIR) push_folder(job, fno.fname);
+  }
+}
+
+// Take the search of the token, or the least recently fetched one
+static search_job_t *alloc_job(const char *token) {
+  search_job_t *job = NULL;
+  for (int i = 0; i < SEARCH_MAX_JOBS; i++) {
+    search_job_t *j = &search_jobs[i];
+    if (!j->in_use || strcmp(j->token, token) == 0) {
+      job = j;
+      break;
+    }
+    if (!job || absolute_time_diff_us(j->deadline, job->deadline) > 0) {
+      job = j;
+    }
+  }
+  free_job(job);
+  memset(job, 0, sizeof(search_job_t));
+  return job;
+}
+
+search_job_t *search_get(const char *token, const char *folder,
+                         const char *pattern, int index) {
+  if (!token || !token[0] || strlen(token) >= sizeof(search_jobs[0].token)) {
+    return NULL;
+  }
+  for (int i = 0; i < SEARCH_MAX_JOBS; i++) {
+    search_job_t *j = &search_jobs[i];
+    if (j->in_use && strcmp(j->token, token) == 0 &&
+        strcmp(j->folder, folder) == 0 && strcmp(j->pattern, pattern) == 0 &&
+        j->delivered == index) {
+      j->deadline = make_timeout_time_ms(SEARCH_TIMEOUT_MS);
+      return j;
+    }
+  }
+  if (strlen(folder) >= SEARCH_PATH_SIZE ||
+      strlen(pattern) >= SEARCH_PATTERN_SIZE) {
+    return NULL;
+  }
+  search_job_t *job = alloc_job(token);
+  job->in_use = true;
+  strncpy(job->token, token, sizeof(job->token) - 1);
+  strcpy(job->folder, folder);
+  strcpy(job->pattern, pattern);
+  // The folder without its trailing slash, except for the root
+  strcpy(job->path, folder);
+  int len = strlen(job->path);
+  while (len > 1 && job->path[len - 1] == '/') job->path[--len] = '\0';
+  job->pathLen[0] = len;
+  job->skip = index;
+  job->delivered = index;
+  job->deadline = make_timeout_time_ms(SEARCH_TIMEOUT_MS);
+  DPRINTF("Searching %s in %s from match %d\n", pattern, folder, index);
+  return job;
+}
+
+bool search_read(search_job_t *job, search_result_t *result) {
+  if (job->head == job->tail) return false;
+  search_packed_t packed;
+  memcpy(&packed, job->results + job->head, sizeof(packed));
+  memcpy(result->path, job->results + job->head + sizeof(packed),
+         packed.pathLen);
+  result->path[packed.pathLen] = '\0';
+  result->fsize = packed.fsize;
+  result->fdate = packed.fdate;
+  result->ftime = packed.ftime;
+  result->fattrib = packed.fattrib;
+  job->head += sizeof(packed) + packed.pathLen;
+  job->delivered++;
+  return true;
+}
+
+bool search_finished(const search_job_t *job) {
+  return job->done && job->head == job->tail;
+}
+
+void search_release(search_job_t *job) {
+  if (job) free_job(job);
+}
+
+void search_suspend(void) {
+  for (int i = 0; i < SEARCH_MAX_JOBS; i++) {
+    close_folder(&search_jobs[i]);
+  }
+}
+
+void search_poll(void) {
+  absolute_time_t now = get_absolute_time();
+  for (int i = 0; i < SEARCH_MAX_JOBS; i++) {
+    search_job_t *job = &search_jobs[i];
+    if (!job->in_use) continue;
+    if (absolute_time_diff_us(now, job->deadline) < 0) {
+      DPRINTF("Dropping idle search %s\n", job->token);
+      free_job(job);
+      continue;
+    }
+    if (!job->done) search_step(job);
+  }
+}
@@ -3,6 +3,7 @@
 static reset_callback_t __not_in_flash_func(reset_cb) = NULL;
 static reset_callback_t __not_in_flash_func(reset_long_cb) =
     NULL;  // New long-press callback
+static idle_callback_t idle_cb = NULL;  // Work done while waiting
 
 void __not_in_flash_func(select_waitPush)() {
   DPRINTF("Waiting for SELECT button to be released\n");
@@ -43,10 +44,13 @@ bool select_detectPush() { return (gpio_get(SELECT_GPIO) != 0); }
 void select_coreWaitPush(reset_callback_t reset, reset_callback_t resetLong) {
   inline void core1_waitPush(void) {
     DPRINTF("Waiting for SELECT button to be pushed\n");
-    // Wait until the SELECT button is pushed.
+    // Wait until the SELECT button is pushed. Sleep only when the idle
+    // callback had nothing to do.
     while (!select_detectPush()) {
-      tight_loop_contents();
-      sleep_ms(SELECT_LOOP_DELAY);
+      if (idle_cb == NULL || !idle_cb()) {
+        tight_loop_contents();
+        sleep_ms(SELECT_LOOP_DELAY);
+      }
     }
     DPRINTF("SELECT button pushed!\n");
     select_waitPush();
@@ -76,4 +80,5 @@ void select_checkPushReset() {
 void select_setResetCallback(reset_callback_t reset) { reset_cb = reset; }
 void select_setLongResetCallback(reset_callback_t resetLong) {
   reset_long_cb = resetLong;
-}
\ No newline at end of file
+}
+void select_setIdleCallback(idle_callback_t idle) { idle_cb = idle; }
\ No newline at end of file
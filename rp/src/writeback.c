@@ -0,0 +1,317 @@
+/**
+ * File: writeback.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: Writes to the SD card done by core 1 behind the network
+ */
+
+#include "writeback.h"
+
+static writeback_stream_t streams[WRITEBACK_MAX_STREAMS] = {0};
+
+_Static_assert(WRITEBACK_BUFFER_SIZE % FF_MIN_SS == 0,
+               "The buffers must hold whole sectors");
+
+// Room left in the buffer at head. A buffer ends at a sector boundary, so only
+// the first and the last writes of a run are not whole sectors.
+static UINT buffer_room(const writeback_stream_t *stream) {
+  UINT size = WRITEBACK_BUFFER_SIZE -
+              (UINT)(stream->offset[stream->head % WRITEBACK_BUFFERS] %
+                     FF_MIN_SS);
+  return size - stream->fill;
+}
+
+// Hand the buffer at head over to core 1
+static void publish(writeback_stream_t *stream) {
+  stream->length[stream->head % WRITEBACK_BUFFERS] = stream->fill;
+  stream->fill = 0;
+  __dmb();
+  stream->head++;
+}
+
+// Report the buffers written by core 1, which can be filled again
+static void reap(writeback_stream_t *stream) {
+  uint32_t tail = stream->tail;
+  __dmb();
+  while (stream->acked != tail) {
+    UINT len = stream->length[stream->acked % WRITEBACK_BUFFERS];
+    stream->acked++;
+    if (stream->recved) stream->recved(stream->arg, (u16_t)len);
+  }
+}
+
+// Copy as much data as fits in the free buffers
+static size_t copy_in(writeback_stream_t *stream, const uint8_t *data,
+                      size_t len) {
+  size_t copied = 0;
+  while (copied < len && stream->head - stream->acked < WRITEBACK_BUFFERS) {
+    uint32_t index = stream->head % WRITEBACK_BUFFERS;
+    if (stream->fill == 0) stream->offset[index] = stream->position;
+    size_t n = buffer_room(stream);
+    if (n > len - copied) n = len - copied;
+    memcpy(&stream->data[index * WRITEBACK_BUFFER_SIZE + stream->fill],
+           &data[copied], n);
+    stream->fill += n;
+    stream->position += n;
+    copied += n;
+    if (buffer_room(stream) == 0) publish(stream);
+  }
+  return copied;
+}
+
+// Copy the data that follows somewhere else in the file to a new buffer
+static void move_to(writeback_stream_t *stream, FSIZE_t offset) {
+  if (offset == stream->position) return;
+  // The buffer being filled is only written up to here
+  if (stream->fill > 0) publish(stream);
+  stream->position = offset;
+}
+
+// Copy the pbufs of a chain that fit in the free buffers, freeing them.
+// Returns the rest of the chain.
+static struct pbuf *copy_chain(writeback_stream_t *stream, struct pbuf *p) {
+  while (p) {
+    u16_t len = p->len;
+    size_t n = copy_in(stream, (const uint8_t *)p->payload, len);
+    if (n < len) return pbuf_free_header(p, (u16_t)n);
+    // Unlink the pbuf copied, even if empty, and keep the rest of the chain
+    struct pbuf *q = p;
+    p = p->next;
+    q->next = NULL;
+    pbuf_free(q);
+  }
+  return NULL;
+}
+
+// Copy the segments kept with the ring full, each one at its offset
+static void queue_pending(writeback_stream_t *stream) {
+  while (stream->pending) {
+    writeback_segment_t *segment = stream->pending;
+    move_to(stream, segment->offset);
+    segment->p = copy_chain(stream, segment->p);
+    segment->offset = stream->position;
+    if (segment->p) break;
+    stream->pending = segment->next;
+    free(segment);
+  }
+  if (stream->pending) return;
+  stream->last = NULL;
+  // A flush asked for with data waiting applies once the data is in
+  if (stream->flush) {
+    if (stream->fill > 0) publish(stream);
+    stream->flush = false;
+  }
+}
+
+// Free the segments kept and their pbufs
+static void drop_pending(writeback_stream_t *stream) {
+  while (stream->pending) {
+    writeback_segment_t *segment = stream->pending;
+    stream->pending = segment->next;
+    pbuf_free(segment->p);
+    free(segment);
+  }
+  stream->last = NULL;
+}
+
+// Queue the data received at the current position, and keep the part of it
+// that doesn't fit in the ring after the data already waiting. The data goes
+// to the last segment if it follows it in the file, to a new one otherwise.
+static err_t keep_pending(writeback_stream_t *stream, struct pbuf *p) {
+  FSIZE_t offset = stream->received;
+  stream->received += p->tot_len;
+  if (!stream->pending) {
+    move_to(stream, offset);
+    p = copy_chain(stream, p);
+    if (!p) return ERR_OK;
+    offset = stream->position;
+  }
+  writeback_segment_t *last = stream->last;
+  if (last && last->end == offset) {
+    pbuf_cat(last->p, p);
+  } else {
+    writeback_segment_t *segment = malloc(sizeof(writeback_segment_t));
+    if (!segment) {
+      DPRINTF("No memory to keep the data received\n");
+      pbuf_free(p);
+      return ERR_MEM;
+    }
+    segment->next = NULL;
+    segment->p = p;
+    segment->offset = offset;
+    if (last) {
+      last->next = segment;
+    } else {
+      stream->pending = segment;
+    }
+    stream->last = last = segment;
+  }
+  last->end = stream->received;
+  return ERR_OK;
+}
+
+writeback_stream_t *writeback_open(FIL *file, writeback_recved_t recved,
+                                   void *arg) {
+  for (int i = 0; i < WRITEBACK_MAX_STREAMS; i++) {
+    writeback_stream_t *stream = &streams[i];
+    if (stream->in_use) continue;
+    stream->data = malloc(WRITEBACK_BUFFERS * WRITEBACK_BUFFER_SIZE);
+    if (!stream->data) {
+      DPRINTF("No memory for the write buffers\n");
+      return NULL;
+    }
+    // head and tail keep counting from the last use: core 1 only looks at
+    // the stream again once head moves
+    stream->in_use = true;
+    stream->file = file;
+    stream->error = FR_OK;
+    stream->dropping = false;
+    stream->flush = false;
+    stream->fill = 0;
+    stream->position = f_tell(file);
+    stream->received = stream->position;
+    stream->acked = stream->head;
+    stream->pending = NULL;
+    stream->last = NULL;
+    stream->recved = recved;
+    stream->arg = arg;
+    return stream;
+  }
+  DPRINTF("No write stream available\n");
+  return NULL;
+}
+
+void writeback_detach(writeback_stream_t *stream) { stream->recved = NULL; }
+
+void writeback_seek(writeback_stream_t *stream, FSIZE_t offset) {
+  // The data already kept keeps its own offset
+  stream->received = offset;
+}
+
+err_t writeback_receive(writeback_stream_t *stream, struct pbuf *p) {
+  if (stream->error != FR_OK) {
+    pbuf_free(p);
+    return ERR_VAL;
+  }
+  // Never wait for core 1 here, it would stall lwIP. With a recved callback
+  // the sender can't send more than the window while the pbufs wait, without
+  // it the owner bounds the data it receives.
+  return keep_pending(stream, p);
+}
+
+err_t writeback_write(writeback_stream_t *stream, const void *data,
+                      size_t len) {
+  if (stream->error != FR_OK) return ERR_VAL;
+  const uint8_t *bytes = (const uint8_t *)data;
+  size_t n = 0;
+  if (!stream->pending) {
+    move_to(stream, stream->received);
+    n = copy_in(stream, bytes, len);
+    stream->received += n;
+  }
+  if (n == len) return ERR_OK;
+  // The rest waits in a pbuf, as the data received with the ring full
+  if (len - n > 0xFFFF) return ERR_MEM;
+  struct pbuf *p = pbuf_alloc(PBUF_RAW, (u16_t)(len - n), PBUF_RAM);
+  if (!p) return ERR_MEM;
+  pbuf_take(p, bytes + n, (u16_t)(len - n));
+  return keep_pending(stream, p);
+}
+
+void writeback_flush(writeback_stream_t *stream) {
+  stream->flush = true;
+  if (!stream->pending) queue_pending(stream);
+}
+
+bool writeback_isDrained(const writeback_stream_t *stream) {
+  return !stream->pending && stream->fill == 0 &&
+         stream->tail == stream->head;
+}
+
+FRESULT writeback_close(writeback_stream_t *stream) {
+  // The owners only close drained streams from lwIP callbacks, so this only
+  // waits outside of them. The pbufs left are written too, unless a write
+  // already failed.
+  while (stream->pending && stream->error == FR_OK) {
+    reap(stream);
+    queue_pending(stream);
+    tight_loop_contents();
+  }
+  drop_pending(stream);
+  writeback_flush(stream);
+  while (stream->tail != stream->head) tight_loop_contents();
+  reap(stream);
+  FRESULT res = stream->error;
+  free(stream->data);
+  stream->data = NULL;
+  stream->in_use = false;
+  return res;
+}
+
+void writeback_abort(writeback_stream_t *stream, writeback_closed_t closed,
+                     void *arg) {
+  stream->recved = NULL;
+  drop_pending(stream);
+  stream->fill = 0;
+  stream->closed = closed;
+  stream->closedArg = arg;
+  // Core 1 skips the buffers queued from now on
+  __dmb();
+  stream->dropping = true;
+}
+
+void writeback_poll(void) {
+  for (int i = 0; i < WRITEBACK_MAX_STREAMS; i++) {
+    writeback_stream_t *stream = &streams[i];
+    if (!stream->in_use) continue;
+    if (stream->dropping) {
+      // Free the stream once core 1 is done with the buffer it was writing
+      if (stream->tail != stream->head) continue;
+      free(stream->data);
+      stream->data = NULL;
+      stream->in_use = false;
+      if (stream->closed) stream->closed(stream->closedArg);
+      continue;
+    }
+    reap(stream);
+    queue_pending(stream);
+  }
+}
+
+bool writeback_work(void) {
+  bool worked = false;
+  for (int i = 0; i < WRITEBACK_MAX_STREAMS; i++) {
+    writeback_stream_t *stream = &streams[i];
+    uint32_t tail = stream->tail;
+    if (stream->head == tail) continue;
+    // The buffer is complete before head moves
+    __dmb();
+    uint32_t index = tail % WRITEBACK_BUFFERS;
+    // After an error or an abort the buffers are dropped, so core 0 doesn't
+    // wait forever
+    if (stream->error == FR_OK && !stream->dropping) {
+      FIL *file = stream->file;
+      UINT len = stream->length[index];
+      FRESULT res = FR_OK;
+      if (f_tell(file) != stream->offset[index]) {
+        res = f_lseek(file, stream->offset[index]);
+      }
+      UINT written = 0;
+      if (res == FR_OK) {
+        res = f_write(file, &stream->data[index * WRITEBACK_BUFFER_SIZE], len,
+                      &written);
+      }
+      // Disk full reports FR_OK with a short write
+      if (res == FR_OK && written != len) res = FR_DENIED;
+      if (res != FR_OK) {
+        DPRINTF("Error writing behind: %d\n", res);
+        stream->error = res;
+      }
+    }
+    __dmb();
+    stream->tail = tail + 1;
+    worked = true;
+  }
+  return worked;
+}
@@ -0,0 +1,516 @@
+/**
+ * File: zip.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2026
+ * Copyright: 2026 - GOODDATA LABS SL
+ * Description: ZIP archives of SD card folders built on the fly
+ */
+
+#include "zip.h"
+
+// Version 2.0, MS-DOS attributes. The CRC32 follows the data of each entry in
+// a data descriptor. The names are in the OEM code page of FatFS, CP437, the
+// default encoding of ZIP.
+#define ZIP_VERSION 20
+#define ZIP_FLAGS 0x0008
+
+#define CRC_TABLE \
+  ((uint32_t *)((uint8_t *)&__rom_in_ram_start__ + ZIP_CRC_TABLE_OFFSET))
+_Static_assert(ZIP_CRC_TABLE_OFFSET < 2 * ROM_SIZE_BYTES,
+               "The CRC table must fit in the ROM in RAM area");
+
+typedef enum {
+  ZIP_STATE_IDLE,
+  ZIP_STATE_SIZING,      // Walking the folder to find the archive size
+  ZIP_STATE_LOCAL,       // Next entry and its local header
+  ZIP_STATE_DATA,        // Content of the file of the entry
+  ZIP_STATE_DESCRIPTOR,  // CRC32 and sizes of the entry
+  ZIP_STATE_CENTRAL,     // Walking the folder again for the central directory
+  ZIP_STATE_END,
+  ZIP_STATE_DONE,
+  ZIP_STATE_FAILED
+} zip_state_t;
+
+// Walk of the folder, depth first, in directory order. Like the searches, only
+// the folder being read is open and the subfolders found wait on a stack. The
+// archive walks the folder three times and gets the same entries every time.
+typedef struct {
+  char path[ZIP_PATH_SIZE];  // Folder being read
+  int pathLen[ZIP_MAX_DEPTH + 1];
+  int depth;
+  DIR dir;
+  bool open;
+  int read;  // Entries of the folder read, skipped when reopening it
+  uint8_t stack[ZIP_STACK_SIZE];
+  size_t stackLen;
+} zip_walk_t;
+
+typedef struct {
+  zip_state_t state;
+  zip_walk_t walk;
+  char root[ZIP_PATH_SIZE];  // Folder archived, without trailing slash
+  int rootLen;
+  uint32_t entries;      // Entries found by the sizing walk
+  uint64_t size;         // Size of the archive
+  uint64_t cdOffset;     // Offset of the central directory
+  uint32_t index;        // Entry being sent
+  uint32_t offset;       // Bytes of the archive sent
+  uint32_t entryOffset;  // Local header of the entry in the central directory
+  FIL file;
+  bool fileOpen;
+  uint32_t fileSize;
+  uint32_t fileLeft;
+  uint32_t crc;
+  uint8_t pending[ZIP_CENTRAL_SIZE + ZIP_PATH_SIZE];  // Header being sent
+  int pendingLen;
+  int pendingSent;
+} zip_stream_t;
+
+static zip_stream_t stream = {0};
+
+// DMA channel of the sniffer, claimed on the first CRC32. -1 if there was
+// none free: the CRC32 is then computed by the CPU.
+static int sniff_channel = -2;
+static uint32_t sniff_sink;
+
+static uint32_t bit_reverse(uint32_t v) {
+  v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+  v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+  v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+  return (v >> 16) | (v << 16);
+}
+
+static uint32_t crc32_software(uint32_t crc, const uint8_t *data,
+                               size_t len) {
+  static const uint32_t nibbles[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+      0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ nibbles[crc & 0x0F];
+    crc = (crc >> 4) ^ nibbles[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// The sniffer computes the CRC32 of the bytes a DMA channel reads, here while
+// copying them to a single word. Its accumulator holds the CRC register bit
+// reversed, and reads back reversed and inverted as the final CRC32.
+static uint32_t crc32_dma(uint32_t crc, const uint8_t *data, size_t len) {
+  dma_channel_config c = dma_channel_get_default_config(sniff_channel);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_sniff_enable(&c, true);
+  dma_hw->sniff_data = bit_reverse(~crc);
+  dma_sniffer_enable(sniff_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+  dma_sniffer_set_output_reverse_enabled(true);
+  dma_sniffer_set_output_invert_enabled(true);
+  dma_channel_configure(sniff_channel, &c, &sniff_sink, data, len, true);
+  dma_channel_wait_for_finish_blocking(sniff_channel);
+  crc = dma_hw->sniff_data;
+  dma_sniffer_disable();
+  return crc;
+}
+
+uint32_t zip_crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  if (sniff_channel == -2) {
+    sniff_channel = dma_claim_unused_channel(false);
+    DPRINTF("CRC32 DMA sniffer channel: %d\n", sniff_channel);
+  }
+  if (sniff_channel >= 0 && len >= ZIP_DMA_CRC_MIN_SIZE) {
+    return crc32_dma(crc, data, len);
+  }
+  return crc32_software(crc, data, len);
+}
+
+// No separator after the root folder
+static const char *separator(const char *path) {
+  size_t len = strlen(path);
+  return (len > 0 && path[len - 1] == '/') ? "" : "/";
+}
+
+static void walk_close(zip_walk_t *walk) {
+  if (walk->open) {
+    f_closedir(&walk->dir);
+    walk->open = false;
+  }
+}
+
+static void walk_start(zip_walk_t *walk, const char *folder) {
+  walk_close(walk);
+  memset(walk, 0, sizeof(zip_walk_t));
+  // The folder without its trailing slash, except for the root
+  strncpy(walk->path, folder, sizeof(walk->path) - 1);
+  int len = strlen(walk->path);
+  while (len > 1 && walk->path[len - 1] == '/') walk->path[--len] = '\0';
+  walk->pathLen[0] = len;
+}
+
+// Subfolders too deep or not fitting in the stack are left out, the same way
+// on every walk
+static void walk_push(zip_walk_t *walk, const char *name) {
+  size_t nameLen = strlen(name);
+  if (walk->depth >= ZIP_MAX_DEPTH ||
+      walk->stackLen + nameLen + 2 > ZIP_STACK_SIZE) {
+    DPRINTF("Archive skips %s/%s\n", walk->path, name);
+    return;
+  }
+  walk->stack[walk->stackLen++] = (uint8_t)(walk->depth + 1);
+  memcpy(walk->stack + walk->stackLen, name, nameLen + 1);
+  walk->stackLen += nameLen + 1;
+}
+
+static bool walk_pop(zip_walk_t *walk) {
+  if (walk->stackLen == 0) return false;
+  size_t start = walk->stackLen - 1;  // Terminator of the name
+  while (start > 0 && walk->stack[start - 1] != '\0') start--;
+  int depth = walk->stack[start];
+  const char *name = (const char *)&walk->stack[start + 1];
+  int len = walk->pathLen[depth - 1];
+  walk->path[len] = '\0';
+  len += snprintf(walk->path + len, sizeof(walk->path) - len, "%s%s",
+                  separator(walk->path), name);
+  walk->pathLen[depth] = len;
+  walk->depth = depth;
+  walk->read = 0;
+  walk->stackLen = start;
+  return true;
+}
+
+static FRESULT walk_open(zip_walk_t *walk) {
+  FRESULT fr = f_opendir(&walk->dir, walk->path);
+  if (fr != FR_OK) return fr;
+  walk->open = true;
+  FILINFO fno;
+  for (int i = 0; i < walk->read; i++) {
+    fr = f_readdir(&walk->dir, &fno);
+    if (fr != FR_OK) return fr;
+  }
+  return FR_OK;
+}
+
+// Get the next entry and its name in the archive, with a trailing slash for
+// the folders. Returns 1 for an entry, 0 at the end and -1 on error.
+static int walk_next(zip_walk_t *walk, int rootLen, FILINFO *fno, char *name,
+                     size_t nameSize) {
+  for (;;) {
+    FRESULT fr = walk->open ? FR_OK : walk_open(walk);
+    if (fr == FR_OK) fr = f_readdir(&walk->dir, fno);
+    if (fr != FR_OK) {
+      DPRINTF("Archive cannot read %s: %d\n", walk->path, fr);
+      return -1;
+    }
+    if (fno->fname[0] == '\0') {
+      walk_close(walk);
+      if (!walk_pop(walk)) return 0;
+      continue;
+    }
+    walk->read++;
+    // Names relative to the folder archived
+    const char *rel = walk->path + rootLen;
+    if (*rel == '/') rel++;
+    bool isDir = (fno->fattrib & AM_DIR) != 0;
+    int len = snprintf(name, nameSize, "%s%s%s%s", rel, *rel ? "/" : "",
+                       fno->fname, isDir ? "/" : "");
+    if (len >= (int)nameSize) {
+      DPRINTF("Archive skips %s/%s\n", walk->path, fno->fname);
+      continue;
+    }
+    if (isDir) walk_push(walk, fno->fname);
+    return 1;
+  }
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void close_file(void) {
+  if (stream.fileOpen) {
+    f_close(&stream.file);
+    stream.fileOpen = false;
+  }
+}
+
+static void fail(const char *reason) {
+  DPRINTF("Archive failed at %lu bytes: %s\n", (unsigned long)stream.offset,
+          reason);
+  close_file();
+  walk_close(&stream.walk);
+  stream.state = ZIP_STATE_FAILED;
+}
+
+static void set_pending(int len) {
+  stream.pendingLen = len;
+  stream.pendingSent = 0;
+}
+
+// Local header of the next entry, without CRC32 nor sizes: they go in the
+// data descriptor after the data
+static void next_local(void) {
+  FILINFO fno;
+  char name[ZIP_PATH_SIZE];
+  int r = walk_next(&stream.walk, stream.rootLen, &fno, name, sizeof(name));
+  if (r < 0) {
+    fail("cannot read the folder");
+    return;
+  }
+  if (r == 0) {
+    if (stream.index != stream.entries || stream.offset != stream.cdOffset) {
+      fail("the folder changed");
+      return;
+    }
+    walk_start(&stream.walk, stream.root);
+    stream.index = 0;
+    stream.entryOffset = 0;
+    stream.state = ZIP_STATE_CENTRAL;
+    return;
+  }
+  if (stream.index >= stream.entries) {
+    fail("the folder changed");
+    return;
+  }
+  uint16_t nameLen = (uint16_t)strlen(name);
+  uint8_t *h = stream.pending;
+  memset(h, 0, ZIP_LOCAL_SIZE);
+  put32(h, ZIP_LOCAL_SIG);
+  put16(h + 4, ZIP_VERSION);
+  put16(h + 6, ZIP_FLAGS);
+  put16(h + 10, fno.ftime);
+  put16(h + 12, fno.fdate);
+  put16(h + 26, nameLen);
+  memcpy(h + ZIP_LOCAL_SIZE, name, nameLen);
+  set_pending(ZIP_LOCAL_SIZE + nameLen);
+  stream.crc = 0;
+  stream.fileSize = 0;
+  stream.fileLeft = 0;
+  stream.state = ZIP_STATE_DESCRIPTOR;
+  if (fno.fattrib & AM_DIR) return;
+  char path[ZIP_PATH_SIZE];
+  snprintf(path, sizeof(path), "%s%s%s", stream.walk.path,
+           separator(stream.walk.path), fno.fname);
+  FRESULT fr = f_open(&stream.file, path, FA_READ);
+  if (fr != FR_OK) {
+    DPRINTF("Archive cannot open %s: %d\n", path, fr);
+    fail("cannot open a file");
+    return;
+  }
+  stream.fileOpen = true;
+  stream.fileSize = (uint32_t)fno.fsize;
+  stream.fileLeft = stream.fileSize;
+  stream.state = ZIP_STATE_DATA;
+}
+
+// Read the file straight into the buffer of httpd
+static int read_data(uint8_t *buffer, int count) {
+  if (stream.fileLeft == 0) {
+    close_file();
+    stream.state = ZIP_STATE_DESCRIPTOR;
+    return 0;
+  }
+  UINT want = ((UINT)count < stream.fileLeft) ? (UINT)count : stream.fileLeft;
+  UINT br = 0;
+  FRESULT fr = f_read(&stream.file, buffer, want, &br);
+  if (fr != FR_OK || br != want) {
+    fail("cannot read a file");
+    return -1;
+  }
+  stream.crc = zip_crc32(stream.crc, buffer, br);
+  stream.fileLeft -= br;
+  return (int)br;
+}
+
+static void next_descriptor(void) {
+  uint8_t *d = stream.pending;
+  put32(d, ZIP_DESCRIPTOR_SIG);
+  put32(d + 4, stream.crc);
+  put32(d + 8, stream.fileSize);
+  put32(d + 12, stream.fileSize);
+  set_pending(ZIP_DESCRIPTOR_SIZE);
+  CRC_TABLE[stream.index++] = stream.crc;
+  stream.state = ZIP_STATE_LOCAL;
+}
+
+// Central directory entry of the next entry, found by walking the folder
+// again. Its offset follows from the sizes of the entries before it.
+static void next_central(void) {
+  FILINFO fno;
+  char name[ZIP_PATH_SIZE];
+  int r = walk_next(&stream.walk, stream.rootLen, &fno, name, sizeof(name));
+  if (r < 0) {
+    fail("cannot read the folder");
+    return;
+  }
+  if (r == 0) {
+    if (stream.index != stream.entries) {
+      fail("the folder changed");
+      return;
+    }
+    stream.state = ZIP_STATE_END;
+    return;
+  }
+  if (stream.index >= stream.entries) {
+    fail("the folder changed");
+    return;
+  }
+  bool isDir = (fno.fattrib & AM_DIR) != 0;
+  uint32_t size = isDir ? 0 : (uint32_t)fno.fsize;
+  uint16_t nameLen = (uint16_t)strlen(name);
+  uint8_t *h = stream.pending;
+  memset(h, 0, ZIP_CENTRAL_SIZE);
+  put32(h, ZIP_CENTRAL_SIG);
+  put16(h + 4, ZIP_VERSION);
+  put16(h + 6, ZIP_VERSION);
+  put16(h + 8, ZIP_FLAGS);
+  put16(h + 12, fno.ftime);
+  put16(h + 14, fno.fdate);
+  put32(h + 16, CRC_TABLE[stream.index]);
+  put32(h + 20, size);
+  put32(h + 24, size);
+  put16(h + 28, nameLen);
+  put32(h + 38, fno.fattrib);
+  put32(h + 42, stream.entryOffset);
+  memcpy(h + ZIP_CENTRAL_SIZE, name, nameLen);
+  set_pending(ZIP_CENTRAL_SIZE + nameLen);
+  stream.entryOffset += ZIP_LOCAL_SIZE + nameLen + size + ZIP_DESCRIPTOR_SIZE;
+  stream.index++;
+}
+
+static void next_end(void) {
+  if (stream.entryOffset != stream.cdOffset) {
+    fail("the folder changed");
+    return;
+  }
+  uint8_t *e = stream.pending;
+  memset(e, 0, ZIP_END_SIZE);
+  put32(e, ZIP_END_SIG);
+  put16(e + 8, (uint16_t)stream.entries);
+  put16(e + 10, (uint16_t)stream.entries);
+  put32(e + 12, (uint32_t)(stream.size - stream.cdOffset - ZIP_END_SIZE));
+  put32(e + 16, (uint32_t)stream.cdOffset);
+  set_pending(ZIP_END_SIZE);
+  stream.state = ZIP_STATE_DONE;
+}
+
+bool zip_open(const char *folder) {
+  if (stream.state != ZIP_STATE_IDLE) {
+    DPRINTF("Another archive is being built\n");
+    return false;
+  }
+  memset(&stream, 0, sizeof(stream));
+  walk_start(&stream.walk, folder);
+  strcpy(stream.root, stream.walk.path);
+  stream.rootLen = stream.walk.pathLen[0];
+  stream.state = ZIP_STATE_SIZING;
+  DPRINTF("Archiving %s\n", stream.walk.path);
+  return true;
+}
+
+int zip_prepare(const char **error) {
+  if (stream.state == ZIP_STATE_FAILED) {
+    *error = "cannot read the folder";
+    return -1;
+  }
+  if (stream.state != ZIP_STATE_SIZING) return 1;
+  FILINFO fno;
+  char name[ZIP_PATH_SIZE];
+  for (int n = 0; n < ZIP_STEP_ENTRIES; n++) {
+    int r = walk_next(&stream.walk, stream.rootLen, &fno, name, sizeof(name));
+    if (r < 0) {
+      fail("cannot read the folder");
+      *error = "cannot read the folder";
+      return -1;
+    }
+    if (r == 0) {
+      stream.size = stream.cdOffset + stream.size + ZIP_END_SIZE;
+      DPRINTF("Archive of %lu entries, %llu bytes\n",
+              (unsigned long)stream.entries, (unsigned long long)stream.size);
+      // Walk again from the folder archived to send the entries
+      walk_start(&stream.walk, stream.root);
+      stream.state = ZIP_STATE_LOCAL;
+      return 1;
+    }
+    uint64_t size = (fno.fattrib & AM_DIR) ? 0 : fno.fsize;
+    size_t nameLen = strlen(name);
+    // The local entries, then the central directory in stream.size
+    stream.cdOffset += ZIP_LOCAL_SIZE + nameLen + size + ZIP_DESCRIPTOR_SIZE;
+    stream.size += ZIP_CENTRAL_SIZE + nameLen;
+    stream.entries++;
+    if (stream.entries > ZIP_MAX_ENTRIES || stream.entries >= 0xFFFF) {
+      fail("too many files");
+      *error = "too many files";
+      return -1;
+    }
+    if (stream.cdOffset + stream.size + ZIP_END_SIZE >= 0xFFFFFFFFull) {
+      fail("too large");
+      *error = "too large";
+      return -1;
+    }
+  }
+  return 0;
+}
+
+uint32_t zip_size(void) { return (uint32_t)stream.size; }
+
+int zip_read(uint8_t *buffer, int count) {
+  int done = 0;
+  while (done < count) {
+    if (stream.pendingSent < stream.pendingLen) {
+      int n = stream.pendingLen - stream.pendingSent;
+      if (n > count - done) n = count - done;
+      memcpy(buffer + done, stream.pending + stream.pendingSent, n);
+      stream.pendingSent += n;
+      stream.offset += n;
+      done += n;
+      continue;
+    }
+    switch (stream.state) {
+      case ZIP_STATE_LOCAL:
+        next_local();
+        break;
+      case ZIP_STATE_DATA: {
+        int n = read_data(buffer + done, count - done);
+        if (n > 0) {
+          stream.offset += n;
+          done += n;
+        }
+        break;
+      }
+      case ZIP_STATE_DESCRIPTOR:
+        next_descriptor();
+        break;
+      case ZIP_STATE_CENTRAL:
+        next_central();
+        break;
+      case ZIP_STATE_END:
+        next_end();
+        break;
+      case ZIP_STATE_DONE:
+        return done;
+      default:
+        // Send what was ready before the failure
+        return done > 0 ? done : -1;
+    }
+  }
+  return done;
+}
+
+void zip_close(void) {
+  if (stream.state == ZIP_STATE_IDLE) return;
+  DPRINTF("Archive closed after %lu bytes\n", (unsigned long)stream.offset);
+  close_file();
+  walk_close(&stream.walk);
+  stream.state = ZIP_STATE_IDLE;
+}
+
+void zip_suspend(void) { walk_close(&stream.walk); }